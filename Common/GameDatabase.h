@@ -0,0 +1,156 @@
+// Supported games, shared by DirtFix.exe to find and configure them, and by the
+// dinput8.dll shim to stand aside in game builds that already include a fix.
+// Both binaries compile this one table, so they can't disagree about a game.
+
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+// Installation directories, under each store's library directory.
+constexpr const char* GAME_DIRS[]
+{
+	"DiRT Rally",									// Steam
+	"DiRT Rally 2.0",								// Steam and Microsoft
+	"DiRT 4",										// Steam
+	"codemasters-dirt-rally/World/application",		// Oculus
+	"codemasters-dirt-rally-2-0",					// Oculus
+	"GRID Autosport",								// Steam
+};
+
+// Executables are recognised by these appearing in their product name.
+constexpr std::string_view GAME_PRODUCT_TOKENS[]{ "DiRT", "GRID" };
+
+// Names of the game executables, which are checked first when looking for a
+// game in a directory. Others are only checked if none of these match.
+constexpr std::string_view GAME_EXE_NAMES[]
+{
+	"drt.exe",						// DiRT Rally
+	"dirtrally2.exe",				// DiRT Rally 2.0
+	"dirt4.exe",					// DiRT 4
+	"GRIDAutosport.exe",			// GRID Autosport
+	"GRIDAutosport_avx.exe",
+};
+
+constexpr uint64_t MakeVersion(uint16_t major, uint16_t minor, uint16_t revision, uint16_t build)
+{
+	return (static_cast<uint64_t>(major) << 48) | (static_cast<uint64_t>(minor) << 32) |
+		(static_cast<uint64_t>(revision) << 16) | build;
+}
+
+struct FixedGame
+{
+	std::string_view product_name;
+	uint64_t fixed_version;		// first product version including a fix
+};
+
+constexpr FixedGame FIXED_GAMES[]
+{
+	{ "DiRT Rally 2.0", MakeVersion(1, 10, 129, 1631) },	// 1.10.1 patch
+};
+
+// Parse a product version string, such as "1, 10, 129, 1631" or "1.10.129.1631",
+// with any missing parts treated as zero. Returns zero if there are no digits,
+// or a part is too large for a version resource to hold.
+constexpr uint64_t ParseVersion(std::string_view version)
+{
+	uint64_t parts[4]{};
+	size_t part = 0;
+	bool any_digits = false;
+
+	for (auto c : version)
+	{
+		if (c >= '0' && c <= '9')
+		{
+			parts[part] = parts[part] * 10 + static_cast<uint64_t>(c - '0');
+			if (parts[part] > UINT16_MAX)
+				return 0;
+
+			any_digits = true;
+		}
+		else if (c == ',' || c == '.')
+		{
+			if (++part == std::size(parts))
+				break;
+		}
+		else if (c != ' ')
+			break;
+	}
+
+	if (!any_digits)
+		return 0;
+
+	return MakeVersion(static_cast<uint16_t>(parts[0]), static_cast<uint16_t>(parts[1]),
+		static_cast<uint16_t>(parts[2]), static_cast<uint16_t>(parts[3]));
+}
+
+constexpr bool IsSupportedProduct(std::string_view product_name)
+{
+	for (auto token : GAME_PRODUCT_TOKENS)
+	{
+		if (product_name.find(token) != std::string_view::npos)
+			return true;
+	}
+
+	return false;
+}
+
+constexpr bool IsKnownGameExe(std::string_view file_name)
+{
+	auto lower = [](char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + 32) : c; };
+
+	for (auto name : GAME_EXE_NAMES)
+	{
+		if (name.size() != file_name.size())
+			continue;
+
+		size_t i = 0;
+		while (i < name.size() && lower(name[i]) == lower(file_name[i]))
+			++i;
+
+		if (i == name.size())
+			return true;
+	}
+
+	return false;
+}
+
+// Test whether a game build already includes a fix, so needs no help from us.
+constexpr bool IsFixedVersion(std::string_view product_name, uint64_t version)
+{
+	for (auto& game : FIXED_GAMES)
+	{
+		if (game.product_name == product_name)
+			return version >= game.fixed_version;
+	}
+
+	return false;
+}
+
+constexpr bool IsGameDatabaseValid()
+{
+	for (auto& game : FIXED_GAMES)
+	{
+		if (!IsSupportedProduct(game.product_name) || !game.fixed_version)
+			return false;
+	}
+
+	for (size_t i = 0; i < std::size(GAME_DIRS); ++i)
+	{
+		for (size_t j = i + 1; j < std::size(GAME_DIRS); ++j)
+		{
+			if (std::string_view(GAME_DIRS[i]) == GAME_DIRS[j])
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static_assert(IsGameDatabaseValid(), "fixed games must be supported, and directories unique");
+static_assert(IsKnownGameExe("DirtRally2.exe") && !IsKnownGameExe("dirtrally2.ex"), "executable names");
+static_assert(ParseVersion("1, 10, 129, 1631") == FIXED_GAMES[0].fixed_version, "version parsing");
+static_assert(IsFixedVersion("DiRT Rally 2.0", ParseVersion("1.10.129.1631")), "version comparison");
+static_assert(!IsFixedVersion("DiRT Rally 2.0", ParseVersion("1.10.0.0")), "version comparison");
+static_assert(!IsFixedVersion("DiRT Rally", ParseVersion("99.0")), "version comparison");
@@ -0,0 +1,85 @@
+// Log-linear latency histogram in the style of HdrHistogram, with each power of
+// two range split into 16 linear buckets, for a worst case error of 1/16th.
+// Recording is a couple of relaxed atomic adds, so it's cheap enough for hot
+// paths, and the fixed layout allows it to live in shared memory.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+constexpr int HIST_SUB_BITS{ 4 };
+constexpr uint32_t HIST_SUB_COUNT{ 1u << HIST_SUB_BITS };
+constexpr int HIST_BUCKETS{ static_cast<int>(HIST_SUB_COUNT * (32 - HIST_SUB_BITS + 1)) };
+
+struct Histogram
+{
+	std::atomic<uint32_t> counts[HIST_BUCKETS];
+	std::atomic<uint64_t> total_us;
+
+	static int BucketIndex(uint32_t value_us)
+	{
+		if (value_us < HIST_SUB_COUNT)
+			return static_cast<int>(value_us);
+
+		int msb = 0;
+		for (int shift = 16; shift; shift >>= 1)
+		{
+			if (value_us >> (msb + shift))
+				msb += shift;
+		}
+
+		auto scale = msb - HIST_SUB_BITS;
+		return static_cast<int>(HIST_SUB_COUNT * (scale + 1) + ((value_us >> scale) - HIST_SUB_COUNT));
+	}
+
+	// Highest value recorded in the given bucket.
+	static uint32_t BucketValue(int index)
+	{
+		if (index < static_cast<int>(HIST_SUB_COUNT))
+			return static_cast<uint32_t>(index);
+
+		auto scale = index / HIST_SUB_COUNT - 1;
+		auto sub = index % HIST_SUB_COUNT;
+		return static_cast<uint32_t>((static_cast<uint64_t>(HIST_SUB_COUNT + sub + 1) << scale) - 1);
+	}
+
+	void Record(uint32_t value_us)
+	{
+		counts[BucketIndex(value_us)].fetch_add(1, std::memory_order_relaxed);
+		total_us.fetch_add(value_us, std::memory_order_relaxed);
+	}
+
+	uint64_t Count() const
+	{
+		uint64_t count = 0;
+		for (auto& bucket : counts)
+			count += bucket.load(std::memory_order_relaxed);
+
+		return count;
+	}
+
+	// Value at or below which the given percentage of samples fall.
+	uint32_t Percentile(double percent) const
+	{
+		uint32_t snapshot[HIST_BUCKETS];
+		uint64_t count = 0;
+
+		for (int i = 0; i < HIST_BUCKETS; ++i)
+			count += snapshot[i] = counts[i].load(std::memory_order_relaxed);
+
+		auto target = static_cast<uint64_t>(percent / 100.0 * count + 0.5);
+		uint64_t seen = 0;
+
+		for (int i = 0; i < HIST_BUCKETS; ++i)
+		{
+			seen += snapshot[i];
+			if (seen && seen >= target)
+				return BucketValue(i);
+		}
+
+		return 0;
+	}
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "histogram requires lock-free 64-bit atomics");
@@ -0,0 +1,126 @@
+// Live policy control for the dinput8.dll shim, through a named shared memory
+// section written by "DirtFix.exe /policy". The shim reads it on every hooked
+// call, so it uses a seqlock rather than any kind of kernel object.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <thread>
+
+constexpr uint32_t SHIM_CONTROL_VERSION{ 2 };
+constexpr uint32_t DEFAULT_FRAME_BUDGET_US{ 11'111 };	// 90fps
+constexpr uint32_t SHIM_CONTROL_READ_TRIES{ 64 };		// far longer than a write takes
+constexpr uint32_t SHIM_CONTROL_CLAIM_TRIES{ 100'000 };	// before a writer is presumed dead
+
+enum class ShimMode : uint32_t
+{
+	Cached,			// replay snapshots of earlier enumerations
+	Throttle,		// pass through a limited number of calls per thread, then fail
+	PassThrough,	// leave all calls alone
+	Adaptive,		// pass through while calls fit the frame budget, otherwise cached
+	PollDetect,		// cached for threads polling on a timer, otherwise pass through
+};
+
+constexpr const char* SHIM_MODE_NAMES[]{ "cached", "throttle", "passthrough", "adaptive", "polldetect" };
+
+inline const char* ShimModeName(ShimMode mode)
+{
+	auto index = static_cast<size_t>(mode);
+	return (index < std::size(SHIM_MODE_NAMES)) ? SHIM_MODE_NAMES[index] : "unknown";
+}
+
+inline bool ParseShimMode(const char* name, ShimMode& mode)
+{
+	for (size_t i = 0; i < std::size(SHIM_MODE_NAMES); ++i)
+	{
+		if (!strcmp(name, SHIM_MODE_NAMES[i]))
+		{
+			mode = static_cast<ShimMode>(i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+struct ShimPolicy
+{
+	ShimMode mode;
+	uint32_t max_calls;		// pass-through calls per thread, before throttling
+	uint32_t budget_us;		// largest enumeration cost passed through in adaptive mode
+};
+
+struct ShimControl
+{
+	uint32_t version;
+	uint32_t size;
+
+	std::atomic<uint32_t> sequence;		// odd while a write is in progress
+	std::atomic<uint32_t> mode;
+	std::atomic<uint32_t> max_calls;
+	std::atomic<uint32_t> budget_us;
+
+	// Read the policy, giving up rather than waiting on a write that doesn't
+	// finish, as the writer may have been killed part way through.
+	bool Read(ShimPolicy& policy) const
+	{
+		for (uint32_t i = 0; i < SHIM_CONTROL_READ_TRIES; ++i)
+		{
+			auto seq = sequence.load(std::memory_order_acquire);
+			ShimPolicy read
+			{
+				static_cast<ShimMode>(mode.load(std::memory_order_relaxed)),
+				max_calls.load(std::memory_order_relaxed),
+				budget_us.load(std::memory_order_relaxed),
+			};
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (!(seq & 1) && sequence.load(std::memory_order_relaxed) == seq)
+			{
+				policy = read;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void Write(const ShimPolicy& policy)
+	{
+		// Claim the sequence by making it odd, which also excludes other writers.
+		// One left odd for long was abandoned by a writer that died, so is taken
+		// over by advancing it to the next odd number.
+		auto seq = sequence.load(std::memory_order_relaxed);
+		for (uint32_t tries = 0; ; ++tries)
+		{
+			if ((seq & 1) && tries < SHIM_CONTROL_CLAIM_TRIES)
+			{
+				std::this_thread::yield();
+				seq = sequence.load(std::memory_order_relaxed);
+				continue;
+			}
+
+			auto claimed = seq + ((seq & 1) ? 2 : 1);
+			if (sequence.compare_exchange_weak(seq, claimed, std::memory_order_acquire))
+			{
+				seq = claimed;
+				break;
+			}
+		}
+
+		std::atomic_thread_fence(std::memory_order_release);
+		mode.store(static_cast<uint32_t>(policy.mode), std::memory_order_relaxed);
+		max_calls.store(policy.max_calls, std::memory_order_relaxed);
+		budget_us.store(policy.budget_us, std::memory_order_relaxed);
+		sequence.store(seq + 1, std::memory_order_release);
+	}
+};
+
+inline std::string ShimControlName(uint32_t pid)
+{
+	return R"(Local\DirtFix.Control.)" + std::to_string(pid);
+}
@@ -0,0 +1,48 @@
+// Latency statistics exported by the dinput8.dll shim through a named shared
+// memory section, for live viewing with "DirtFix.exe /stats <pid>". The layout
+// uses fixed size types only, so 32-bit and 64-bit processes agree on it.
+
+#pragma once
+
+#include "Histogram.h"
+
+#include <cstdio>
+#include <string>
+
+constexpr uint32_t SHIM_STATS_VERSION{ 1 };
+
+struct ShimStats
+{
+	uint32_t version;
+	uint32_t size;
+
+	Histogram enum_devices;		// duration of each pass-through EnumDevices call
+	Histogram enum_saved;		// pass-through cost avoided by each served call
+	Histogram msg_dispatch;		// main thread message dispatch, including DINPUT8 lock waits
+};
+
+inline std::string ShimStatsName(uint32_t pid)
+{
+	return R"(Local\DirtFix.Stats.)" + std::to_string(pid);
+}
+
+inline std::string FormatHistogram(const char* name, const Histogram& hist)
+{
+	char sz[160]{};
+	snprintf(sz, sizeof(sz), "%-24s n=%-8llu p50=%-8u p99=%-8u p99.9=%-8u (us)\n",
+		name,
+		static_cast<unsigned long long>(hist.Count()),
+		hist.Percentile(50.0),
+		hist.Percentile(99.0),
+		hist.Percentile(99.9));
+
+	return sz;
+}
+
+inline std::string FormatShimStats(const ShimStats& stats)
+{
+	return
+		FormatHistogram("EnumDevices", stats.enum_devices) +
+		FormatHistogram("EnumDevices saved", stats.enum_saved) +
+		FormatHistogram("Message dispatch", stats.msg_dispatch);
+}
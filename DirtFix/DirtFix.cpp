@@ -4,36 +4,76 @@
 
 #include "pch.h"
 #include "resource.h"
+#include "ParallelScan.h"
+#include "PeFile.h"
+#include "ScanCache.h"
+#include "ShimDigest.h"
+#include "../Common/GameDatabase.h"
+#include "../Common/ShimControl.h"
+#include "../Common/ShimStats.h"
 
 constexpr auto APP_NAME{ "DirtFix" };
 constexpr auto APP_VER{ "v1.6" };
 constexpr auto APP_URL{ "https://github.com/simonowen/dirtfix" };
 constexpr auto SETTINGS_KEY{ R"(Software\SimonOwen\DirtFix)" };
+constexpr auto FINGERPRINTS_KEY{ R"(Software\SimonOwen\DirtFix\Fingerprints)" };
 constexpr auto STEAM_KEY{ R"(Software\Valve\Steam)" };
 constexpr auto OCULUS_KEY{ R"(Software\Oculus VR, LLC\Oculus\Libraries)" };
+constexpr auto SCAN_CACHE_FILE{ R"(DirtFix\ScanCache.bin)" };		// under local app data
+constexpr auto DRIVE_SCAN_TIMEOUT = std::chrono::milliseconds(3000);	// for sleeping or network drives
 
-const std::vector<std::string> game_dirs
+// Shim DLLs installed in game directories, with the base name of the build each
+// is copied from. The XInput shim is only installed under the names the game
+// imports, and never over a copy the game ships with.
+constexpr std::pair<const char*, const char*> SHIM_FILES[]
 {
-	"DiRT Rally",									// Steam
-	"DiRT Rally 2.0",								// Steam and Microsoft
-	"DiRT 4",										// Steam
-	"codemasters-dirt-rally/World/application",		// Oculus
-	"codemasters-dirt-rally-2-0",					// Oculus
-	"GRID Autosport",								// Steam
+	{ "dinput8.dll", "dinput8" },
+	{ "xinput1_3.dll", "xinput" },
+	{ "xinput1_4.dll", "xinput" },
+	{ "xinput9_1_0.dll", "xinput" },
 };
 
-const std::map<std::string, std::string> fixed_games
-{
-	{ "DiRT Rally 2.0", "1,10,129,1631" },			// Fixed in 1.10.1 patch
-};
+// Files the dinput8 shim writes alongside itself, removed with it.
+constexpr const char* SHIM_DATA_FILES[]{ "DirtFix.devices", "DirtFix.tmp" };
 
 struct GameInfo
 {
 	bool is_enabled{ false };
 	bool is_x64{ false };
 	bool is_fixed{ false };
+	uint32_t imports{};		// PE_NOTED_IMPORTS bits of the game executable
+};
+
+using GameScan = ParallelScan<std::map<std::string, GameInfo>>;
+
+// Called on a scan thread as each library or saved directory is checked, with
+// the games found there.
+using SettingsProgress = std::function<void(size_t finished, size_t total,
+	const std::map<std::string, GameInfo>& found)>;
+
+constexpr UINT WM_SCAN_PROGRESS{ WM_APP + 1 };	// lParam is a ScanUpdate for the receiver to delete
+constexpr UINT WM_SCAN_DONE{ WM_APP + 2 };
+
+struct ScanUpdate
+{
+	std::map<std::string, GameInfo> found;
+	size_t finished{};
+	size_t total{};
+};
+
+// Options dialog state, with the list drawn from the settings as needed.
+struct OptionsState
+{
+	std::map<std::string, GameInfo> settings;
+	std::vector<std::string> items;		// directories shown, in list order
+	std::thread scan_thread;
+	std::atomic<bool> scan_cancel{ false };
+	bool painted{ false };
 };
 
+ScanCache& g_scanCache = *new ScanCache();	// never freed, as abandoned scan threads may outlive WinMain
+const auto g_startTime = std::chrono::steady_clock::now();
+
 struct FILE_CHANGES
 {
 	std::vector<std::pair<std::string, std::string>> copies;
@@ -53,135 +93,248 @@ private:
 	PVOID m_last_redir{};
 };
 
-////////////////////////////////////////////////////////////////////////////////
-
-bool MatchingFiles(const fs::path& src_path, const fs::path& dst_path)
+// Read-only view of a whole file, which is empty if it couldn't be mapped.
+class MappedFile
 {
-	try
+public:
+	explicit MappedFile(const fs::path& path)
 	{
-		if (fs::exists(src_path) && fs::exists(dst_path) &&
-			fs::file_size(src_path) == fs::file_size(dst_path))
-		{
-			std::ifstream src_file(src_path.string(), std::ifstream::in | std::ifstream::binary);
-			std::ifstream dst_file(dst_path.string(), std::ifstream::in | std::ifstream::binary);
-			if (src_file.is_open() && dst_file.is_open())
-			{
-				std::vector<char> sbuf(static_cast<size_t>(fs::file_size(src_path)));
-				std::vector<char> dbuf(static_cast<size_t>(fs::file_size(dst_path)));
+		m_hfile = CreateFile(path.string().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 
-				src_file.read(sbuf.data(), sbuf.size());
-				dst_file.read(dbuf.data(), dbuf.size());
+		LARGE_INTEGER size{};
+		if (m_hfile == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_hfile, &size) || !size.QuadPart ||
+			static_cast<uint64_t>(size.QuadPart) > SIZE_MAX)
+		{
+			return;
+		}
 
-				return sbuf == dbuf;
-			}
+		m_hmapping = CreateFileMapping(m_hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hmapping)
+		{
+			m_data = static_cast<const uint8_t*>(MapViewOfFile(m_hmapping, FILE_MAP_READ, 0, 0, 0));
+			m_size = m_data ? static_cast<size_t>(size.QuadPart) : 0;
 		}
 	}
-	catch (...) {}
-
-	return false;
-}
 
-bool IsX64Binary(const fs::path &path)
-{
-	// GetBinaryType appears to fail when the path contains unreadable directories,
-	// even when a full path is given. Below does all we need directly.
-	try
+	~MappedFile()
 	{
-		std::ifstream f(path.string(), std::ifstream::in | std::ifstream::binary);
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_hmapping)
+			CloseHandle(m_hmapping);
+		if (m_hfile != INVALID_HANDLE_VALUE)
+			CloseHandle(m_hfile);
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
 
-		IMAGE_DOS_HEADER dos_header{};
-		f.read(reinterpret_cast<char*>(&dos_header), sizeof(dos_header));
+	const uint8_t* Data() const { return m_data; }
+	size_t Size() const { return m_size; }
 
-		if (dos_header.e_magic != IMAGE_DOS_SIGNATURE)
+	// Run a function reading the view, failing if the file can't be read part
+	// way through, such as from a removed or failing drive, which raises an
+	// in-page error rather than returning one.
+	template <typename Func>
+	bool Read(Func&& func) const
+	{
+		__try
+		{
+			func();
+			return true;
+		}
+		__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+		{
 			return false;
+		}
+	}
 
-		f.seekg(dos_header.e_lfanew);
+private:
+	HANDLE m_hfile{ INVALID_HANDLE_VALUE };
+	HANDLE m_hmapping{};
+	const uint8_t* m_data{};
+	size_t m_size{};
+};
 
-		IMAGE_NT_HEADERS nt_headers{};
-		f.read(reinterpret_cast<char*>(&nt_headers), sizeof(nt_headers));
+////////////////////////////////////////////////////////////////////////////////
 
-		return nt_headers.FileHeader.Machine == IMAGE_FILE_MACHINE_AMD64;
+// Size and modification time of a file, read without opening it.
+bool GetFileStamp(const fs::path& path, uint64_t& size, uint64_t& write_time)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fad{};
+	if (!GetFileAttributesEx(path.string().c_str(), GetFileExInfoStandard, &fad) ||
+		(fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		return false;
 	}
-	catch (...) {}
 
-	return false;
+	size = (static_cast<uint64_t>(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow;
+	write_time = (static_cast<uint64_t>(fad.ftLastWriteTime.dwHighDateTime) << 32) |
+		fad.ftLastWriteTime.dwLowDateTime;
+	return true;
 }
 
-uint64_t VersionValue(const std::string strVersion)
+bool HashFile(const fs::path& path, uint64_t size, uint64_t& digest)
 {
-	unsigned major = 0, minor = 0, revision = 0, build = 0;
-	if (sscanf_s(strVersion.c_str(), "%u,%u,%u,%u", &major, &minor, &revision, &build) < 1)
-		return 0;
+	MappedFile file(path);
+	if (!file.Data() || file.Size() != size)
+		return false;
 
-	return (static_cast<uint64_t>((major << 16) | minor) << 32) | (revision << 16) | build;
+	Fnv1a64 hash;
+	if (!file.Read([&] { hash.Update(file.Data(), file.Size()); }))
+		return false;
+
+	digest = hash.Value();
+	return true;
 }
 
-bool IsGameExe(const fs::path &path, GameInfo &info)
+// Fingerprint of a shim shipped alongside us, using the digest embedded at
+// build time if the file is unchanged since, or hashing it once per run if not.
+bool GetSourceFingerprint(const fs::path& src_path, ShimFingerprint& fingerprint)
 {
-	DWORD dwHandle;
-	auto path_str = path.string();
-	auto dwSize = GetFileVersionInfoSize(path_str.c_str(), &dwHandle);
+	static std::map<std::string, ShimFingerprint> hashed;
 
-	std::vector<BYTE> data(dwSize);
-	if (!GetFileVersionInfo(path_str.c_str(), NULL, dwSize, data.data()))
+	if (!GetFileStamp(src_path, fingerprint.size, fingerprint.write_time))
 		return false;
 
-    UINT ncbSz;
-	struct LANGANDCODEPAGE { WORD wLanguage; WORD wCodePage; } *pLcp;
-	if (!VerQueryValue(data.data(), "\\VarFileInfo\\Translation", (LPVOID *)&pLcp, &ncbSz))
+	auto file_name = src_path.filename().string();
+	if (auto shim = FindEmbeddedDigest(file_name, fingerprint.size, fingerprint.write_time))
+	{
+		fingerprint.digest = shim->digest;
+		return true;
+	}
+
+	auto& cached = hashed[src_path.string()];
+	if (!IsFingerprintCurrent(cached, fingerprint.size, fingerprint.write_time))
+	{
+		if (!HashFile(src_path, fingerprint.size, fingerprint.digest))
+			return false;
+
+		cached = fingerprint;
+	}
+
+	fingerprint = cached;
+	return true;
+}
+
+// Test whether an installed shim matches the one we'd install, hashing only the
+// installed copy, and only if it changed since it was last seen.
+bool MatchingFiles(const fs::path& src_path, const fs::path& dst_path)
+{
+	ShimFingerprint src{}, dst{};
+	if (!GetSourceFingerprint(src_path, src) || !GetFileStamp(dst_path, dst.size, dst.write_time) ||
+		dst.size != src.size)
+	{
 		return false;
+	}
+
+	HKEY hkey{};
+	if (RegCreateKey(HKEY_CURRENT_USER, FINGERPRINTS_KEY, &hkey) != ERROR_SUCCESS)
+		hkey = NULL;
+
+	auto dst_str = dst_path.string();
+	ShimFingerprint seen{};
+	DWORD cbSeen = sizeof(seen);
 
-	std::stringstream ss;
-	ss << std::hex << std::setfill('0');
-	ss << std::setw(4) << pLcp->wLanguage;
-	ss << std::setw(4) << pLcp->wCodePage;
-	ss << std::dec;
-	auto strCodepage = ss.str();
+	auto have_digest = hkey &&
+		RegQueryValueEx(hkey, dst_str.c_str(), NULL, NULL, reinterpret_cast<LPBYTE>(&seen), &cbSeen) == ERROR_SUCCESS &&
+		cbSeen == sizeof(seen) && IsFingerprintCurrent(seen, dst.size, dst.write_time);
 
-	auto strProductNameKey = "\\StringFileInfo\\" + strCodepage + "\\ProductName";
+	if (have_digest)
+		dst.digest = seen.digest;
+	else if ((have_digest = HashFile(dst_path, dst.size, dst.digest)) && hkey)
+		RegSetValueEx(hkey, dst_str.c_str(), 0, REG_BINARY, reinterpret_cast<const BYTE*>(&dst), sizeof(dst));
+
+	if (hkey)
+		RegCloseKey(hkey);
 
-	char *pszValue{};
-	unsigned int cchValue{};
-	if (!VerQueryValue(data.data(), strProductNameKey.c_str(), (LPVOID *)&pszValue, &cchValue))
+	return have_digest && dst.digest == src.digest;
+}
+
+// Read a PE image, failing if it couldn't be read, with is_pe set if it's one.
+bool ReadPeFile(const fs::path &path, PeInfo &pe, bool &is_pe)
+{
+	// GetBinaryType appears to fail when the path contains unreadable directories,
+	// even when a full path is given, so the image is read directly.
+	MappedFile file(path);
+	return file.Data() && file.Read([&] { is_pe = ParsePeFile(file.Data(), file.Size(), pe); });
+}
+
+// Check an executable, failing only if it couldn't be read, so the result can
+// be remembered.
+bool ScanGameExe(const fs::path &path, ExeScan &scan)
+{
+	PeInfo pe;
+	auto is_pe = false;
+	if (!ReadPeFile(path, pe, is_pe))
 		return false;
 
-	auto strProductName = std::string(pszValue);
-	auto is_supported =
-		strProductName.find("DiRT") != std::string::npos ||
-		strProductName.find("GRID") != std::string::npos;
+	scan.is_game = is_pe && pe.has_product_name && IsSupportedProduct(pe.product_name);
 
-	auto itFixed = fixed_games.find(strProductName);
-	if (itFixed != fixed_games.end())
-	{
-		auto strProductVersionKey = "\\StringFileInfo\\" + strCodepage + "\\ProductVersion";
-		info.is_fixed = true;
+	// Games with a fix are assumed to be fixed if the version is missing.
+	auto version = pe.has_product_version ? ParseVersion(pe.product_version) : UINT64_MAX;
+	scan.is_fixed = scan.is_game && IsFixedVersion(pe.product_name, version);
 
-		if (VerQueryValue(data.data(), strProductVersionKey.c_str(), (LPVOID*)&pszValue, &cchValue))
-		{
-			auto strProductVersion = std::string(pszValue, cchValue);
+	scan.is_x64 = pe.machine == PE_MACHINE_AMD64;
+	scan.imports = static_cast<uint8_t>(pe.imports);
+	return true;
+}
 
-			if (VersionValue(strProductVersion) < VersionValue(itFixed->second))
-				info.is_fixed = false;
-		}
-	}
-	else
+// Check an executable, using the cached result if it's unchanged since.
+bool IsGameExe(const fs::path &path, GameInfo &info)
+{
+	auto dir = path.parent_path().lexically_normal().string();
+	auto name = path.filename().string();
+
+	// A scan that gave up on us while the drive was blocked discards the result.
+	ExeScan scan{};
+	if (!GetFileStamp(path, scan.size, scan.write_time) || IsScanAbandoned())
+		return false;
+
+	if (!g_scanCache.Find(dir, name, scan.size, scan.write_time, scan))
 	{
-		info.is_fixed = false;
-	}
+		if (!ScanGameExe(path, scan) || IsScanAbandoned())
+			return false;
 
-	info.is_x64 = IsX64Binary(path);
+		g_scanCache.Store(dir, name, scan);
+	}
 
-	return is_supported;
+	info.is_x64 = scan.is_x64;
+	info.is_fixed = scan.is_fixed;
+	info.imports = scan.imports;
+	return scan.is_game;
 }
 
 bool IsGameDirectory(const fs::path &dir, GameInfo &info)
 {
-	if (!fs::is_directory(dir))
+	std::vector<fs::path> exes;
+	std::error_code ec;
+
+	for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+	{
+		if (it->path().extension() == ".exe")
+			exes.push_back(it->path());
+	}
+
+	std::vector<std::string> names;
+	for (auto& exe : exes)
+		names.push_back(exe.filename().string());
+
+	// Forget executables that have gone, unless the directory couldn't be read.
+	if (IsScanAbandoned())
 		return false;
+	else if (!ec || ec == std::errc::no_such_file_or_directory)
+		g_scanCache.Prune(dir.lexically_normal().string(), names);
 
-	for (auto& p : fs::directory_iterator(dir))
+	// Executables with known names are checked first, so the others in the
+	// directory usually needn't be read at all.
+	std::stable_partition(exes.begin(), exes.end(),
+		[](const fs::path& exe) { return IsKnownGameExe(exe.filename().string()); });
+
+	for (auto& exe : exes)
 	{
-		if (p.path().extension() == ".exe" && IsGameExe(p.path(), info))
+		if (IsGameExe(exe, info))
 			return true;
 	}
 
@@ -194,32 +347,69 @@ bool IsShimInstalled(const fs::path &path)
 	return fs::exists(dll_path) && fs::is_regular_file(dll_path);
 }
 
+// Test whether an installed file is one of our shims, either matching one of
+// the builds we ship, or an older release that names us as its product.
+bool IsOwnShim(const fs::path &src_dir, const char *src_name, const fs::path &dst_path)
+{
+	for (auto suffix : { "_32.dll", "_64.dll" })
+	{
+		if (MatchingFiles(src_dir / (std::string(src_name) + suffix), dst_path))
+			return true;
+	}
+
+	PeInfo pe;
+	auto is_pe = false;
+	return ReadPeFile(dst_path, pe, is_pe) && is_pe && pe.has_product_name &&
+		!lstrcmp(pe.product_name, APP_NAME);
+}
+
 bool GetShimFileChanges(fs::path path, bool install, FILE_CHANGES &file_changes)
 {
 	DisableFsRedirection fs_disable;
 
 	char szEXE[MAX_PATH]{};
 	GetModuleFileName(NULL, szEXE, _countof(szEXE));
+	auto src_dir = fs::path(szEXE).remove_filename();
 
+	// Removal doesn't need the game, which may have been uninstalled already.
 	GameInfo info;
-	if (!IsGameDirectory(path, info))
+	if (install && !IsGameDirectory(path, info))
 		return false;
 
-	auto dst_path = path / "dinput8.dll";
-
-	if (install)
+	for (auto [dst_name, src_name] : SHIM_FILES)
 	{
-		auto src_path = fs::path(szEXE).remove_filename();
-		src_path /= (info.is_x64 ? "dinput8_64.dll" : "dinput8_32.dll");
+		auto dst_path = path / dst_name;
+		auto import_bit = NotedImportBit(dst_name);
+		std::error_code ec;
+
+		auto exists = fs::exists(dst_path, ec);
+		auto wanted = install && (!import_bit || (info.imports & import_bit));
+
+		if (wanted)
+		{
+			auto src_path = src_dir / (std::string(src_name) + (info.is_x64 ? "_64.dll" : "_32.dll"));
+
+			if (import_bit && exists && !IsOwnShim(src_dir, src_name, dst_path))
+				continue;
 
-		if (!MatchingFiles(src_path, dst_path))
+			if (!MatchingFiles(src_path, dst_path))
+			{
+				file_changes.copies.emplace_back(std::make_pair(src_path.string(), dst_path.string()));
+			}
+		}
+		else if (exists && IsOwnShim(src_dir, src_name, dst_path))
 		{
-			file_changes.copies.emplace_back(std::make_pair(src_path.string(), dst_path.string()));
+			file_changes.deletes.emplace_back(dst_path.string());
 		}
 	}
-	else if (fs::exists(dst_path))
+
+	for (auto data_name : SHIM_DATA_FILES)
 	{
-		file_changes.deletes.emplace_back(dst_path.string());
+		auto data_path = path / data_name;
+		std::error_code ec;
+
+		if (!install && fs::exists(data_path, ec))
+			file_changes.deletes.emplace_back(data_path.string());
 	}
 
 	return true;
@@ -276,26 +466,75 @@ bool ApplyFileChanges(HWND hwndParent, const FILE_CHANGES &file_changes)
 	return true;
 }
 
-bool AddListEntry(HWND hDlg, fs::path path, bool enabled)
+// Add newly found games to the list, keeping the check state of any already
+// present, which the user may have changed.
+void MergeSettings(HWND hDlg, OptionsState& state, const std::map<std::string, GameInfo>& found)
 {
+	auto added = false;
+
+	for (auto& [dir, info] : found)
+	{
+		if (state.settings.count(dir))
+			continue;
+
+		// Hide and disable fixed games.
+		auto& setting = state.settings[dir] = info;
+		if (setting.is_fixed)
+			setting.is_enabled = false;
+		else
+		{
+			state.items.push_back(dir);
+			added = true;
+		}
+	}
+
+	if (!added)
+		return;
+
+	// The list only knows items by index, so note the selected and focused
+	// directories to find them again once they've moved.
 	HWND hListView = GetDlgItem(hDlg, IDL_DIRS);
-	auto strPath = fs::canonical(fs::path(path)).string();
+	std::vector<std::string> selected;
+	for (int index = -1; (index = ListView_GetNextItem(hListView, index, LVNI_SELECTED)) >= 0; )
+	{
+		if (static_cast<size_t>(index) < state.items.size())
+			selected.push_back(state.items[index]);
+	}
 
-	LVFINDINFO lfi{};
-	lfi.flags = LVFI_STRING;
-	lfi.psz = strPath.c_str();
-	auto index = ListView_FindItem(hListView, 0, &lfi);
+	std::string focused;
+	auto focus_index = ListView_GetNextItem(hListView, -1, LVNI_FOCUSED);
+	if (focus_index >= 0 && static_cast<size_t>(focus_index) < state.items.size())
+		focused = state.items[focus_index];
 
-	if (index >= 0)
-		return false;
+	std::sort(state.items.begin(), state.items.end(),
+		[](const std::string& a, const std::string& b) { return lstrcmpi(a.c_str(), b.c_str()) < 0; });
+
+	ListView_SetItemCountEx(hListView, static_cast<int>(state.items.size()), LVSICF_NOSCROLL);
+	ListView_SetItemState(hListView, -1, 0, LVIS_SELECTED | LVIS_FOCUSED);
 
-	LVITEM lvi{};
-	lvi.mask = LVIF_TEXT;
-	lvi.pszText = const_cast<char*>(lfi.psz);
-	index = ListView_InsertItem(hListView, &lvi);
+	for (size_t i = 0; i < state.items.size(); ++i)
+	{
+		UINT item_state{ 0 };
+		if (std::find(selected.begin(), selected.end(), state.items[i]) != selected.end())
+			item_state |= LVIS_SELECTED;
+		if (!focused.empty() && state.items[i] == focused)
+			item_state |= LVIS_FOCUSED;
+
+		if (item_state)
+			ListView_SetItemState(hListView, static_cast<int>(i), item_state, item_state);
+	}
+
+	InvalidateRect(hListView, NULL, FALSE);
+}
+
+void ToggleListItem(HWND hListView, OptionsState& state, int index)
+{
+	if (index < 0 || static_cast<size_t>(index) >= state.items.size())
+		return;
 
-	ListView_SetCheckState(hListView, index, enabled);
-	return index >= 0;
+	auto& info = state.settings[state.items[index]];
+	info.is_enabled = !info.is_enabled;
+	ListView_RedrawItems(hListView, index, index);
 }
 
 bool AddValidGameSettings(
@@ -312,10 +551,122 @@ bool AddValidGameSettings(
 	return true;
 }
 
-auto LoadRegistrySettings()
+// Volume holding a path, such as "c:" or "\\server\share", to group scan tasks.
+std::string VolumeKey(const fs::path& path)
+{
+	auto volume = path.root_name().string();
+	std::transform(volume.begin(), volume.end(), volume.begin(),
+		[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return volume;
+}
+
+// Check for supported games under a library directory, on a scan thread.
+void AddLibraryScan(GameScan& scan, const fs::path& library_path, bool disable_redirection)
+{
+	scan.Add(VolumeKey(library_path), [library_path, disable_redirection] {
+		std::optional<DisableFsRedirection> fs_disable;
+		if (disable_redirection)
+			fs_disable.emplace();
+
+		std::map<std::string, GameInfo> found;
+		if (fs::exists(library_path))
+		{
+			for (auto subdir : GAME_DIRS)
+				AddValidGameSettings(fs::absolute(library_path / subdir), found);
+		}
+
+		return found;
+	});
+}
+
+// Location of the scan cache, though its directory may not exist yet.
+fs::path ScanCachePath()
+{
+	char szPath[MAX_PATH]{};
+	if (FAILED(SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA, NULL, SHGFP_TYPE_CURRENT, szPath)))
+		return {};
+
+	return fs::path(szPath) / SCAN_CACHE_FILE;
+}
+
+void LoadScanCache()
+{
+	auto path = ScanCachePath();
+	if (path.empty())
+		return;
+
+	std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	g_scanCache.Load(data);
+}
+
+// Write the cache via a temporary file, so an interrupted write can't leave a
+// damaged one. It's only a hint, so failures are ignored.
+void SaveScanCache()
+{
+	std::vector<uint8_t> data;
+	auto path = ScanCachePath();
+	if (path.empty() || !g_scanCache.Save(data))
+		return;
+
+	auto temp_path = fs::path(path).replace_extension(".tmp");
+	std::error_code ec;
+	fs::create_directories(path.parent_path(), ec);
+
+	{
+		std::ofstream file(temp_path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+		if (!file.write(reinterpret_cast<const char*>(data.data()), data.size()))
+			return;
+	}
+
+	MoveFileEx(temp_path.string().c_str(), path.string().c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+// Remove the cache and any temporary file left from saving it, then its
+// directory if nothing else is there.
+void DeleteScanCache()
+{
+	auto path = ScanCachePath();
+	if (path.empty())
+		return;
+
+	std::error_code ec;
+	fs::remove(path, ec);
+	fs::remove(fs::path(path).replace_extension(".tmp"), ec);
+	fs::remove(path.parent_path(), ec);		// fails unless empty
+}
+
+// Directories saved by earlier runs, which includes manual entries.
+std::vector<std::string> LoadSavedDirectories()
+{
+	std::vector<std::string> dirs;
+
+	HKEY hkey{};
+	if (RegOpenKeyEx(HKEY_CURRENT_USER, SETTINGS_KEY, 0, KEY_QUERY_VALUE, &hkey) != ERROR_SUCCESS)
+		return dirs;
+
+	for (DWORD idx = 0; ; ++idx)
+	{
+		char szValue[256];
+		DWORD cchValue{ _countof(szValue) };
+
+		if (RegEnumValue(hkey, idx, szValue, &cchValue, NULL, NULL, NULL, NULL) != ERROR_SUCCESS)
+			break;
+
+		dirs.push_back(szValue);
+	}
+
+	RegCloseKey(hkey);
+	return dirs;
+}
+
+auto LoadRegistrySettings(
+	SettingsProgress progress = nullptr,
+	_In_opt_ const std::atomic<bool>* cancel = nullptr)
 {
 	HKEY hkey;
 	std::map<std::string, GameInfo> settings;
+	GameScan scan;
 
 	// If Steam is installed, check if the supported games are installed.
 	if (RegOpenKeyEx(HKEY_CURRENT_USER, STEAM_KEY, 0, KEY_QUERY_VALUE, &hkey) == ERROR_SUCCESS)
@@ -327,13 +678,7 @@ auto LoadRegistrySettings()
 		RegQueryValueEx(hkey, "SteamPath", NULL, &dwType, reinterpret_cast<LPBYTE>(szPath), &cbPath);
 		RegCloseKey(hkey);
 
-		auto steam_path = fs::path(szPath) / "SteamApps/common";
-
-		for (auto& subdir : game_dirs)
-		{
-			auto dir_path = fs::absolute(steam_path / subdir);
-			AddValidGameSettings(dir_path, settings);
-		}
+		AddLibraryScan(scan, fs::path(szPath) / "SteamApps/common", false);
 	}
 
 	// Check for supported games in Microsoft Store storage locations.
@@ -341,8 +686,6 @@ auto LoadRegistrySettings()
 	if (ExpandEnvironmentStrings("%ProgramW6432%", szPF, _countof(szPF)) ||
 		ExpandEnvironmentStrings("%ProgramFiles%", szPF, _countof(szPF)))
 	{
-		DisableFsRedirection fs_disable;
-
 		// Until we know how to find the storage locations, scan all fixed drives.
 		std::vector<char> drives(GetLogicalDriveStrings(0, nullptr));
 		GetLogicalDriveStrings(static_cast<DWORD>(drives.size()), drives.data());
@@ -353,16 +696,7 @@ auto LoadRegistrySettings()
 				continue;
 
 			szPF[0] = pszRoot[0];
-			auto msstore_path = fs::path(szPF) / "ModifiableWindowsApps";
-
-			if (fs::exists(msstore_path))
-			{
-				for (auto& subdir : game_dirs)
-				{
-					auto dir_path = fs::absolute(msstore_path / subdir);
-					AddValidGameSettings(dir_path, settings);
-				}
-			}
+			AddLibraryScan(scan, fs::path(szPF) / "ModifiableWindowsApps", true);
 		}
 	}
 
@@ -370,7 +704,6 @@ auto LoadRegistrySettings()
 	DWORD dwOptions = KEY_QUERY_VALUE | KEY_ENUMERATE_SUB_KEYS;
 	if (RegOpenKeyEx(HKEY_CURRENT_USER, OCULUS_KEY, 0, dwOptions, &hkey) == ERROR_SUCCESS)
 	{
-		DisableFsRedirection fs_disable;
 		DWORD dwIndex = 0;
 
 		for (;;)
@@ -396,13 +729,7 @@ auto LoadRegistrySettings()
 				GetVolumePathNamesForVolumeName(vol_str.c_str(), szVolume, _countof(szVolume), &cchRet);
 
 				auto oculus_path = fs::path(std::string(szVolume)) / std::string(szPath + 49);
-				oculus_path /= "Software";
-
-				for (auto& subdir : game_dirs)
-				{
-					auto dir_path = fs::absolute(oculus_path / subdir);
-					AddValidGameSettings(dir_path, settings);
-				}
+				AddLibraryScan(scan, oculus_path / "Software", true);
 			}
 		}
 
@@ -410,31 +737,50 @@ auto LoadRegistrySettings()
 	}
 
 	// Pull previously saved paths from the registry, which includes manual entries.
-	if (RegCreateKey(HKEY_CURRENT_USER, SETTINGS_KEY, &hkey) == ERROR_SUCCESS)
+	auto saved_dirs = LoadSavedDirectories();
+	auto first_saved = scan.Size();
+
+	for (auto& saved_dir : saved_dirs)
 	{
-		// Populate from settings stored in the registry.
-		for (DWORD idx = 0; ; ++idx)
-		{
-			char szValue[256];
-			DWORD dwType{ REG_DWORD };
-			DWORD cchValue{ _countof(szValue) };
-			DWORD dwData{ 0 }, cbData{ sizeof(dwData) };
+		auto dir_path = fs::path(saved_dir);
+		scan.Add(VolumeKey(dir_path), [dir_path] {
+			std::map<std::string, GameInfo> found;
+			AddValidGameSettings(dir_path, found);
+			return found;
+		});
+	}
 
-			if (RegEnumValue(hkey, idx, szValue, &cchValue, NULL, &dwType,
-					reinterpret_cast<BYTE*>(&dwData), &cbData) != ERROR_SUCCESS)
-			{
-				break;
-			}
+	// Merge in the order the tasks were added, as the sequential scan did.
+	LoadScanCache();
+	auto total = scan.Size();
+	auto results = scan.Run(DRIVE_SCAN_TIMEOUT, [&](size_t finished, const auto& result) {
+		if (progress)
+			progress(finished, total, result ? *result : std::map<std::string, GameInfo>{});
+	}, cancel);
+	SaveScanCache();
 
-			auto dir_path = fs::path(szValue);
-			if (!AddValidGameSettings(dir_path, settings))
-			{
-				RegDeleteValue(hkey, szValue);
-				idx--;
-			}
+	for (auto& result : results)
+	{
+		if (!result)
+			continue;
+
+		for (auto& [dir, info] : *result)
+			settings[dir] = info;
+	}
+
+	// Forget saved paths that no longer hold a game, but not those on a drive
+	// that didn't respond in time.
+	HKEY hkeySettings{};
+	if (!saved_dirs.empty() && RegOpenKeyEx(HKEY_CURRENT_USER, SETTINGS_KEY, 0, KEY_SET_VALUE, &hkeySettings) == ERROR_SUCCESS)
+	{
+		for (size_t i = 0; i < saved_dirs.size(); ++i)
+		{
+			auto& result = results[first_saved + i];
+			if (result && result->empty())
+				RegDeleteValue(hkeySettings, saved_dirs[i].c_str());
 		}
 
-		RegCloseKey(hkey);
+		RegCloseKey(hkeySettings);
 	}
 
 	return settings;
@@ -458,11 +804,50 @@ void SaveRegistrySettings(
 		}
 
 		RegCloseKey(hkey);
+		SaveScanCache();
 		ApplyFileChanges(hDlg, file_changes);
 	}
 }
 
-void AddSetting(HWND hDlg)
+// Log the time since start-up, to measure how soon the dialog is usable.
+void LogElapsed(const char* pszEvent)
+{
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - g_startTime);
+	auto str = std::string(APP_NAME) + ": " + pszEvent + " after " + std::to_string(ms.count()) + "ms\n";
+	OutputDebugString(str.c_str());
+}
+
+// Look for games on a background thread, posting what each scan task finds to
+// the dialog as it arrives, then the merged settings once the scan is over.
+void ScanSettings(HWND hDlg, const std::atomic<bool>* cancel)
+{
+	auto post = [&](UINT uMsg, ScanUpdate update) {
+		auto pUpdate = new ScanUpdate(std::move(update));
+		if (*cancel || !PostMessage(hDlg, uMsg, 0, reinterpret_cast<LPARAM>(pUpdate)))
+			delete pUpdate;
+	};
+
+	auto settings = LoadRegistrySettings([&](size_t finished, size_t total, const auto& found) {
+		post(WM_SCAN_PROGRESS, ScanUpdate{ found, finished, total });
+	}, cancel);
+
+	post(WM_SCAN_DONE, ScanUpdate{ std::move(settings) });
+}
+
+// Stop a scan in progress, waiting for its thread to finish with our state,
+// then free any updates it posted that won't now be handled.
+void StopScanSettings(HWND hDlg, OptionsState& state)
+{
+	state.scan_cancel = true;
+	if (state.scan_thread.joinable())
+		state.scan_thread.join();
+
+	MSG msg;
+	while (PeekMessage(&msg, hDlg, WM_SCAN_PROGRESS, WM_SCAN_DONE, PM_REMOVE))
+		delete reinterpret_cast<ScanUpdate*>(msg.lParam);
+}
+
+void AddSetting(HWND hDlg, OptionsState& state)
 {
 	BROWSEINFO bi{};
 	bi.hwndOwner = hDlg;
@@ -487,7 +872,8 @@ void AddSetting(HWND hDlg)
 		return;
 	}
 
-	AddListEntry(hDlg, path, IsShimInstalled(path));
+	info.is_enabled = IsShimInstalled(path);
+	MergeSettings(hDlg, state, { { fs::canonical(path).string(), info } });
 }
 
 fs::path ExePath(
@@ -504,10 +890,10 @@ INT_PTR CALLBACK DialogProc(
 	_In_ HWND hDlg,
 	_In_ UINT uMsg,
 	_In_ WPARAM wParam,
-	_In_ LPARAM /*lParam*/)
+	_In_ LPARAM lParam)
 {
 	constexpr auto IDM_ABOUT = 0x1234;
-	static std::map<std::string, GameInfo> settings;
+	static OptionsState state;
 
 	switch (uMsg)
 	{
@@ -518,21 +904,16 @@ INT_PTR CALLBACK DialogProc(
 
 		HWND hListView = GetDlgItem(hDlg, IDL_DIRS);
 		ListView_SetExtendedListViewStyle(hListView, LVS_EX_CHECKBOXES);
+		ListView_SetCallbackMask(hListView, LVIS_STATEIMAGEMASK);
 
 		LVCOLUMN lvc{};
 		lvc.cx = 1000;
 		lvc.mask = LVCF_WIDTH;
 		ListView_InsertColumn(hListView, 0, &lvc);
 
-		settings = LoadRegistrySettings();
-		for (auto &[dir, info] : settings)
-		{
-			// Hide and disable fixed games.
-			if (info.is_fixed)
-				info.is_enabled = false;
-			else
-				AddListEntry(hDlg, dir, info.is_enabled);
-		}
+		// Games are added as they're found, so the dialog is usable straight away.
+		state.scan_cancel = false;
+		state.scan_thread = std::thread(ScanSettings, hDlg, &state.scan_cancel);
 
 		auto hmenu = GetSystemMenu(hDlg, FALSE);
 		AppendMenu(hmenu, MF_SEPARATOR, 0, nullptr);
@@ -541,39 +922,98 @@ INT_PTR CALLBACK DialogProc(
 		return TRUE;
 	}
 
-	case WM_COMMAND:
-	{
-		switch (LOWORD(wParam))
+	case WM_PAINT:
+		if (!state.painted)
 		{
-		case IDC_ADD:
-			AddSetting(hDlg);
-			return TRUE;
+			state.painted = true;
+			LogElapsed("first paint");
+		}
+		break;
 
-		case IDOK:
+	case WM_SCAN_PROGRESS:
+	{
+		std::unique_ptr<ScanUpdate> update(reinterpret_cast<ScanUpdate*>(lParam));
+		MergeSettings(hDlg, state, update->found);
+
+		SendDlgItemMessage(hDlg, IDC_PROGRESS, PBM_SETRANGE32, 0, update->total);
+		SendDlgItemMessage(hDlg, IDC_PROGRESS, PBM_SETPOS, update->finished, 0);
+		return TRUE;
+	}
+
+	case WM_SCAN_DONE:
+	{
+		std::unique_ptr<ScanUpdate> update(reinterpret_cast<ScanUpdate*>(lParam));
+		MergeSettings(hDlg, state, update->found);
+
+		ShowWindow(GetDlgItem(hDlg, IDC_PROGRESS), SW_HIDE);
+		LogElapsed("game list complete");
+		return TRUE;
+	}
+
+	case WM_NOTIFY:
+	{
+		auto pnmh = reinterpret_cast<LPNMHDR>(lParam);
+		if (pnmh->idFrom != IDL_DIRS)
+			break;
+
+		HWND hListView = pnmh->hwndFrom;
+
+		switch (pnmh->code)
 		{
-			auto hListView = GetDlgItem(hDlg, IDL_DIRS);
+		case LVN_GETDISPINFO:
+		{
+			auto& item = reinterpret_cast<NMLVDISPINFO*>(lParam)->item;
+			if (item.iItem < 0 || static_cast<size_t>(item.iItem) >= state.items.size())
+				break;
 
-			auto num_items = ListView_GetItemCount(hListView);
-			for (int i = 0; i < num_items; ++i)
-			{
-				char szItem[MAX_PATH]{};
+			auto& dir = state.items[item.iItem];
+			if (item.mask & LVIF_TEXT)
+				lstrcpyn(item.pszText, dir.c_str(), item.cchTextMax);
 
-				LV_ITEM li{};
-				li.mask = LVIF_TEXT;
-				li.iItem = i;
-				li.pszText = szItem;
-				li.cchTextMax = _countof(szItem);
+			if (item.mask & LVIF_STATE)
+			{
+				item.state = INDEXTOSTATEIMAGEMASK(state.settings[dir].is_enabled ? 2 : 1);
+				item.stateMask = LVIS_STATEIMAGEMASK;
+			}
+			return TRUE;
+		}
 
-				if (!SendMessage(hListView, LVM_GETITEM, 0, reinterpret_cast<LPARAM>(&li)))
-					break;
+		// The list holds no check state of its own, so clicks and the space
+		// bar are applied to the settings it's drawn from.
+		case NM_CLICK:
+		{
+			LVHITTESTINFO hti{};
+			hti.pt = reinterpret_cast<LPNMITEMACTIVATE>(lParam)->ptAction;
+			if (ListView_HitTest(hListView, &hti) >= 0 && (hti.flags & LVHT_ONITEMSTATEICON))
+				ToggleListItem(hListView, state, hti.iItem);
+			return TRUE;
+		}
 
-				settings[szItem].is_enabled = ListView_GetCheckState(hListView, i);
+		case LVN_KEYDOWN:
+			if (reinterpret_cast<LPNMLVKEYDOWN>(lParam)->wVKey == VK_SPACE)
+			{
+				for (int i = -1; (i = ListView_GetNextItem(hListView, i, LVNI_SELECTED)) >= 0; )
+					ToggleListItem(hListView, state, i);
 			}
+			return TRUE;
+		}
+		break;
+	}
 
-			SaveRegistrySettings(hDlg, settings);
+	case WM_COMMAND:
+	{
+		switch (LOWORD(wParam))
+		{
+		case IDC_ADD:
+			AddSetting(hDlg, state);
+			return TRUE;
+
+		case IDOK:
+			// Games not found yet are left as they were.
+			StopScanSettings(hDlg, state);
+			SaveRegistrySettings(hDlg, state.settings);
 			DestroyWindow(hDlg);
 			return TRUE;
-		}
 
 		case IDCANCEL:
 			DestroyWindow(hDlg);
@@ -588,6 +1028,10 @@ INT_PTR CALLBACK DialogProc(
 			ShellExecute(nullptr, "open", APP_URL, nullptr, nullptr, SW_SHOWNORMAL);
 
 		break;
+
+	case WM_DESTROY:
+		StopScanSettings(hDlg, state);
+		break;
 	}
 
 	return FALSE;
@@ -595,6 +1039,109 @@ INT_PTR CALLBACK DialogProc(
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void AttachParentConsole()
+{
+	if (!AttachConsole(ATTACH_PARENT_PROCESS))
+		AllocConsole();
+
+	FILE* f{};
+	freopen_s(&f, "CONOUT$", "w", stdout);
+}
+
+// Change the policy used by the shim in a running game, or show the current
+// one if no mode is given.
+// Usage: /policy <pid> [cached|throttle|passthrough|adaptive|polldetect] [max_calls] [budget_ms]
+int SetShimPolicy(const char* pszArgs)
+{
+	AttachParentConsole();
+
+	DWORD pid{};
+	char szMode[32]{};
+	unsigned max_calls{}, budget_ms{};
+	auto fields = sscanf_s(pszArgs, "%lu %31s %u %u", &pid, szMode, static_cast<unsigned>(_countof(szMode)),
+		&max_calls, &budget_ms);
+
+	auto hMap = OpenFileMapping(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, ShimControlName(pid).c_str());
+	if (fields < 1 || !hMap)
+	{
+		printf("No %s policy control found for process %lu.\n", APP_NAME, pid);
+		return 1;
+	}
+
+	auto pControl = reinterpret_cast<ShimControl*>(
+		MapViewOfFile(hMap, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(ShimControl)));
+	if (!pControl || pControl->version != SHIM_CONTROL_VERSION || pControl->size != sizeof(ShimControl))
+	{
+		printf("Policy control version mismatch for process %lu.\n", pid);
+		return 1;
+	}
+
+	// An earlier change that was killed part way through can only be replaced.
+	ShimPolicy policy{};
+	if (!pControl->Read(policy) && fields < 4)
+	{
+		printf("Policy change for process %lu was interrupted; give the mode, calls and budget to replace it.\n", pid);
+		return 1;
+	}
+
+	if (fields >= 2)
+	{
+		if (!ParseShimMode(szMode, policy.mode))
+		{
+			printf("Unknown mode: %s\n", szMode);
+			return 1;
+		}
+
+		if (fields >= 3)
+			policy.max_calls = max_calls;
+		if (fields >= 4)
+			policy.budget_us = budget_ms * 1000;
+
+		pControl->Write(policy);
+	}
+
+	printf("Process %lu: mode=%s max_calls=%u budget=%.1fms\n",
+		pid, ShimModeName(policy.mode), policy.max_calls, policy.budget_us / 1000.0);
+
+	UnmapViewOfFile(pControl);
+	CloseHandle(hMap);
+	return 0;
+}
+
+// Print live latency statistics from the shim running in the given process.
+int ShowShimStats(DWORD pid)
+{
+	AttachParentConsole();
+
+	auto hMap = OpenFileMapping(FILE_MAP_READ, FALSE, ShimStatsName(pid).c_str());
+	auto hProcess = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	if (!hMap || !hProcess)
+	{
+		printf("No %s statistics found for process %lu.\n", APP_NAME, pid);
+		return 1;
+	}
+
+	auto pStats = reinterpret_cast<const ShimStats*>(MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, sizeof(ShimStats)));
+	if (!pStats || pStats->version != SHIM_STATS_VERSION || pStats->size != sizeof(ShimStats))
+	{
+		printf("Statistics version mismatch for process %lu.\n", pid);
+		return 1;
+	}
+
+	// Refresh every second until the game exits.
+	do
+	{
+		printf("\n%s", FormatShimStats(*pStats).c_str());
+	} while (WaitForSingleObject(hProcess, 1000) == WAIT_TIMEOUT);
+
+	UnmapViewOfFile(pStats);
+	CloseHandle(hProcess);
+	CloseHandle(hMap);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 int CALLBACK WinMain(
 	_In_ HINSTANCE hInstance,
 	_In_opt_ HINSTANCE /*hPrevInstance*/,
@@ -605,16 +1152,26 @@ int CALLBACK WinMain(
 	{
 		FILE_CHANGES file_changes;
 
-		auto settings = LoadRegistrySettings();
-		for (auto &entry : settings)
-		{
-			auto [dir, enabled] = entry;
+		// Every saved directory is visited, however long its drive takes, as the
+		// shim may be installed there whether or not the game still is.
+		for (auto &dir : LoadSavedDirectories())
 			GetShimFileChanges(dir, false, file_changes);
-		}
 
 		ApplyFileChanges(NULL, file_changes);
+
+		// Forget the saved directories and the fingerprints of installed shims.
+		RegDeleteTree(HKEY_CURRENT_USER, SETTINGS_KEY);
+		DeleteScanCache();
 		return 0;
 	}
+	else if (!_strnicmp(lpCmdLine, "/stats", 6))
+	{
+		return ShowShimStats(strtoul(lpCmdLine + 6, nullptr, 10));
+	}
+	else if (!_strnicmp(lpCmdLine, "/policy", 7))
+	{
+		return SetShimPolicy(lpCmdLine + 7);
+	}
 
 	auto strCaption = std::string(APP_NAME) + " " + APP_VER;
 	auto hwnd = FindWindow(nullptr, strCaption.c_str());
@@ -626,7 +1183,7 @@ int CALLBACK WinMain(
 	{
 		if (SUCCEEDED(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED)))
 		{
-			INITCOMMONCONTROLSEX icce{ sizeof(icce), ICC_LISTVIEW_CLASSES };
+			INITCOMMONCONTROLSEX icce{ sizeof(icce), ICC_LISTVIEW_CLASSES | ICC_PROGRESS_CLASS };
 			InitCommonControlsEx(&icce);
 
 			DialogBox(hInstance, MAKEINTRESOURCE(IDD_OPTIONS), NULL, DialogProc);
@@ -0,0 +1,174 @@
+// Runs independent discovery tasks in parallel, on a bounded pool of threads
+// that each take a whole volume at a time, so a sleeping or network drive only
+// holds up its own tasks. Tasks on the same volume run one after another, to
+// avoid seeking a hard disk back and forth.
+//
+// A blocked file system call can't be cancelled, so volumes still busy at the
+// timeout are abandoned rather than waited for, and any later results from
+// them are discarded. Tasks can check IsScanAbandoned to skip work that would
+// be thrown away. Threads abandoned by earlier runs count against the pool
+// until they finish, so a drive that never responds can't accumulate them.
+//
+// Results are returned in the order tasks were added, so merging them gives
+// the same outcome however the threads were scheduled. Each result can also be
+// reported as it arrives, for showing progress.
+//
+// This is kept free of Windows headers, so it can be measured anywhere.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+constexpr auto SCAN_CANCEL_POLL = std::chrono::milliseconds(50);
+constexpr size_t SCAN_MAX_THREADS{ 8 };		// including any still blocked from earlier runs
+
+inline std::atomic<size_t> g_abandonedScanThreads{ 0 };
+inline thread_local const std::atomic<bool>* t_scanAbandoned;
+
+// Test whether the scan running the calling task has given up on it.
+inline bool IsScanAbandoned()
+{
+	return t_scanAbandoned && *t_scanAbandoned;
+}
+
+template <typename Result>
+class ParallelScan
+{
+public:
+	// Called on a scan thread as each task finishes in time, with the number
+	// finished so far. Calls are serialised, and none are made after Run returns.
+	using Progress = std::function<void(size_t finished, const std::optional<Result>& result)>;
+
+	void Add(const std::string& volume, std::function<Result()> task)
+	{
+		m_tasks.push_back(Task{ volume, std::move(task) });
+	}
+
+	size_t Size() const { return m_tasks.size(); }
+
+	// Run the tasks, waiting up to the timeout for all volumes to finish, or
+	// until cancelled. Tasks that failed, or didn't finish in time, have no result.
+	std::vector<std::optional<Result>> Run(std::chrono::milliseconds timeout, Progress progress = nullptr,
+		const std::atomic<bool>* cancel = nullptr)
+	{
+		auto state = std::make_shared<State>();
+		state->results.resize(m_tasks.size());
+		state->progress = std::move(progress);
+
+		std::map<std::string, Work> volumes;
+		for (size_t i = 0; i < m_tasks.size(); ++i)
+			volumes[m_tasks[i].volume].emplace_back(i, std::move(m_tasks[i].fn));
+
+		for (auto& entry : volumes)
+			state->volumes.push_back(std::move(entry.second));
+
+		m_tasks.clear();
+
+		auto abandoned = g_abandonedScanThreads.load();
+		auto num_threads = std::min(state->volumes.size(), SCAN_MAX_THREADS - std::min(abandoned, SCAN_MAX_THREADS));
+		state->pending = num_threads;
+
+		// The state is shared, as abandoned threads may outlive this call.
+		for (size_t i = 0; i < num_threads; ++i)
+			std::thread(RunVolumes, state).detach();
+
+		// The cancel flag belongs to the caller, so it's polled rather than signalled.
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		std::unique_lock<std::mutex> lock(state->mutex);
+		while (state->pending && !(cancel && *cancel))
+		{
+			auto now = std::chrono::steady_clock::now();
+			if (now >= deadline)
+				break;
+
+			state->done.wait_until(lock, std::min(deadline, now + SCAN_CANCEL_POLL), [&] { return !state->pending; });
+		}
+
+		state->abandoned = true;
+		g_abandonedScanThreads += state->pending;
+		return std::move(state->results);
+	}
+
+private:
+	struct Task
+	{
+		std::string volume;
+		std::function<Result()> fn;
+	};
+
+	using Work = std::vector<std::pair<size_t, std::function<Result()>>>;
+
+	struct State
+	{
+		std::mutex mutex;
+		std::condition_variable done;
+		std::vector<Work> volumes;
+		std::vector<std::optional<Result>> results;
+		Progress progress;
+		size_t next_volume{ 0 };
+		size_t finished{ 0 };				// tasks with their result stored
+		size_t pending{ 0 };				// threads still running
+		std::atomic<bool> abandoned{ false };
+	};
+
+	// Take volumes until none are left, or the scan is abandoned.
+	static void RunVolumes(std::shared_ptr<State> state)
+	{
+		t_scanAbandoned = &state->abandoned;
+
+		for (;;)
+		{
+			Work work;
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (state->abandoned || state->next_volume == state->volumes.size())
+					break;
+
+				work = std::move(state->volumes[state->next_volume++]);
+			}
+
+			for (auto& [index, fn] : work)
+			{
+				if (state->abandoned)
+					break;
+
+				std::optional<Result> result;
+				try
+				{
+					result = fn();
+				}
+				catch (...) {}
+
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (!state->abandoned)
+				{
+					state->results[index] = std::move(result);
+					if (state->progress)
+						state->progress(++state->finished, state->results[index]);
+				}
+			}
+		}
+
+		t_scanAbandoned = nullptr;
+
+		std::lock_guard<std::mutex> lock(state->mutex);
+		if (state->abandoned)
+			--g_abandonedScanThreads;
+		else if (!--state->pending)
+			state->done.notify_all();
+	}
+
+	std::vector<Task> m_tasks;
+};
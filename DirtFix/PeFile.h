@@ -0,0 +1,456 @@
+// Reader for the parts of a PE image DirtFix needs to recognise a game: the
+// machine type, the product name and version from its version resource, and
+// which of the DLLs it installs shims for are imported.
+// It works in one pass over a mapped view of the file, without copying the
+// resource or allocating, so probing the many executables in a game directory
+// costs one open each.
+//
+// The input is untrusted, so every offset is checked against the view. This
+// is kept free of Windows headers, so it can be tested against fixture and
+// malformed files anywhere.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+constexpr uint16_t PE_MACHINE_I386{ 0x014c };
+constexpr uint16_t PE_MACHINE_AMD64{ 0x8664 };
+
+// DLLs whose import is noted, as bits in PeInfo::imports.
+constexpr std::string_view PE_NOTED_IMPORTS[]{ "xinput1_3.dll", "xinput1_4.dll", "xinput9_1_0.dll" };
+
+struct PeInfo
+{
+	uint16_t machine{};
+	bool has_product_name{};		// with a translation to select its string table
+	bool has_product_version{};
+	char product_name[128]{};		// truncated if longer, non-ASCII as '?'
+	char product_version[64]{};
+	uint32_t imports{};				// PE_NOTED_IMPORTS bits, directly or delay-loaded
+};
+
+// Bit for a DLL in PeInfo::imports, or 0 if its import isn't noted.
+constexpr uint32_t NotedImportBit(std::string_view dll_name)
+{
+	for (size_t i = 0; i < std::size(PE_NOTED_IMPORTS); ++i)
+	{
+		auto& name = PE_NOTED_IMPORTS[i];
+		if (name.size() != dll_name.size())
+			continue;
+
+		size_t j = 0;
+		for (; j < name.size(); ++j)
+		{
+			auto c = dll_name[j];
+			if (((c >= 'A' && c <= 'Z') ? c + 32 : c) != name[j])
+				break;
+		}
+
+		if (j == name.size())
+			return 1u << i;
+	}
+
+	return 0;
+}
+
+namespace pe_detail {
+
+constexpr uint16_t RT_VERSION_ID{ 16 };
+constexpr uint32_t RESOURCE_SUBDIR{ 0x80000000 };
+constexpr size_t MAX_RESOURCE_DEPTH{ 3 };		// type, name, language
+constexpr uint32_t DIRECTORY_IMPORT{ 1 };
+constexpr uint32_t DIRECTORY_RESOURCE{ 2 };
+constexpr uint32_t DIRECTORY_DELAY_IMPORT{ 13 };
+constexpr size_t MAX_IMPORT_DLLS{ 1024 };
+constexpr size_t MAX_IMPORT_NAME{ 256 };
+
+// Bounded view of the file, where reads past the end fail rather than fault.
+class PeView
+{
+public:
+	PeView(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+	template <typename T>
+	bool Read(size_t offset, T& value) const
+	{
+		if (offset > m_size || m_size - offset < sizeof(T))
+			return false;
+
+		std::memcpy(&value, m_data + offset, sizeof(T));
+		return true;
+	}
+
+	bool Contains(size_t offset, size_t size) const { return offset <= m_size && m_size - offset >= size; }
+	const uint8_t* At(size_t offset) const { return m_data + offset; }
+
+private:
+	const uint8_t* m_data;
+	size_t m_size;
+};
+
+// A UTF-16 string, held as a pointer into the view and a length in characters.
+struct Utf16
+{
+	const uint8_t* p{};
+	size_t length{};
+
+	char16_t At(size_t i) const { return static_cast<char16_t>(p[i * 2] | (p[i * 2 + 1] << 8)); }
+
+	bool Equals(std::string_view s, bool ignore_case = false) const
+	{
+		if (s.size() != length)
+			return false;
+
+		auto lower = [&](char16_t c) { return (ignore_case && c >= 'A' && c <= 'Z') ? c + 32 : c; };
+
+		for (size_t i = 0; i < length; ++i)
+		{
+			if (lower(At(i)) != lower(static_cast<unsigned char>(s[i])))
+				return false;
+		}
+
+		return true;
+	}
+
+	template <size_t N>
+	void CopyTo(char (&dst)[N]) const
+	{
+		size_t i = 0;
+		for (; i < length && i < N - 1; ++i)
+			dst[i] = (At(i) < 0x80) ? static_cast<char>(At(i)) : '?';
+
+		dst[i] = '\0';
+	}
+};
+
+// Find a null-terminated UTF-16 string within [offset, end).
+inline bool ReadUtf16(const PeView& view, size_t offset, size_t end, Utf16& str)
+{
+	if (!view.Contains(offset, 0) || end < offset)
+		return false;
+
+	for (auto pos = offset; pos + 2 <= end; pos += 2)
+	{
+		uint16_t c;
+		if (!view.Read(pos, c))
+			return false;
+
+		if (!c)
+		{
+			str = Utf16{ view.At(offset), (pos - offset) / 2 };
+			return true;
+		}
+	}
+
+	return false;
+}
+
+constexpr size_t Align4(size_t offset) { return (offset + 3) & ~static_cast<size_t>(3); }
+
+// A version resource block: a header, key, optional value, then child blocks,
+// each aligned to 4 bytes within the file, as the resource itself is aligned.
+struct VersionBlock
+{
+	size_t start{};
+	size_t end{};
+	uint16_t value_length{};
+	uint16_t type{};				// 1 for text values
+	Utf16 key;
+	size_t value{};
+	size_t children{};
+};
+
+inline bool ReadVersionBlock(const PeView& view, size_t offset, size_t limit, VersionBlock& block)
+{
+	uint16_t length{};
+	if (!view.Read(offset, length) || length < 6 || offset + length > limit)
+		return false;
+
+	block.start = offset;
+	block.end = offset + length;
+	if (!view.Read(offset + 2, block.value_length) || !view.Read(offset + 4, block.type) ||
+		!ReadUtf16(view, offset + 6, block.end, block.key))
+	{
+		return false;
+	}
+
+	block.value = Align4(offset + 6 + (block.key.length + 1) * 2);
+
+	// Text lengths are in characters, and binary lengths in bytes, though some
+	// tools write the former in bytes too. Text values are null-terminated, so
+	// only binary values need their length to find the children.
+	auto value_bytes = block.type ? 0 : static_cast<size_t>(block.value_length);
+	block.children = Align4(block.value + value_bytes);
+	return block.value <= block.end;
+}
+
+// Convert an RVA to a file offset using the section table.
+inline bool RvaToOffset(const PeView& view, size_t sections, uint16_t num_sections, uint32_t rva, size_t& offset)
+{
+	for (uint16_t i = 0; i < num_sections; ++i)
+	{
+		auto section = sections + i * 40;
+		uint32_t virtual_size{}, virtual_address{}, raw_size{}, raw_offset{};
+
+		if (!view.Read(section + 8, virtual_size) || !view.Read(section + 12, virtual_address) ||
+			!view.Read(section + 16, raw_size) || !view.Read(section + 20, raw_offset))
+		{
+			return false;
+		}
+
+		auto size = virtual_size ? virtual_size : raw_size;
+		if (rva >= virtual_address && rva - virtual_address < size)
+		{
+			if (rva - virtual_address >= raw_size)
+				return false;
+
+			offset = static_cast<size_t>(raw_offset) + (rva - virtual_address);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Note the imports from a descriptor table, each descriptor having the RVA of
+// the DLL name at a fixed offset, and the table ending with one that's zero.
+inline void ReadImports(const PeView& view, size_t sections, uint16_t num_sections, uint32_t table_rva,
+	size_t descriptor_size, size_t name_offset, PeInfo& info)
+{
+	size_t table{};
+	if (!RvaToOffset(view, sections, num_sections, table_rva, table))
+		return;
+
+	for (size_t i = 0; i < MAX_IMPORT_DLLS; ++i)
+	{
+		uint32_t name_rva{};
+		size_t name{};
+		if (!view.Read(table + i * descriptor_size + name_offset, name_rva) || !name_rva)
+			return;
+		else if (!RvaToOffset(view, sections, num_sections, name_rva, name))
+			continue;
+
+		size_t length = 0;
+		for (char c{}; length < MAX_IMPORT_NAME && view.Read(name + length, c) && c; ++length)
+			;
+
+		if (view.Contains(name, length))
+			info.imports |= NotedImportBit({ reinterpret_cast<const char*>(view.At(name)), length });
+	}
+}
+
+// Follow the resource tree to the first version resource, choosing the first
+// entry at the name and language levels.
+inline bool FindVersionResource(const PeView& view, size_t sections, uint16_t num_sections,
+	uint32_t resource_rva, size_t& offset, size_t& size)
+{
+	size_t root{};
+	if (!RvaToOffset(view, sections, num_sections, resource_rva, root))
+		return false;
+
+	auto directory = root;
+	for (size_t depth = 0; depth < MAX_RESOURCE_DEPTH; ++depth)
+	{
+		uint16_t num_named{}, num_ids{};
+		if (!view.Read(directory + 12, num_named) || !view.Read(directory + 14, num_ids))
+			return false;
+
+		uint32_t next{};
+		bool found = false;
+
+		// Named entries come first, and version resources are found by ID.
+		for (uint32_t i = (depth == 0) ? num_named : 0; i < static_cast<uint32_t>(num_named) + num_ids; ++i)
+		{
+			uint32_t id{}, data{};
+			auto entry = directory + 16 + i * 8;
+			if (!view.Read(entry, id) || !view.Read(entry + 4, data))
+				return false;
+
+			if (depth == 0 && id != RT_VERSION_ID)
+				continue;
+
+			next = data;
+			found = true;
+			break;
+		}
+
+		if (!found)
+			return false;
+
+		auto is_subdir = (next & RESOURCE_SUBDIR) != 0;
+		if (is_subdir != (depth + 1 < MAX_RESOURCE_DEPTH))
+			return false;
+
+		directory = root + (next & ~RESOURCE_SUBDIR);
+	}
+
+	// The leaf is a data entry, giving the RVA and size of the resource.
+	uint32_t data_rva{}, data_size{};
+	if (!view.Read(directory, data_rva) || !view.Read(directory + 4, data_size) ||
+		!RvaToOffset(view, sections, num_sections, data_rva, offset) || !view.Contains(offset, data_size))
+	{
+		return false;
+	}
+
+	size = data_size;
+	return true;
+}
+
+// Read the first translation, as the 8 hex digits naming its string table.
+inline bool ReadTranslation(const PeView& view, const VersionBlock& var_file_info, char (&table)[9])
+{
+	VersionBlock var;
+	for (auto offset = var_file_info.children; offset < var_file_info.end; offset = Align4(var.end))
+	{
+		if (!ReadVersionBlock(view, offset, var_file_info.end, var))
+			return false;
+
+		uint16_t language{}, code_page{};
+		if (var.key.Equals("Translation") && var.value_length >= 4 &&
+			view.Read(var.value, language) && view.Read(var.value + 2, code_page))
+		{
+			constexpr char HEX[] = "0123456789abcdef";
+			uint32_t value = (static_cast<uint32_t>(language) << 16) | code_page;
+			for (int i = 0; i < 8; ++i)
+				table[i] = HEX[(value >> (28 - i * 4)) & 0xf];
+
+			table[8] = '\0';
+			return true;
+		}
+	}
+
+	return false;
+}
+
+inline void ReadProductStrings(const PeView& view, const VersionBlock& string_file_info,
+	std::string_view table_name, PeInfo& info)
+{
+	VersionBlock table;
+	for (auto offset = string_file_info.children; offset < string_file_info.end; offset = Align4(table.end))
+	{
+		if (!ReadVersionBlock(view, offset, string_file_info.end, table))
+			return;
+		else if (!table.key.Equals(table_name, true))
+			continue;
+
+		VersionBlock str;
+		for (auto pos = table.children; pos < table.end; pos = Align4(str.end))
+		{
+			if (!ReadVersionBlock(view, pos, table.end, str))
+				return;
+
+			Utf16 value;
+			if (!str.value_length || !ReadUtf16(view, str.value, str.end, value))
+				continue;
+
+			if (str.key.Equals("ProductName"))
+			{
+				value.CopyTo(info.product_name);
+				info.has_product_name = true;
+			}
+			else if (str.key.Equals("ProductVersion"))
+			{
+				value.CopyTo(info.product_version);
+				info.has_product_version = true;
+			}
+		}
+
+		return;
+	}
+}
+
+} // namespace pe_detail
+
+// Parse a PE image held in memory, failing if it isn't one. Images without
+// version information succeed, with only the machine type and imports set.
+inline bool ParsePeFile(const uint8_t* data, size_t size, PeInfo& info)
+{
+	using namespace pe_detail;
+	PeView view(data, size);
+	info = PeInfo{};
+
+	uint16_t dos_magic{};
+	uint32_t nt_offset{}, nt_magic{};
+	if (!view.Read(0, dos_magic) || dos_magic != 0x5a4d ||		// MZ
+		!view.Read(0x3c, nt_offset) || !view.Read(nt_offset, nt_magic) || nt_magic != 0x4550)	// PE\0\0
+	{
+		return false;
+	}
+
+	uint16_t num_sections{}, optional_size{}, optional_magic{};
+	auto file_header = static_cast<size_t>(nt_offset) + 4;
+	auto optional_header = file_header + 20;
+	if (!view.Read(file_header, info.machine) || !view.Read(file_header + 2, num_sections) ||
+		!view.Read(file_header + 16, optional_size) || !view.Read(optional_header, optional_magic))
+	{
+		return false;
+	}
+
+	// Data directories follow the fixed fields, which differ in size for PE32+.
+	size_t directories{}, num_directories_offset{};
+	if (optional_magic == 0x10b)
+		num_directories_offset = 92, directories = 96;
+	else if (optional_magic == 0x20b)
+		num_directories_offset = 108, directories = 112;
+	else
+		return true;
+
+	uint32_t num_directories{};
+	auto sections = optional_header + optional_size;
+	if (!view.Read(optional_header + num_directories_offset, num_directories))
+		return true;
+
+	auto read_directory = [&](uint32_t index, uint32_t& rva) {
+		uint32_t directory_size{};
+		return index < num_directories && directories + (index + 1) * 8 <= optional_size &&
+			view.Read(optional_header + directories + index * 8, rva) &&
+			view.Read(optional_header + directories + index * 8 + 4, directory_size) &&
+			rva && directory_size;
+	};
+
+	// Delay-load descriptors give the name's RVA after their attributes.
+	uint32_t import_rva{}, delay_import_rva{}, resource_rva{};
+	if (read_directory(DIRECTORY_IMPORT, import_rva))
+		ReadImports(view, sections, num_sections, import_rva, 20, 12, info);
+	if (read_directory(DIRECTORY_DELAY_IMPORT, delay_import_rva))
+		ReadImports(view, sections, num_sections, delay_import_rva, 32, 4, info);
+
+	if (!read_directory(DIRECTORY_RESOURCE, resource_rva))
+		return true;
+
+	size_t resource{}, resource_length{};
+	VersionBlock root;
+	if (!FindVersionResource(view, sections, num_sections, resource_rva, resource, resource_length) ||
+		!ReadVersionBlock(view, resource, resource + resource_length, root) || !root.key.Equals("VS_VERSION_INFO"))
+	{
+		return true;
+	}
+
+	// The translation selects the string table, as VerQueryValue callers do.
+	char table_name[9]{};
+	VersionBlock child;
+	for (auto offset = root.children; offset < root.end; offset = Align4(child.end))
+	{
+		if (!ReadVersionBlock(view, offset, root.end, child))
+			break;
+		else if (child.key.Equals("VarFileInfo") && ReadTranslation(view, child, table_name))
+			break;
+	}
+
+	if (!table_name[0])
+		return true;
+
+	for (auto offset = root.children; offset < root.end; offset = Align4(child.end))
+	{
+		if (!ReadVersionBlock(view, offset, root.end, child))
+			break;
+		else if (child.key.Equals("StringFileInfo"))
+			ReadProductStrings(view, child, table_name, info);
+	}
+
+	return true;
+}
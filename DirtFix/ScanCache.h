@@ -0,0 +1,281 @@
+// Results of checking game directories, saved between runs so unchanged
+// executables needn't be opened again. Each executable is remembered by its
+// size and modification time, and is read afresh if either differs.
+//
+// The file is only a hint, so one that's damaged or from another version is
+// discarded, and the directories are scanned as if it didn't exist.
+//
+// This is kept free of Windows headers, so the parser can be fuzzed anywhere.
+
+#pragma once
+
+#include "ShimDigest.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+constexpr char SCAN_CACHE_MAGIC[8]{ 'D', 'i', 'R', 'T', 'S', 'C', 'N', '\0' };
+constexpr uint32_t SCAN_CACHE_VERSION{ 2 };
+constexpr uint32_t MAX_SCAN_CACHE_DIRS{ 1024 };
+constexpr uint32_t MAX_SCAN_CACHE_EXES{ 256 };		// per directory
+constexpr uint32_t MAX_SCAN_CACHE_NAME{ 1024 };		// bytes in a path or file name
+
+constexpr uint32_t SCAN_EXE_GAME{ 1 };
+constexpr uint32_t SCAN_EXE_X64{ 2 };
+constexpr uint32_t SCAN_EXE_FIXED{ 4 };
+constexpr uint32_t SCAN_EXE_IMPORTS_SHIFT{ 8 };		// PeInfo::imports bits above this
+
+struct ScanCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_dirs;
+	uint64_t checksum;			// of everything after the header
+};
+
+// Each directory is its length-prefixed path, then its executables, each
+// a length-prefixed file name followed by the entry.
+struct ScanCacheEntry
+{
+	uint64_t size;
+	uint64_t write_time;
+	uint32_t flags;				// SCAN_EXE_*
+	uint32_t reserved;
+};
+
+static_assert(sizeof(ScanCacheHeader) == 24 && sizeof(ScanCacheEntry) == 24, "scan cache layout must not change");
+
+struct ExeScan
+{
+	uint64_t size{};
+	uint64_t write_time{};
+	bool is_game{};
+	bool is_x64{};
+	bool is_fixed{};
+	uint8_t imports{};			// PE_NOTED_IMPORTS bits
+};
+
+// Executables by lower-case file name, within directories by lower-case path.
+using ScanCacheMap = std::map<std::string, std::map<std::string, ExeScan>>;
+
+inline std::string ScanCacheKey(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(),
+		[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return s;
+}
+
+inline std::vector<uint8_t> SerializeScanCache(const ScanCacheMap& dirs)
+{
+	std::vector<uint8_t> data(sizeof(ScanCacheHeader));
+	auto append = [&](const void* p, size_t size) {
+		auto bytes = static_cast<const uint8_t*>(p);
+		data.insert(data.end(), bytes, bytes + size);
+	};
+	auto append_string = [&](const std::string& s) {
+		auto length = static_cast<uint32_t>(s.size());
+		append(&length, sizeof(length));
+		append(s.data(), s.size());
+	};
+
+	uint32_t num_dirs{ 0 };
+	for (auto& [dir, exes] : dirs)
+	{
+		// Anything the parser would reject is left out, rather than losing the lot.
+		if (num_dirs == MAX_SCAN_CACHE_DIRS || dir.size() > MAX_SCAN_CACHE_NAME || exes.size() > MAX_SCAN_CACHE_EXES ||
+			std::any_of(exes.begin(), exes.end(), [](auto& exe) { return exe.first.size() > MAX_SCAN_CACHE_NAME; }))
+		{
+			continue;
+		}
+
+		append_string(dir);
+		auto num_exes = static_cast<uint32_t>(exes.size());
+		append(&num_exes, sizeof(num_exes));
+
+		for (auto& [name, exe] : exes)
+		{
+			ScanCacheEntry entry{ exe.size, exe.write_time,
+				(exe.is_game ? SCAN_EXE_GAME : 0) | (exe.is_x64 ? SCAN_EXE_X64 : 0) | (exe.is_fixed ? SCAN_EXE_FIXED : 0) |
+				(static_cast<uint32_t>(exe.imports) << SCAN_EXE_IMPORTS_SHIFT), 0 };
+
+			append_string(name);
+			append(&entry, sizeof(entry));
+		}
+
+		++num_dirs;
+	}
+
+	ScanCacheHeader header{};
+	std::copy(std::begin(SCAN_CACHE_MAGIC), std::end(SCAN_CACHE_MAGIC), header.magic);
+	header.version = SCAN_CACHE_VERSION;
+	header.num_dirs = num_dirs;
+
+	Fnv1a64 hash;
+	hash.Update(data.data() + sizeof(header), data.size() - sizeof(header));
+	header.checksum = hash.Value();
+	std::memcpy(data.data(), &header, sizeof(header));
+
+	return data;
+}
+
+// Parse a saved cache, failing if it's damaged or from a different version.
+inline bool ParseScanCache(const std::vector<uint8_t>& data, ScanCacheMap& dirs)
+{
+	size_t offset{ 0 };
+	auto read = [&](void* p, size_t size) {
+		if (data.size() - offset < size)
+			return false;
+
+		std::memcpy(p, data.data() + offset, size);
+		offset += size;
+		return true;
+	};
+	auto read_string = [&](std::string& s) {
+		uint32_t length{};
+		if (!read(&length, sizeof(length)) || length > MAX_SCAN_CACHE_NAME || data.size() - offset < length)
+			return false;
+
+		s.assign(reinterpret_cast<const char*>(data.data() + offset), length);
+		offset += length;
+		return true;
+	};
+
+	ScanCacheHeader header{};
+	if (!read(&header, sizeof(header)) ||
+		std::memcmp(header.magic, SCAN_CACHE_MAGIC, sizeof(SCAN_CACHE_MAGIC)) ||
+		header.version != SCAN_CACHE_VERSION ||
+		header.num_dirs > MAX_SCAN_CACHE_DIRS)
+	{
+		return false;
+	}
+
+	Fnv1a64 hash;
+	hash.Update(data.data() + offset, data.size() - offset);
+	if (header.checksum != hash.Value())
+		return false;
+
+	ScanCacheMap loaded;
+	for (uint32_t i = 0; i < header.num_dirs; ++i)
+	{
+		std::string dir;
+		uint32_t num_exes{};
+		if (!read_string(dir) || loaded.count(dir) || !read(&num_exes, sizeof(num_exes)) ||
+			num_exes > MAX_SCAN_CACHE_EXES)
+		{
+			return false;
+		}
+
+		auto& exes = loaded[dir];
+		for (uint32_t j = 0; j < num_exes; ++j)
+		{
+			std::string name;
+			ScanCacheEntry entry{};
+			if (!read_string(name) || exes.count(name) || !read(&entry, sizeof(entry)))
+				return false;
+
+			exes[name] = ExeScan{ entry.size, entry.write_time, (entry.flags & SCAN_EXE_GAME) != 0,
+				(entry.flags & SCAN_EXE_X64) != 0, (entry.flags & SCAN_EXE_FIXED) != 0,
+				static_cast<uint8_t>(entry.flags >> SCAN_EXE_IMPORTS_SHIFT) };
+		}
+	}
+
+	if (offset != data.size())
+		return false;
+
+	dirs = std::move(loaded);
+	return true;
+}
+
+// Cache shared by the scan threads, noting whether it needs saving.
+class ScanCache
+{
+public:
+	bool Load(const std::vector<uint8_t>& data)
+	{
+		ScanCacheMap dirs;
+		auto valid = ParseScanCache(data, dirs);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_dirs = std::move(dirs);
+		m_dirty = !valid;		// replace a damaged file
+		return valid;
+	}
+
+	// Serialize the cache if it changed since it was loaded or last saved.
+	bool Save(std::vector<uint8_t>& data)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_dirty)
+			return false;
+
+		data = SerializeScanCache(m_dirs);
+		m_dirty = false;
+		return true;
+	}
+
+	// Find the result for an executable, provided it's unchanged since.
+	bool Find(const std::string& dir, const std::string& name, uint64_t size, uint64_t write_time, ExeScan& scan)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it_dir = m_dirs.find(ScanCacheKey(dir));
+		if (it_dir == m_dirs.end())
+			return false;
+
+		auto it_exe = it_dir->second.find(ScanCacheKey(name));
+		if (it_exe == it_dir->second.end() || it_exe->second.size != size || it_exe->second.write_time != write_time)
+			return false;
+
+		scan = it_exe->second;
+		return true;
+	}
+
+	void Store(const std::string& dir, const std::string& name, const ExeScan& scan)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_dirs[ScanCacheKey(dir)][ScanCacheKey(name)] = scan;
+		m_dirty = true;
+	}
+
+	// Forget the executables in a directory that aren't in the given list, or
+	// the whole directory if the list is empty.
+	void Prune(const std::string& dir, const std::vector<std::string>& names)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it_dir = m_dirs.find(ScanCacheKey(dir));
+		if (it_dir == m_dirs.end())
+			return;
+
+		auto& exes = it_dir->second;
+		for (auto it = exes.begin(); it != exes.end(); )
+		{
+			auto present = std::any_of(names.begin(), names.end(),
+				[&](auto& name) { return ScanCacheKey(name) == it->first; });
+
+			if (present)
+				++it;
+			else
+			{
+				it = exes.erase(it);
+				m_dirty = true;
+			}
+		}
+
+		if (exes.empty())
+		{
+			m_dirs.erase(it_dir);
+			m_dirty = true;
+		}
+	}
+
+private:
+	std::mutex m_mutex;
+	ScanCacheMap m_dirs;
+	bool m_dirty{ false };
+};
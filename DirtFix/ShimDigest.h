@@ -0,0 +1,76 @@
+// Digests of the shim DLLs DirtFix.exe installs, so an installed copy can be
+// checked by hashing it alone, rather than reading it alongside the original.
+// The build embeds the digests of the DLLs it produced, falling back to
+// hashing the originals at run-time if they weren't available to it.
+//
+// Each installed copy's size, modification time and digest are remembered, so
+// unchanged files need no reading at all when settings are applied again.
+//
+// This is kept free of Windows headers, so it can be tested anywhere.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// FNV-1a, which the pre-build step reproduces to generate ShimDigests.h.
+class Fnv1a64
+{
+public:
+	void Update(const void* data, size_t size)
+	{
+		auto p = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i)
+			m_hash = (m_hash ^ p[i]) * 0x100000001b3ull;
+	}
+
+	uint64_t Value() const { return m_hash; }
+
+private:
+	uint64_t m_hash{ 0xcbf29ce484222325ull };
+};
+
+struct ShimDigest
+{
+	std::string_view file_name;		// name of the build output, such as dinput8_32.dll
+	uint64_t size;
+	uint64_t write_time;			// FILETIME of the output, preserved by installers
+	uint64_t digest;
+};
+
+// What was seen of an installed file, stored against its path.
+struct ShimFingerprint
+{
+	uint64_t size;
+	uint64_t write_time;
+	uint64_t digest;
+};
+
+#if __has_include("ShimDigests.h")
+#include "ShimDigests.h"
+#else
+constexpr ShimDigest SHIM_DIGESTS[]{ { "", 0, 0, 0 } };
+#endif
+
+// Find the embedded digest of a shim, provided it's for the file as it is now,
+// as a DLL rebuilt or replaced since needs hashing afresh.
+constexpr const ShimDigest* FindEmbeddedDigest(std::string_view file_name, uint64_t size, uint64_t write_time)
+{
+	for (auto& shim : SHIM_DIGESTS)
+	{
+		if (!shim.file_name.empty() && shim.file_name == file_name && shim.size == size &&
+			shim.write_time == write_time)
+		{
+			return &shim;
+		}
+	}
+
+	return nullptr;
+}
+
+// Test whether a remembered fingerprint still describes a file.
+constexpr bool IsFingerprintCurrent(const ShimFingerprint& fingerprint, uint64_t size, uint64_t write_time)
+{
+	return fingerprint.size == size && fingerprint.write_time == write_time;
+}
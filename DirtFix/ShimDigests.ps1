@@ -0,0 +1,55 @@
+# Generates ShimDigests.h for DirtFix.exe, with the size, write time and FNV-1a
+# digest of each shim DLL found in the build output directories. Shims not
+# built yet are left out, for DirtFix.exe to hash at run-time instead.
+
+param(
+	[Parameter(Mandatory = $true)][string]$Header,
+	[Parameter(Mandatory = $true)][string[]]$Dirs
+)
+
+Add-Type -TypeDefinition @"
+public static class Fnv1a64
+{
+	public static ulong Hash(byte[] data)
+	{
+		ulong hash = 0xcbf29ce484222325;
+		unchecked
+		{
+			foreach (var b in data)
+				hash = (hash ^ b) * 0x100000001b3;
+		}
+		return hash;
+	}
+}
+"@
+
+$shims = 'dinput8_32.dll', 'dinput8_64.dll', 'xinput_32.dll', 'xinput_64.dll'
+$lines = @('// Generated by ShimDigests.ps1 before each build.', '', '#pragma once', '',
+	'constexpr ShimDigest SHIM_DIGESTS[]', '{')
+
+foreach ($shim in $shims)
+{
+	foreach ($dir in $Dirs)
+	{
+		$path = Join-Path $dir $shim
+		if (Test-Path $path)
+		{
+			$data = [System.IO.File]::ReadAllBytes($path)
+			$digest = [Fnv1a64]::Hash($data)
+			$write_time = (Get-Item $path).LastWriteTimeUtc.ToFileTimeUtc()
+			$lines += "`t{{ `"{0}`", {1}, {2}, 0x{3:x16}ull }}," -f $shim, $data.Length, $write_time, $digest
+			break
+		}
+	}
+}
+
+$lines += "`t{ `"`", 0, 0, 0 },"
+$lines += '};'
+
+# Only touch the header if it changed, to avoid needless rebuilds.
+$text = ($lines -join "`r`n") + "`r`n"
+if (!(Test-Path $Header) -or [System.IO.File]::ReadAllText($Header) -ne $text)
+{
+	New-Item -ItemType Directory -Force -Path (Split-Path $Header) | Out-Null
+	[System.IO.File]::WriteAllText($Header, $text)
+}
@@ -0,0 +1,293 @@
+// TraceReplay: replays a dinput8.dll shim trace through the policy engine, to
+// show how each policy would have handled the calls from a real session.
+//
+// This uses only standard C++, so it can be built on any platform:
+//   g++ -std=c++17 -O2 -o tracereplay TraceReplay/TraceReplay.cpp
+//   cl /std:c++17 /EHsc /O2 TraceReplay\TraceReplay.cpp
+//
+// Source code released under MIT License.
+
+#include "../dinput8/DeviceCache.h"
+#include "../dinput8/Policy.h"
+#include "../dinput8/PollDetector.h"
+#include "../dinput8/Trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+constexpr size_t NUM_DECISIONS{ std::size(DECISION_NAMES) };
+
+struct SimResult
+{
+	uint64_t decisions[NUM_DECISIONS]{};
+	uint64_t enum_cost_us{};
+};
+
+bool LoadTrace(const char* path, std::vector<TraceRecord>& records)
+{
+	std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+
+	TraceHeader header{};
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) ||
+		header.version != TRACE_VERSION ||
+		header.record_size != sizeof(TraceRecord))
+	{
+		return false;
+	}
+
+	// A trace from a game that's still running may end with a partial record.
+	TraceRecord record;
+	while (file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+		records.push_back(record);
+
+	return true;
+}
+
+bool IsEnumEvent(uint8_t event)
+{
+	return event == static_cast<uint8_t>(TraceEvent::EnumDevices) ||
+		event == static_cast<uint8_t>(TraceEvent::EnumDevicesBySemantics);
+}
+
+// Average cost of the enumerations that were really performed in the trace.
+uint32_t MeanEnumCost(const std::vector<TraceRecord>& records)
+{
+	uint64_t total_us = 0, count = 0;
+
+	for (auto& record : records)
+	{
+		auto decision = static_cast<Decision>(record.decision);
+		if (IsEnumEvent(record.event) &&
+			(decision == Decision::PassThrough || decision == Decision::Capture))
+		{
+			total_us += record.duration_us;
+			++count;
+		}
+	}
+
+	return count ? static_cast<uint32_t>(total_us / count) : 0;
+}
+
+template <typename Throttle>
+SimResult Simulate(const std::vector<TraceRecord>& records, const ShimPolicy& policy,
+	const ThrottleLimits& limits, uint32_t enum_cost_us)
+{
+	SimResult result;
+	CostEstimate cost;
+	std::map<uint32_t, ThreadCalls> thread_calls;
+	std::map<uint32_t, PollDetector> detectors;
+	std::set<uint32_t> snapshot_flags;
+	std::set<std::pair<uint32_t, uint32_t>> semantic_keys;
+
+	for (auto& record : records)
+	{
+		auto event = static_cast<TraceEvent>(record.event);
+
+		switch (event)
+		{
+		case TraceEvent::EnumDevices:
+		case TraceEvent::EnumDevicesBySemantics:
+		{
+			// Semantic snapshots are approximated by genre and flags, as the
+			// action map itself isn't traced.
+			auto semantic_key = std::make_pair(record.dev_type, record.flags);
+			auto have_snapshot = (event == TraceEvent::EnumDevices) ?
+				snapshot_flags.count(SnapshotFlags(record.flags)) != 0 : semantic_keys.count(semantic_key) != 0;
+			auto& detector = detectors[record.thread_id];
+			detector.Call(record.time_us);
+
+			CallState state{ have_snapshot, cost.Estimate(), detector.IsPoller() };
+			auto decision = DecideEnumDevices(policy, state, [&] {
+				return Throttle::Allow(thread_calls[record.thread_id], limits, [&] { return record.time_us; });
+			});
+
+			// Device snapshots survive invalidation, as the shim refreshes them in
+			// the background, but semantic ones must be captured again.
+			if (decision == Decision::Capture && event == TraceEvent::EnumDevices)
+				snapshot_flags.insert(SnapshotFlags(record.flags));
+			else if (decision == Decision::Capture)
+				semantic_keys.insert(semantic_key);
+
+			if (decision == Decision::PassThrough || decision == Decision::Capture)
+			{
+				result.enum_cost_us += enum_cost_us;
+				cost.Record(enum_cost_us);
+			}
+
+			result.decisions[static_cast<size_t>(decision)]++;
+			break;
+		}
+
+		case TraceEvent::Invalidate:
+			thread_calls.clear();
+			semantic_keys.clear();
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return result;
+}
+
+// Show which threads the shim would identify as timer-driven pollers.
+void PrintPollers(const std::vector<TraceRecord>& records)
+{
+	std::map<uint32_t, PollDetector> detectors;
+	std::map<uint32_t, uint64_t> calls;
+
+	for (auto& record : records)
+	{
+		if (IsEnumEvent(record.event))
+		{
+			detectors[record.thread_id].Call(record.time_us);
+			calls[record.thread_id]++;
+		}
+	}
+
+	for (auto& [thread_id, detector] : detectors)
+	{
+		printf("thread %-8u %6llu calls  %-8s period %8.1fms  jitter %8.1fms\n",
+			thread_id, static_cast<unsigned long long>(calls[thread_id]),
+			detector.IsPoller() ? "poller" : "one-off",
+			detector.PeriodUs() / 1000.0, detector.JitterUs() / 1000.0);
+	}
+
+	printf("\n");
+}
+
+// Show how often each real enumeration was answered from the SetupAPI memo.
+void PrintSetupMemo(const std::vector<TraceRecord>& records)
+{
+	uint64_t enumerations = 0, hits = 0, misses = 0;
+
+	for (auto& record : records)
+	{
+		if (record.event != static_cast<uint8_t>(TraceEvent::SetupMemo))
+			continue;
+
+		auto queries = record.dev_type + record.flags;
+		printf("enumeration %-6llu thread %-8u %8.1fms  %6u queries  %5.1f%% memo hits\n",
+			static_cast<unsigned long long>(++enumerations), record.thread_id, record.duration_us / 1000.0,
+			queries, queries ? record.dev_type * 100.0 / queries : 0.0);
+
+		hits += record.dev_type;
+		misses += record.flags;
+	}
+
+	if (enumerations)
+	{
+		printf("%llu enumerations, %.1f%% memo hits overall\n\n", static_cast<unsigned long long>(enumerations),
+			(hits + misses) ? hits * 100.0 / (hits + misses) : 0.0);
+	}
+}
+
+void PrintResult(const std::string& name, const SimResult& result)
+{
+	printf("%-24s", name.c_str());
+	for (auto count : result.decisions)
+		printf(" %12llu", static_cast<unsigned long long>(count));
+
+	printf(" %12.1f\n", result.enum_cost_us / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <trace file> [max_calls] [refill_ms] [interval_ms] [budget_ms]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<TraceRecord> records;
+	if (!LoadTrace(argv[1], records))
+	{
+		fprintf(stderr, "%s: not a valid DirtFix trace, or from a different version\n", argv[1]);
+		return 1;
+	}
+
+	ThrottleLimits limits{ 2, DEFAULT_REFILL_US, DEFAULT_INTERVAL_US };
+	if (argc > 2)
+		limits.max_calls = static_cast<uint32_t>(strtoul(argv[2], nullptr, 10));
+	if (argc > 3)
+		limits.refill_us = strtoull(argv[3], nullptr, 10) * 1000;
+	if (argc > 4)
+		limits.interval_us = strtoull(argv[4], nullptr, 10) * 1000;
+
+	auto budget_us = DEFAULT_FRAME_BUDGET_US;
+	if (argc > 5)
+		budget_us = static_cast<uint32_t>(strtod(argv[5], nullptr) * 1000);
+
+	auto enum_cost_us = MeanEnumCost(records);
+
+	SimResult recorded;
+	uint64_t hid_changes = 0, invalidations = 0, dropped = 0;
+
+	for (auto& record : records)
+	{
+		switch (static_cast<TraceEvent>(record.event))
+		{
+		case TraceEvent::EnumDevices:
+		case TraceEvent::EnumDevicesBySemantics:
+			if (record.decision < NUM_DECISIONS)
+				recorded.decisions[record.decision]++;
+
+			if (record.decision == static_cast<uint8_t>(Decision::PassThrough) ||
+				record.decision == static_cast<uint8_t>(Decision::Capture))
+				recorded.enum_cost_us += record.duration_us;
+			break;
+
+		case TraceEvent::HidChange: ++hid_changes; break;
+		case TraceEvent::Invalidate: ++invalidations; break;
+		case TraceEvent::Dropped: dropped += record.duration_us; break;
+		case TraceEvent::CostEstimate: break;
+		case TraceEvent::SetupMemo: break;
+		}
+	}
+
+	printf("%zu records, %llu HID changes, %llu invalidations, %llu dropped, mean enumeration %.1fms\n\n",
+		records.size(),
+		static_cast<unsigned long long>(hid_changes),
+		static_cast<unsigned long long>(invalidations),
+		static_cast<unsigned long long>(dropped),
+		enum_cost_us / 1000.0);
+
+	PrintPollers(records);
+	PrintSetupMemo(records);
+
+	printf("%-24s", "policy");
+	for (auto name : DECISION_NAMES)
+		printf(" %12s", name);
+	printf(" %12s\n", "enum ms");
+
+	PrintResult("(as recorded)", recorded);
+
+	// Passthrough mode ignores the throttle, so only needs showing once.
+	for (auto mode : { ShimMode::Cached, ShimMode::Adaptive, ShimMode::PollDetect, ShimMode::Throttle, ShimMode::PassThrough })
+	{
+		for (size_t i = 0; i < std::size(THROTTLE_NAMES); ++i)
+		{
+			ShimPolicy policy{ mode, limits.max_calls, budget_us };
+			auto name = std::string(ShimModeName(mode)) + "/" + THROTTLE_NAMES[i];
+
+			auto result = WithThrottle(static_cast<ThrottleKind>(i), [&](auto throttle) {
+				return Simulate<decltype(throttle)>(records, policy, limits, enum_cost_us);
+			});
+
+			PrintResult(name, result);
+
+			if (mode == ShimMode::PassThrough)
+				break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+// Per-thread call accounting for the EnumDevices hook, without locks or
+// allocation. Each thread keeps its own state, which is discarded when it
+// sees the shared generation has changed since it was last used.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Intended for a thread_local instance, so must remain trivially constructible.
+struct ThreadCalls
+{
+	uint32_t generation;
+	uint32_t count;			// calls, or tokens used, since the last reset
+	uint64_t last_us;		// time of the last call, or token refill
+};
+
+class CallCounter
+{
+public:
+	// Return the state for the current thread, cleared if there's been a reset.
+	ThreadCalls& Sync(ThreadCalls& calls) const
+	{
+		auto generation = m_generation.load(std::memory_order_acquire);
+		if (calls.generation != generation)
+			calls = ThreadCalls{ generation, 0, 0 };
+
+		return calls;
+	}
+
+	// Count a call on the current thread, returning the total since the last reset.
+	uint32_t Increment(ThreadCalls& calls) const { return ++Sync(calls).count; }
+
+	// Reset the state for all threads, which happens lazily on their next call.
+	void Reset() { m_generation.fetch_add(1, std::memory_order_release); }
+
+private:
+	std::atomic<uint32_t> m_generation{ 1 };
+};
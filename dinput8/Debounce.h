@@ -0,0 +1,73 @@
+// Merges bursts of device change events into a single invalidation. Plugging
+// in one controller typically generates arrivals for several HID interfaces.
+//
+// The caller supplies the current time to each call, rather than this reading
+// a clock, so it can be driven by any time source.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+
+class Debouncer
+{
+public:
+	using Time = std::chrono::milliseconds;
+
+	// Fire once events stop arriving for the quiet period, but never later than
+	// max_delay after the first event, which bounds the invalidation latency.
+	Debouncer(Time quiet, Time max_delay) : m_quiet(quiet), m_max_delay(max_delay) {}
+
+	void Event(Time now)
+	{
+		if (!m_pending)
+		{
+			m_pending = true;
+			m_first = now;
+			m_events = 0;
+		}
+
+		m_last = now;
+		++m_events;
+	}
+
+	// Time remaining until the pending burst fires, or nothing if idle.
+	std::optional<Time> Timeout(Time now) const
+	{
+		if (!m_pending)
+			return std::nullopt;
+
+		auto deadline = std::min(m_last + m_quiet, m_first + m_max_delay);
+		return std::max(deadline - now, Time::zero());
+	}
+
+	// Returns true once when the pending burst is complete.
+	bool Poll(Time now)
+	{
+		auto timeout = Timeout(now);
+		if (!timeout || timeout->count() > 0)
+			return false;
+
+		m_pending = false;
+		m_latency = now - m_first;
+		m_merged = m_events;
+		return true;
+	}
+
+	// Details of the most recently fired burst.
+	Time Latency() const { return m_latency; }
+	int Merged() const { return m_merged; }
+
+private:
+	Time m_quiet;
+	Time m_max_delay;
+
+	bool m_pending{ false };
+	Time m_first{};
+	Time m_last{};
+	int m_events{ 0 };
+
+	Time m_latency{};
+	int m_merged{ 0 };
+};
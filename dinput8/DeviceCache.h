@@ -0,0 +1,252 @@
+// Snapshot of IDirectInput8::EnumDevices results, so repeat calls can be
+// answered from memory instead of repeating the expensive enumeration.
+//
+// This is kept free of Windows headers, with the entry type as a template
+// parameter (the shim holds each device in both A and W forms).
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Device classes and types from dinput.h, needed for dwDevType filtering.
+constexpr uint32_t DEVCLASS_ALL{ 0 };
+constexpr uint32_t DEVCLASS_DEVICE{ 1 };
+constexpr uint32_t DEVCLASS_POINTER{ 2 };
+constexpr uint32_t DEVCLASS_KEYBOARD{ 3 };
+constexpr uint32_t DEVCLASS_GAMECTRL{ 4 };
+
+constexpr uint32_t DEVTYPE_MOUSE{ 0x12 };
+constexpr uint32_t DEVTYPE_KEYBOARD{ 0x13 };
+constexpr uint32_t DEVTYPE_JOYSTICK{ 0x14 };
+constexpr uint32_t DEVTYPE_1STPERSON{ 0x18 };
+constexpr uint32_t DEVTYPE_SCREENPOINTER{ 0x1a };
+
+// EnumDevices flags that can be applied to a full enumeration afterwards, so
+// queries differing only by these share a snapshot.
+constexpr uint32_t EDFL_ATTACHEDONLY{ 0x1 };
+constexpr uint32_t EDFL_FORCEFEEDBACK{ 0x100 };
+constexpr uint32_t EDFL_INDEXED{ EDFL_ATTACHEDONLY | EDFL_FORCEFEEDBACK };
+
+inline uint32_t DevTypeClass(uint32_t dev_type)
+{
+	auto type = dev_type & 0xff;
+
+	if (type == DEVTYPE_MOUSE || type == DEVTYPE_SCREENPOINTER)
+		return DEVCLASS_POINTER;
+	else if (type == DEVTYPE_KEYBOARD)
+		return DEVCLASS_KEYBOARD;
+	else if (type >= DEVTYPE_JOYSTICK && type <= DEVTYPE_1STPERSON)
+		return DEVCLASS_GAMECTRL;
+
+	return DEVCLASS_DEVICE;		// anything that doesn't fall into another class
+}
+
+// Flags used to capture the snapshot that can answer a query.
+inline uint32_t SnapshotFlags(uint32_t flags)
+{
+	return flags & ~EDFL_INDEXED;
+}
+
+// Compact summary of each device, scanned instead of the much larger instance
+// data when filtering.
+struct DeviceIndexEntry
+{
+	uint8_t dev_class;
+	uint8_t dev_type;
+	uint16_t caps;		// EDFL_INDEXED bits satisfied by the device
+};
+
+inline bool IsIndexMatch(uint32_t filter, uint32_t flags, const DeviceIndexEntry& entry)
+{
+	auto required_caps = flags & EDFL_INDEXED;
+	if ((entry.caps & required_caps) != required_caps)
+		return false;
+	else if (filter == DEVCLASS_ALL)
+		return true;
+	else if (filter <= DEVCLASS_GAMECTRL)
+		return entry.dev_class == filter;
+
+	return (filter & 0xff) == entry.dev_type;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Instance>
+class DeviceSnapshot
+{
+public:
+	void Add(const Instance& instance, uint32_t caps = 0)
+	{
+		auto dev_type = static_cast<uint32_t>(instance.dwDevType);
+		m_index.push_back(DeviceIndexEntry{
+			static_cast<uint8_t>(DevTypeClass(dev_type)),
+			static_cast<uint8_t>(dev_type),
+			static_cast<uint16_t>(caps & EDFL_INDEXED) });
+		m_devices.push_back(instance);
+	}
+
+	size_t size() const { return m_devices.size(); }
+	const std::vector<Instance>& Devices() const { return m_devices; }
+	const std::vector<DeviceIndexEntry>& Index() const { return m_index; }
+
+	// Fill in capabilities that can only be determined after enumeration.
+	template <typename CapsFunc>
+	void UpdateCaps(CapsFunc&& caps_of)
+	{
+		for (size_t i = 0; i < m_devices.size(); ++i)
+			m_index[i].caps = static_cast<uint16_t>(caps_of(m_devices[i]) & EDFL_INDEXED);
+	}
+
+	// Pass devices matching the type filter and flags to the callback, until it
+	// returns false to stop.
+	template <typename Callback>
+	bool Replay(uint32_t dev_type_filter, uint32_t flags, Callback&& callback) const
+	{
+		for (size_t i = 0; i < m_index.size(); ++i)
+		{
+			if (IsIndexMatch(dev_type_filter, flags, m_index[i]) && !callback(m_devices[i]))
+				return false;
+		}
+
+		return true;
+	}
+
+private:
+	std::vector<DeviceIndexEntry> m_index;
+	std::vector<Instance> m_devices;
+};
+
+template <typename Instance>
+using SnapshotPtr = std::shared_ptr<const DeviceSnapshot<Instance>>;
+
+// Snapshots are keyed by the EnumDevices flags used to capture them, less
+// those that are answered from the index. Hidden, alias and phantom devices
+// can only be included by a separate enumeration.
+template <typename Instance, typename Key = uint32_t>
+using SnapshotMap = std::map<Key, SnapshotPtr<Instance>>;
+
+// Publishes immutable snapshot maps with a single atomic pointer exchange.
+// Readers never lock or touch a reference count, they just announce themselves
+// so writers know when a replaced map can no longer be in use.
+template <typename Instance, typename Key = uint32_t>
+class DeviceCache
+{
+public:
+	class Reader
+	{
+	public:
+		explicit Reader(const DeviceCache& cache) : m_cache(cache)
+		{
+			m_cache.m_readers.fetch_add(1);
+			m_map = m_cache.m_current.load();
+		}
+		~Reader() { m_cache.m_readers.fetch_sub(1); }
+		Reader(const Reader&) = delete;
+		void operator=(const Reader&) = delete;
+
+		const DeviceSnapshot<Instance>* Find(const Key& key) const
+		{
+			auto it = m_map->find(key);
+			return (it != m_map->end()) ? it->second.get() : nullptr;
+		}
+
+		const SnapshotMap<Instance, Key>& Snapshots() const { return *m_map; }
+
+	private:
+		const DeviceCache& m_cache;
+		const SnapshotMap<Instance, Key>* m_map;
+	};
+
+	DeviceCache() : m_current(new SnapshotMap<Instance, Key>()) {}
+	~DeviceCache() { delete m_current.load(); }
+	DeviceCache(const DeviceCache&) = delete;
+	void operator=(const DeviceCache&) = delete;
+
+	Reader Read() const { return Reader(*this); }
+
+	// Copy of the snapshots currently held, for a background refresh.
+	SnapshotMap<Instance, Key> Sample() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return *m_current.load();
+	}
+
+	// Merge the results of refreshing a sample into the current map. Snapshots
+	// stored since the sample was taken are newer, so they're kept, and sampled
+	// ones that couldn't be refreshed are dropped.
+	void Refresh(const SnapshotMap<Instance, Key>& sampled, SnapshotMap<Instance, Key> refreshed)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto next = std::make_unique<SnapshotMap<Instance, Key>>(*m_current.load());
+		for (auto& [key, snapshot] : sampled)
+		{
+			auto it = next->find(key);
+			if (it == next->end() || it->second != snapshot)
+				continue;
+
+			auto it_refreshed = refreshed.find(key);
+			if (it_refreshed != refreshed.end())
+				it->second = std::move(it_refreshed->second);
+			else
+				next->erase(it);
+		}
+
+		Publish(std::move(next));
+	}
+
+	// Add or update a single snapshot, copying the rest of the current map.
+	void Store(const Key& key, DeviceSnapshot<Instance> snapshot)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		StoreLocked(key, std::move(snapshot));
+	}
+
+	// Add a snapshot only if there isn't one already, returning whether it was.
+	bool Insert(const Key& key, DeviceSnapshot<Instance> snapshot)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_current.load()->count(key))
+			return false;
+
+		StoreLocked(key, std::move(snapshot));
+		return true;
+	}
+
+	void Replace(SnapshotMap<Instance, Key> snapshots)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Publish(std::make_unique<SnapshotMap<Instance, Key>>(std::move(snapshots)));
+	}
+
+	void Clear() { Replace({}); }
+
+private:
+	void StoreLocked(const Key& key, DeviceSnapshot<Instance> snapshot)
+	{
+		auto next = std::make_unique<SnapshotMap<Instance, Key>>(*m_current.load());
+		(*next)[key] = std::make_shared<const DeviceSnapshot<Instance>>(std::move(snapshot));
+		Publish(std::move(next));
+	}
+
+	void Publish(std::unique_ptr<SnapshotMap<Instance, Key>> next)
+	{
+		m_retired.emplace_back(m_current.exchange(next.release()));
+
+		// A reader arriving after the exchange can only see the new map, so
+		// with none active it's safe to free everything replaced so far.
+		if (m_readers.load() == 0)
+			m_retired.clear();
+	}
+
+	std::atomic<const SnapshotMap<Instance, Key>*> m_current;
+	mutable std::atomic<int> m_readers{ 0 };
+	mutable std::mutex m_mutex;
+	std::vector<std::unique_ptr<const SnapshotMap<Instance, Key>>> m_retired;
+};
@@ -0,0 +1,204 @@
+// Pool of device interfaces created by the game, so the objects it tears down
+// after each enumeration can be handed back when it asks for the same device
+// again. Creating and configuring a device takes DirectInput's global lock, and
+// the game repeats it for every device whenever it re-enumerates.
+//
+// The pool holds a reference of its own on each device, and counts those the
+// game holds on the device it lent, as the game adds and releases them. The
+// device is returned when that count reaches zero, whatever DirectInput holds
+// itself. Devices stay pooled until they're removed, and each remembers the
+// data format the game last set, so an identical request on a freshly lent
+// device can be skipped.
+//
+// This is kept free of Windows headers, with reference counting supplied by
+// the Ops type, so it can be tested against a mock object anywhere.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Devices are only handed back through the interface that created them, which
+// each device keeps a reference on, so its address can't be reused meanwhile.
+struct DevicePoolKey
+{
+	uint8_t instance_guid[16];
+	const void* creator;		// IDirectInput8A or IDirectInput8W interface
+
+	bool operator<(const DevicePoolKey& other) const
+	{
+		auto cmp = std::memcmp(instance_guid, other.instance_guid, sizeof(instance_guid));
+		return cmp ? cmp < 0 : std::less<const void*>()(creator, other.creator);
+	}
+};
+
+// Ops provides static AddRef(Device*) and Release(Device*).
+template <typename Device, typename Ops>
+class DevicePool
+{
+public:
+	// Lend an idle device, with a reference added for the caller.
+	Device* Lend(const DevicePoolKey& key)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_entries.find(key);
+		if (it == m_entries.end() || it->second.lent)
+			return nullptr;
+
+		Ops::AddRef(it->second.device);
+		it->second.lent = true;
+		it->second.loans = 1;
+		it->second.fresh = true;
+		return it->second.device;
+	}
+
+	// Pool a device newly created for the caller, who keeps their reference.
+	// The tag identifies the hardware for Remove. This fails if a device is
+	// already pooled for the key, in which case the new one isn't pooled.
+	bool Add(const DevicePoolKey& key, Device* device, const std::string& tag)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_entries.count(key))
+			return false;
+
+		Ops::AddRef(device);
+		m_entries[key] = Entry{ device, tag, {}, true, 1, false };
+		return true;
+	}
+
+	// Count a reference the game added to a device on loan.
+	void AddLoanRef(Device* device)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (auto it = Find(device); it != m_entries.end() && it->second.loans)
+			++it->second.loans;
+	}
+
+	// Count a reference the game is about to release, returning true if it's
+	// the last one on the loan. If so, a reference is taken to keep the device
+	// alive while the caller resets it, until Return makes it available again.
+	bool ReleaseLoanRef(Device* device)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = Find(device);
+		if (it == m_entries.end() || !it->second.loans || --it->second.loans)
+			return false;
+
+		Ops::AddRef(device);
+		return true;
+	}
+
+	void Return(Device* device)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (auto it = Find(device); it != m_entries.end())
+				it->second.lent = false;
+		}
+
+		Ops::Release(device);
+	}
+
+	// Test whether a data format is already set on a device just lent out,
+	// which is only asked once per loan, as the game may change it later.
+	bool IsFormatSet(Device* device, const std::vector<uint8_t>& format)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = Find(device);
+		if (it == m_entries.end() || !it->second.fresh)
+			return false;
+
+		it->second.fresh = false;
+		return !it->second.format.empty() && it->second.format == format;
+	}
+
+	void SetFormat(Device* device, const std::vector<uint8_t>& format)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (auto it = Find(device); it != m_entries.end())
+			it->second.format = format;
+	}
+
+	// Drop the devices for removed hardware, releasing the pool's reference.
+	// Those on loan are freed when the game releases them.
+	void Remove(const std::string& tag)
+	{
+		RemoveIf([&](const Entry& entry) { return entry.tag == tag; });
+	}
+
+	// Stop pooling a device whose references can no longer be counted, such as
+	// one the game has queried for another interface.
+	void Forget(Device* device)
+	{
+		RemoveIf([&](const Entry& entry) { return entry.device == device; });
+	}
+
+	size_t Size()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_entries.size();
+	}
+
+private:
+	struct Entry
+	{
+		Device* device;
+		std::string tag;
+		std::vector<uint8_t> format;	// empty until set successfully
+		bool lent;						// until returned after the last loan reference
+		uint32_t loans;					// references the game holds
+		bool fresh;						// lent without the format being set since
+	};
+
+	using Entries = std::map<DevicePoolKey, Entry>;
+
+	template <typename Pred>
+	void RemoveIf(Pred&& pred)
+	{
+		std::vector<Device*> removed;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			for (auto it = m_entries.begin(); it != m_entries.end(); )
+			{
+				if (pred(it->second))
+				{
+					removed.push_back(it->second.device);
+					it = m_entries.erase(it);
+				}
+				else
+					++it;
+			}
+		}
+
+		// Outside the lock, as the release may re-enter the pool.
+		for (auto device : removed)
+			Ops::Release(device);
+	}
+
+	typename Entries::iterator Find(Device* device)
+	{
+		for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+		{
+			if (it->second.device == device)
+				return it;
+		}
+
+		return m_entries.end();
+	}
+
+	std::mutex m_mutex;
+	Entries m_entries;
+};
@@ -0,0 +1,252 @@
+// Joystick state fed from Raw Input, so per-frame GetDeviceState calls can be
+// answered without taking DirectInput's global lock, which its window hooks
+// also take for every message the game dispatches.
+//
+// The Raw Input thread turns each HID report into device units, published
+// through a seqlock so readers never block the writer or each other. Readers
+// scale the values to the ranges DirectInput reports for each axis, giving the
+// layout of DIJOYSTATE2 without its velocity and force fields.
+//
+// This is kept free of Windows headers, so the parser and seqlock can be
+// tested and measured anywhere.
+
+#pragma once
+
+#include "HidFilter.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+constexpr size_t JOY_AXES{ 8 };			// X, Y, Z, Rx, Ry, Rz and two sliders
+constexpr size_t JOY_POVS{ 4 };
+constexpr size_t JOY_BUTTONS{ 128 };
+constexpr uint32_t JOY_POV_CENTERED{ 0xffffffff };
+
+constexpr uint16_t HID_PAGE_BUTTON{ 0x09 };
+constexpr uint16_t HID_USAGE_X{ 0x30 };
+constexpr uint16_t HID_USAGE_RZ{ 0x35 };
+constexpr uint16_t HID_USAGE_SLIDER{ 0x36 };
+constexpr uint16_t HID_USAGE_DIAL{ 0x37 };
+constexpr uint16_t HID_USAGE_HAT_SWITCH{ 0x39 };
+
+// Matches the start of DIJOYSTATE2, which DIJOYSTATE also shares apart from
+// having only 32 buttons.
+struct JoyState
+{
+	int32_t axes[JOY_AXES];
+	uint32_t povs[JOY_POVS];
+	uint8_t buttons[JOY_BUTTONS];
+};
+
+static_assert(sizeof(JoyState) == 176, "must match the DIJOYSTATE2 prefix");
+
+struct AxisRange
+{
+	int32_t min{ 0 };
+	int32_t max{ 65535 };		// DirectInput's default joystick range
+};
+
+struct AxisRanges
+{
+	AxisRange axes[JOY_AXES];
+};
+
+// A value from a HID input report, with the logical range it's reported in.
+struct HidValue
+{
+	uint16_t usage_page;
+	uint16_t usage;
+	int32_t value;
+	int32_t logical_min;
+	int32_t logical_max;
+};
+
+// Latest device state in HID units, merged from reports that may each carry
+// only some of the values.
+struct HidJoyState
+{
+	int32_t values[JOY_AXES]{};
+	int32_t logical_min[JOY_AXES]{};
+	int32_t logical_max[JOY_AXES]{};
+	uint32_t povs[JOY_POVS]{ JOY_POV_CENTERED, JOY_POV_CENTERED, JOY_POV_CENTERED, JOY_POV_CENTERED };
+	uint8_t buttons[JOY_BUTTONS]{};
+	uint32_t present{};			// bit per axis seen
+	bool unsupported{};			// has values we can't place as DirectInput would
+	bool removed{};				// gone, so only DirectInput can report that properly
+};
+
+// Convert a hat switch value to hundredths of a degree, as DirectInput does,
+// treating values outside the logical range as centred.
+inline uint32_t HatToPov(int32_t value, int32_t logical_min, int32_t logical_max)
+{
+	if (value < logical_min || value > logical_max || logical_max <= logical_min)
+		return JOY_POV_CENTERED;
+
+	auto positions = static_cast<int64_t>(logical_max) - logical_min + 1;
+	return static_cast<uint32_t>((value - logical_min) * 36000 / positions);
+}
+
+// Merge the values and buttons from one input report. Buttons are only updated
+// if the report carried them, as given by has_buttons.
+inline void ApplyHidReport(HidJoyState& state, const std::vector<HidValue>& values,
+	bool has_buttons, const std::vector<uint16_t>& buttons)
+{
+	size_t slider{ 0 }, pov{ 0 };
+
+	for (auto& value : values)
+	{
+		size_t axis{ JOY_AXES };
+
+		if (value.usage_page != HID_PAGE_GENERIC_DESKTOP)
+			state.unsupported = true;
+		else if (value.usage >= HID_USAGE_X && value.usage <= HID_USAGE_RZ)
+			axis = value.usage - HID_USAGE_X;
+		else if (value.usage == HID_USAGE_SLIDER || value.usage == HID_USAGE_DIAL)
+		{
+			if (slider < 2)
+				axis = 6 + slider++;
+			else
+				state.unsupported = true;
+		}
+		else if (value.usage == HID_USAGE_HAT_SWITCH)
+		{
+			if (pov < JOY_POVS)
+				state.povs[pov++] = HatToPov(value.value, value.logical_min, value.logical_max);
+			else
+				state.unsupported = true;
+		}
+		else
+			state.unsupported = true;
+
+		if (axis < JOY_AXES)
+		{
+			state.values[axis] = value.value;
+			state.logical_min[axis] = value.logical_min;
+			state.logical_max[axis] = value.logical_max;
+			state.present |= 1u << axis;
+		}
+	}
+
+	if (has_buttons)
+	{
+		std::memset(state.buttons, 0, sizeof(state.buttons));
+
+		for (auto usage : buttons)
+		{
+			if (usage >= 1 && usage <= JOY_BUTTONS)
+				state.buttons[usage - 1] = 0x80;
+			else
+				state.unsupported = true;
+		}
+	}
+}
+
+// Scale a logical value to an axis range, rounding to nearest.
+inline int32_t ScaleAxis(int32_t value, int32_t logical_min, int32_t logical_max, const AxisRange& range)
+{
+	if (logical_max <= logical_min)
+		return range.min;
+	else if (value <= logical_min)
+		return range.min;
+	else if (value >= logical_max)
+		return range.max;
+
+	auto span = static_cast<int64_t>(logical_max) - logical_min;
+	auto scaled = (static_cast<int64_t>(value) - logical_min) * (static_cast<int64_t>(range.max) - range.min);
+	return static_cast<int32_t>(range.min + (scaled + span / 2) / span);
+}
+
+// Axes the device doesn't have read as zero, as with DirectInput.
+inline JoyState ToJoyState(const HidJoyState& hid, const AxisRanges& ranges)
+{
+	JoyState state{};
+
+	for (size_t i = 0; i < JOY_AXES; ++i)
+	{
+		if (hid.present & (1u << i))
+			state.axes[i] = ScaleAxis(hid.values[i], hid.logical_min[i], hid.logical_max[i], ranges.axes[i]);
+	}
+
+	std::memcpy(state.povs, hid.povs, sizeof(state.povs));
+	std::memcpy(state.buttons, hid.buttons, sizeof(state.buttons));
+	return state;
+}
+
+// Compare our state with DirectInput's, allowing for rounding differences of
+// up to 1/256th of each axis range.
+inline bool IsJoyStateMatch(const JoyState& ours, const JoyState& theirs, const AxisRanges& ranges,
+	size_t num_buttons = JOY_BUTTONS)
+{
+	for (size_t i = 0; i < JOY_AXES; ++i)
+	{
+		auto tolerance = (static_cast<int64_t>(ranges.axes[i].max) - ranges.axes[i].min) / 256 + 1;
+		auto diff = static_cast<int64_t>(ours.axes[i]) - theirs.axes[i];
+		if (diff > tolerance || diff < -tolerance)
+			return false;
+	}
+
+	return !std::memcmp(ours.povs, theirs.povs, sizeof(ours.povs)) &&
+		!std::memcmp(ours.buttons, theirs.buttons, num_buttons);
+}
+
+// Single writer, many reader sequence lock. Data is held in atomic words, so
+// torn reads are detected and retried rather than being undefined behaviour.
+template <typename T>
+class Seqlock
+{
+	static_assert(std::is_trivially_copyable<T>::value, "data is copied as words");
+
+public:
+	void Write(const T& value)
+	{
+		uint32_t words[NUM_WORDS]{};
+		std::memcpy(words, &value, sizeof(T));
+
+		auto seq = m_seq.load(std::memory_order_relaxed);
+		m_seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		for (size_t i = 0; i < NUM_WORDS; ++i)
+			m_words[i].store(words[i], std::memory_order_relaxed);
+
+		m_seq.store(seq + 2, std::memory_order_release);
+	}
+
+	// Read the latest value, failing if nothing has been written yet.
+	bool Read(T& value) const
+	{
+		uint32_t words[NUM_WORDS];
+
+		for (;;)
+		{
+			auto seq = m_seq.load(std::memory_order_acquire);
+			if (seq & 1)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			for (size_t i = 0; i < NUM_WORDS; ++i)
+				words[i] = m_words[i].load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (m_seq.load(std::memory_order_relaxed) != seq)
+				continue;
+			else if (!seq)
+				return false;
+
+			std::memcpy(&value, words, sizeof(T));
+			return true;
+		}
+	}
+
+private:
+	static constexpr size_t NUM_WORDS{ (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t) };
+
+	std::atomic<uint32_t> m_seq{ 0 };
+	std::atomic<uint32_t> m_words[NUM_WORDS]{};
+};
@@ -0,0 +1,174 @@
+// Device snapshots saved next to the shim, so the first enumerations after the
+// game starts can be answered without waiting for DirectInput. The file is only
+// trusted if the hash of the HID interface paths present when it was written
+// still matches, and a real enumeration replaces it in the background anyway.
+//
+// This is kept free of Windows headers, so the parser can be fuzzed anywhere.
+
+#pragma once
+
+#include "DeviceCache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+constexpr char DISK_CACHE_MAGIC[8]{ 'D', 'i', 'R', 'T', 'D', 'E', 'V', '\0' };
+constexpr uint32_t DISK_CACHE_VERSION{ 1 };
+constexpr uint32_t MAX_DISK_CACHE_DEVICES{ 4096 };	// across all snapshots
+
+constexpr uint64_t FNV_OFFSET_BASIS{ 14695981039346656037ull };
+constexpr uint64_t FNV_PRIME{ 1099511628211ull };
+
+struct DiskCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;		// sizeof the device entry type
+	uint64_t device_hash;		// HashDevicePaths when written
+	uint64_t checksum;			// of everything after the header
+	uint32_t num_snapshots;
+	uint32_t reserved;
+};
+
+// Each snapshot is followed by its devices, as a uint32_t of EDFL_INDEXED
+// capabilities followed by the raw entry.
+struct DiskSnapshotHeader
+{
+	uint32_t flags;
+	uint32_t num_devices;
+};
+
+static_assert(sizeof(DiskCacheHeader) == 40 && sizeof(DiskSnapshotHeader) == 8, "disk cache layout must not change");
+
+inline uint64_t Fnv1a(const void* data, size_t size, uint64_t hash = FNV_OFFSET_BASIS)
+{
+	auto p = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ p[i]) * FNV_PRIME;
+
+	return hash;
+}
+
+// Hash a set of device interface paths, ignoring their order and case.
+inline uint64_t HashDevicePaths(std::vector<std::string> paths)
+{
+	for (auto& path : paths)
+	{
+		std::transform(path.begin(), path.end(), path.begin(),
+			[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	}
+
+	std::sort(paths.begin(), paths.end());
+
+	auto hash = FNV_OFFSET_BASIS;
+	for (auto& path : paths)
+		hash = Fnv1a(path.c_str(), path.size() + 1, hash);	// including terminator
+
+	return hash;
+}
+
+template <typename Entry>
+std::vector<uint8_t> SerializeDiskCache(uint64_t device_hash, const SnapshotMap<Entry>& snapshots)
+{
+	static_assert(std::is_trivially_copyable<Entry>::value, "entries are stored as raw bytes");
+
+	std::vector<uint8_t> data(sizeof(DiskCacheHeader));
+	auto append = [&](const void* p, size_t size) {
+		auto bytes = static_cast<const uint8_t*>(p);
+		data.insert(data.end(), bytes, bytes + size);
+	};
+
+	for (auto& snapshot : snapshots)
+	{
+		DiskSnapshotHeader snapshot_header{ snapshot.first, static_cast<uint32_t>(snapshot.second->size()) };
+		append(&snapshot_header, sizeof(snapshot_header));
+
+		auto& index = snapshot.second->Index();
+		auto& devices = snapshot.second->Devices();
+		for (size_t i = 0; i < devices.size(); ++i)
+		{
+			uint32_t caps = index[i].caps;
+			append(&caps, sizeof(caps));
+			append(&devices[i], sizeof(Entry));
+		}
+	}
+
+	DiskCacheHeader header{};
+	std::copy(std::begin(DISK_CACHE_MAGIC), std::end(DISK_CACHE_MAGIC), header.magic);
+	header.version = DISK_CACHE_VERSION;
+	header.entry_size = sizeof(Entry);
+	header.device_hash = device_hash;
+	header.checksum = Fnv1a(data.data() + sizeof(header), data.size() - sizeof(header));
+	header.num_snapshots = static_cast<uint32_t>(snapshots.size());
+	std::memcpy(data.data(), &header, sizeof(header));
+
+	return data;
+}
+
+// Parse a saved cache, failing if it's damaged, from a different build, or was
+// written with a different set of HID devices present.
+template <typename Entry>
+bool ParseDiskCache(const std::vector<uint8_t>& data, uint64_t device_hash, SnapshotMap<Entry>& snapshots)
+{
+	static_assert(std::is_trivially_copyable<Entry>::value, "entries are stored as raw bytes");
+
+	size_t offset{ 0 };
+	auto read = [&](void* p, size_t size) {
+		if (data.size() - offset < size)
+			return false;
+
+		std::memcpy(p, data.data() + offset, size);
+		offset += size;
+		return true;
+	};
+
+	DiskCacheHeader header{};
+	if (!read(&header, sizeof(header)) ||
+		std::memcmp(header.magic, DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC)) ||
+		header.version != DISK_CACHE_VERSION ||
+		header.entry_size != sizeof(Entry) ||
+		header.device_hash != device_hash ||
+		header.checksum != Fnv1a(data.data() + offset, data.size() - offset))
+	{
+		return false;
+	}
+
+	SnapshotMap<Entry> loaded;
+	uint32_t total_devices{ 0 };
+
+	for (uint32_t i = 0; i < header.num_snapshots; ++i)
+	{
+		DiskSnapshotHeader snapshot_header{};
+		if (!read(&snapshot_header, sizeof(snapshot_header)) ||
+			loaded.count(snapshot_header.flags) ||
+			snapshot_header.num_devices > MAX_DISK_CACHE_DEVICES - total_devices)
+		{
+			return false;
+		}
+
+		total_devices += snapshot_header.num_devices;
+
+		DeviceSnapshot<Entry> snapshot;
+		for (uint32_t j = 0; j < snapshot_header.num_devices; ++j)
+		{
+			uint32_t caps{};
+			Entry entry;
+			if (!read(&caps, sizeof(caps)) || !read(&entry, sizeof(entry)))
+				return false;
+
+			snapshot.Add(entry, caps);
+		}
+
+		loaded[snapshot_header.flags] = std::make_shared<const DeviceSnapshot<Entry>>(std::move(snapshot));
+	}
+
+	if (offset != data.size())
+		return false;
+
+	snapshots = std::move(loaded);
+	return true;
+}
@@ -0,0 +1,172 @@
+// Classification of HID interface arrivals and removals, so only changes to
+// game controllers invalidate the device snapshots. Headsets, tracker dongles
+// and RGB peripherals come and go often during VR sessions, and re-running the
+// expensive enumeration for them gains nothing.
+//
+// This is kept free of Windows headers, as a pure function of the interface
+// path, any usage read from the device, and the configured allow/deny lists.
+
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// HID usage pages and Generic Desktop usages for game controllers.
+constexpr uint16_t HID_PAGE_GENERIC_DESKTOP{ 0x01 };
+constexpr uint16_t HID_PAGE_SIMULATION{ 0x02 };
+constexpr uint16_t HID_PAGE_GAME{ 0x05 };
+
+constexpr uint16_t HID_USAGE_JOYSTICK{ 0x04 };
+constexpr uint16_t HID_USAGE_GAMEPAD{ 0x05 };
+constexpr uint16_t HID_USAGE_MULTI_AXIS{ 0x08 };
+
+struct HidDeviceInfo
+{
+	uint16_t vid{};
+	uint16_t pid{};
+	bool has_ids{};
+	uint16_t usage_page{};
+	uint16_t usage{};
+	bool has_usage{};		// only available while the device is present
+};
+
+// Vendor and product to match, with pid ignored if any_pid is set.
+struct HidId
+{
+	uint16_t vid;
+	uint16_t pid;
+	bool any_pid;
+};
+
+struct HidFilter
+{
+	bool enabled{ true };
+	std::vector<HidId> allow;	// always invalidate
+	std::vector<HidId> deny;	// never invalidate
+};
+
+inline bool ParseHex(const std::string& str, size_t pos, size_t digits, uint32_t& value)
+{
+	if (pos + digits > str.size())
+		return false;
+
+	value = 0;
+	for (size_t i = pos; i < pos + digits; ++i)
+	{
+		if (!std::isxdigit(static_cast<unsigned char>(str[i])))
+			return false;
+
+		auto c = std::tolower(static_cast<unsigned char>(str[i]));
+		value = (value << 4) | static_cast<uint32_t>((c <= '9') ? (c - '0') : (c - 'a' + 10));
+	}
+
+	return true;
+}
+
+// Find a "VID_045E" style ID, or the "VID&0002045E_PID&02E0" form used by
+// Bluetooth devices, where the vendor ID has a 4 digit vendor source prefix.
+inline bool ParseHidPathId(const std::string& upper_path, const std::string& name, size_t amp_digits, uint16_t& id)
+{
+	uint32_t value{};
+
+	auto pos = upper_path.find(name + "_");
+	if (pos != std::string::npos && ParseHex(upper_path, pos + name.size() + 1, 4, value))
+	{
+		id = static_cast<uint16_t>(value);
+		return true;
+	}
+
+	pos = upper_path.find(name + "&");
+	if (pos != std::string::npos && ParseHex(upper_path, pos + name.size() + 1, amp_digits, value))
+	{
+		id = static_cast<uint16_t>(value & 0xffff);
+		return true;
+	}
+
+	return false;
+}
+
+// Extract the vendor and product IDs from a HID interface path, such as:
+//   \\?\HID#VID_045E&PID_028E&IG_00#3&2a51c6a0&0&0000#{4d1e55b2-f16f-11cf-88cb-001111000030}
+inline HidDeviceInfo ParseHidInterfacePath(const std::string& path)
+{
+	std::string upper_path(path);
+	for (auto& c : upper_path)
+		c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+
+	HidDeviceInfo info;
+	info.has_ids = ParseHidPathId(upper_path, "VID", 8, info.vid) && ParseHidPathId(upper_path, "PID", 4, info.pid);
+	return info;
+}
+
+inline bool IsGameControllerUsage(uint16_t usage_page, uint16_t usage)
+{
+	if (usage_page == HID_PAGE_GENERIC_DESKTOP)
+		return usage == HID_USAGE_JOYSTICK || usage == HID_USAGE_GAMEPAD || usage == HID_USAGE_MULTI_AXIS;
+
+	return usage_page == HID_PAGE_SIMULATION || usage_page == HID_PAGE_GAME;
+}
+
+inline bool IsHidIdMatch(const std::vector<HidId>& ids, const HidDeviceInfo& info)
+{
+	if (!info.has_ids)
+		return false;
+
+	for (auto& id : ids)
+	{
+		if (id.vid == info.vid && (id.any_pid || id.pid == info.pid))
+			return true;
+	}
+
+	return false;
+}
+
+// Decide whether a HID change should invalidate the device snapshots. Devices
+// we can't identify are assumed to matter, as a missed controller is worse
+// than a wasted enumeration.
+inline bool ShouldInvalidate(const HidFilter& filter, const HidDeviceInfo& info)
+{
+	if (!filter.enabled)
+		return true;
+	else if (IsHidIdMatch(filter.deny, info))
+		return false;
+	else if (IsHidIdMatch(filter.allow, info))
+		return true;
+	else if (info.has_usage)
+		return IsGameControllerUsage(info.usage_page, info.usage);
+
+	return true;
+}
+
+// Parse a list such as "046D:C29B, 28DE:*", ignoring malformed entries.
+inline std::vector<HidId> ParseHidIdList(const std::string& list)
+{
+	std::vector<HidId> ids;
+	size_t start{ 0 };
+
+	while (start < list.size())
+	{
+		auto end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+
+		std::string item;
+		for (auto i = start; i < end; ++i)
+		{
+			if (!std::isspace(static_cast<unsigned char>(list[i])))
+				item += list[i];
+		}
+
+		uint32_t vid{}, pid{};
+		if (item.size() == 6 && item.substr(4) == ":*" && ParseHex(item, 0, 4, vid))
+			ids.push_back(HidId{ static_cast<uint16_t>(vid), 0, true });
+		else if (item.size() == 9 && item[4] == ':' && ParseHex(item, 0, 4, vid) && ParseHex(item, 5, 4, pid))
+			ids.push_back(HidId{ static_cast<uint16_t>(vid), static_cast<uint16_t>(pid), false });
+
+		start = end + 1;
+	}
+
+	return ids;
+}
@@ -0,0 +1,207 @@
+// Decides how each hooked EnumDevices call is handled under the current
+// policy. This is shared by the shim and the offline TraceReplay tool, so
+// it must stay free of Windows headers.
+
+#pragma once
+
+#include "CallCounter.h"
+#include "../Common/ShimControl.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+enum class Decision : uint8_t
+{
+	PassThrough,	// call DirectInput with the original arguments
+	Capture,		// call DirectInput for all devices, keeping a snapshot
+	Replay,			// serve the call from a snapshot
+	Fail,			// fail the call, so the game skips post-processing
+};
+
+constexpr const char* DECISION_NAMES[]{ "passthrough", "capture", "replay", "fail" };
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Throttles decide whether a call that can't be replayed may reach DirectInput.
+// One is chosen per game at load time, and the hook is instantiated for it, so
+// there's no run-time dispatch on the hot path.
+
+struct ThrottleLimits
+{
+	uint32_t max_calls;		// calls per thread, or token bucket size
+	uint64_t refill_us;		// token bucket refill time per call
+	uint64_t interval_us;	// minimum time between calls on a thread
+};
+
+constexpr uint64_t DEFAULT_REFILL_US{ 60'000'000 };
+constexpr uint64_t DEFAULT_INTERVAL_US{ 30'000'000 };
+
+// Allow max_calls per thread, until the next device change. The original policy.
+struct CountLimitThrottle
+{
+	template <typename Clock>
+	static bool Allow(ThreadCalls& calls, const ThrottleLimits& limits, Clock&&)
+	{
+		return ++calls.count <= limits.max_calls;
+	}
+};
+
+// Allow bursts of up to max_calls per thread, refilled at one call per refill_us.
+struct TokenBucketThrottle
+{
+	template <typename Clock>
+	static bool Allow(ThreadCalls& calls, const ThrottleLimits& limits, Clock&& now_us)
+	{
+		auto now = now_us();
+
+		if (calls.count && limits.refill_us)
+		{
+			auto refilled = (now - calls.last_us) / limits.refill_us;
+			if (refilled >= calls.count)
+				calls.count = 0;
+			else
+			{
+				calls.count -= static_cast<uint32_t>(refilled);
+				calls.last_us += refilled * limits.refill_us;
+			}
+		}
+
+		// Refill time is measured from when the bucket was last full.
+		if (!calls.count)
+			calls.last_us = now;
+
+		if (calls.count >= limits.max_calls)
+			return false;
+
+		++calls.count;
+		return true;
+	}
+};
+
+// Allow one call per thread every interval_us.
+struct MinIntervalThrottle
+{
+	template <typename Clock>
+	static bool Allow(ThreadCalls& calls, const ThrottleLimits& limits, Clock&& now_us)
+	{
+		auto now = now_us();
+		if (calls.count && now - calls.last_us < limits.interval_us)
+			return false;
+
+		++calls.count;
+		calls.last_us = now;
+		return true;
+	}
+};
+
+struct PassThroughThrottle
+{
+	template <typename Clock>
+	static bool Allow(ThreadCalls&, const ThrottleLimits&, Clock&&)
+	{
+		return true;
+	}
+};
+
+enum class ThrottleKind : uint32_t
+{
+	CountLimit,
+	TokenBucket,
+	MinInterval,
+	PassThrough,
+};
+
+constexpr const char* THROTTLE_NAMES[]{ "count", "tokenbucket", "interval", "passthrough" };
+
+inline bool ParseThrottleKind(const char* name, ThrottleKind& kind)
+{
+	for (size_t i = 0; i < std::size(THROTTLE_NAMES); ++i)
+	{
+		if (!strcmp(name, THROTTLE_NAMES[i]))
+		{
+			kind = static_cast<ThrottleKind>(i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Call func with a default constructed instance of the throttle for kind.
+template <typename Func>
+auto WithThrottle(ThrottleKind kind, Func&& func)
+{
+	switch (kind)
+	{
+	case ThrottleKind::TokenBucket: return func(TokenBucketThrottle{});
+	case ThrottleKind::MinInterval: return func(MinIntervalThrottle{});
+	case ThrottleKind::PassThrough: return func(PassThroughThrottle{});
+	default: return func(CountLimitThrottle{});
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Moving average of the cost of real enumerations, for adaptive mode. Racing
+// updates from different threads may lose a sample, which is harmless here.
+class CostEstimate
+{
+public:
+	static constexpr uint32_t WEIGHT{ 4 };		// each sample contributes 1/WEIGHT
+
+	void Record(uint32_t cost_us)
+	{
+		uint64_t estimate_us = m_estimate_us.load(std::memory_order_relaxed);
+		auto next_us = estimate_us ? (estimate_us * (WEIGHT - 1) + cost_us) / WEIGHT : cost_us;
+		m_estimate_us.store(static_cast<uint32_t>(std::max<uint64_t>(next_us, 1)), std::memory_order_relaxed);
+	}
+
+	// Zero until the first sample.
+	uint32_t Estimate() const { return m_estimate_us.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint32_t> m_estimate_us{ 0 };
+};
+
+inline bool UsesSnapshots(ShimMode mode)
+{
+	return mode == ShimMode::Cached || mode == ShimMode::Adaptive || mode == ShimMode::PollDetect;
+}
+
+// Adaptive mode passes through calls cheap enough to fit in the frame budget,
+// as those keep hot-plug working for free. The cost is unknown at first.
+inline bool IsWithinBudget(const ShimPolicy& policy, uint32_t cost_us)
+{
+	return cost_us && cost_us <= policy.budget_us;
+}
+
+// What's known about a call when deciding how to handle it.
+struct CallState
+{
+	bool have_snapshot;
+	uint32_t cost_us;		// CostEstimate, or zero if unknown
+	bool is_poller;			// from the calling thread's PollDetector
+};
+
+// The throttle is only consulted when it's needed, through allow_call.
+template <typename AllowCall>
+Decision DecideEnumDevices(const ShimPolicy& policy, const CallState& state, AllowCall&& allow_call)
+{
+	auto mode = policy.mode;
+	if (mode == ShimMode::Adaptive)
+		mode = IsWithinBudget(policy, state.cost_us) ? ShimMode::PassThrough : ShimMode::Cached;
+	else if (mode == ShimMode::PollDetect)
+		mode = state.is_poller ? ShimMode::Cached : ShimMode::PassThrough;
+
+	if (mode == ShimMode::PassThrough)
+		return Decision::PassThrough;
+	else if (mode == ShimMode::Cached && state.have_snapshot)
+		return Decision::Replay;
+	else if (!allow_call())
+		return Decision::Fail;
+
+	return (mode == ShimMode::Throttle) ? Decision::PassThrough : Decision::Capture;
+}
@@ -0,0 +1,68 @@
+// Detection of threads calling EnumDevices on a timer, which is the pattern
+// that causes the stutters, as opposed to one-off calls driven by the game UI.
+// Each thread's call interval and jitter are tracked with moving averages, as
+// TCP does for round-trip times, and a thread is judged to be polling once the
+// jitter is small compared to the period.
+//
+// This uses only standard C++, with times passed in, so it can be checked
+// against synthetic or recorded timelines anywhere.
+
+#pragma once
+
+#include <cstdint>
+
+constexpr uint32_t POLL_MIN_INTERVALS{ 4 };			// before any judgement
+constexpr int64_t POLL_MIN_PERIOD_US{ 200'000 };	// faster repeats are bursts
+constexpr int64_t POLL_MAX_PERIOD_US{ 60'000'000 };	// longer gaps restart detection
+constexpr int64_t POLL_MAX_JITTER_PERCENT{ 20 };
+
+class PollDetector
+{
+public:
+	void Call(uint64_t now_us)
+	{
+		auto interval_us = static_cast<int64_t>(now_us - m_last_us);
+		auto first_call = m_calls++ == 0;
+		m_last_us = now_us;
+
+		if (first_call)
+			return;
+		else if (interval_us > POLL_MAX_PERIOD_US)
+		{
+			m_intervals = 0;
+			return;
+		}
+
+		if (m_intervals++ == 0)
+		{
+			// Start pessimistic, so several regular intervals are needed.
+			m_period_us = interval_us;
+			m_jitter_us = interval_us / 2;
+			return;
+		}
+
+		auto deviation_us = interval_us - m_period_us;
+		if (deviation_us < 0)
+			deviation_us = -deviation_us;
+
+		m_period_us += (interval_us - m_period_us) / 8;
+		m_jitter_us += (deviation_us - m_jitter_us) / 4;
+	}
+
+	bool IsPoller() const
+	{
+		return m_intervals >= POLL_MIN_INTERVALS &&
+			m_period_us >= POLL_MIN_PERIOD_US &&
+			m_jitter_us * 100 <= m_period_us * POLL_MAX_JITTER_PERCENT;
+	}
+
+	int64_t PeriodUs() const { return m_period_us; }
+	int64_t JitterUs() const { return m_jitter_us; }
+
+private:
+	uint64_t m_last_us{ 0 };
+	uint32_t m_calls{ 0 };
+	uint32_t m_intervals{ 0 };
+	int64_t m_period_us{ 0 };
+	int64_t m_jitter_us{ 0 };
+};
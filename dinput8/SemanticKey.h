@@ -0,0 +1,42 @@
+// Key for EnumDevicesBySemantics results. Which devices are offered, and the
+// flags they're offered with, depend on the actions in the caller's action
+// map, so every action's semantic, flags, application data and instance are
+// part of the key, not just the map's GUID and size.
+//
+// This is kept free of Windows headers, with the action type as a template
+// parameter (DIACTIONA and DIACTIONW share the fields used).
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+inline void AppendKeyBytes(std::wstring& key, const void* p, size_t size)
+{
+	constexpr wchar_t HEX_DIGITS[]{ L"0123456789abcdef" };
+
+	auto bytes = static_cast<const uint8_t*>(p);
+	for (size_t i = 0; i < size; ++i)
+	{
+		key += HEX_DIGITS[bytes[i] >> 4];
+		key += HEX_DIGITS[bytes[i] & 0xf];
+	}
+}
+
+template <typename Action>
+void AppendSemanticActions(std::wstring& key, const Action* actions, uint32_t num_actions)
+{
+	if (!actions)
+		return;
+
+	for (uint32_t i = 0; i < num_actions; ++i)
+	{
+		auto& action = actions[i];
+
+		key += L'|';
+		AppendKeyBytes(key, &action.dwSemantic, sizeof(action.dwSemantic));
+		AppendKeyBytes(key, &action.dwFlags, sizeof(action.dwFlags));
+		AppendKeyBytes(key, &action.uAppData, sizeof(action.uAppData));
+		AppendKeyBytes(key, &action.guidInstance, sizeof(action.guidInstance));
+	}
+}
@@ -0,0 +1,204 @@
+// Memo of the SetupAPI and configuration manager queries that DirectInput makes
+// during each enumeration, which is where most of its time goes. It re-opens
+// the HID device information set and re-reads the same registry properties of
+// every device each time, so the results are kept until the next HID change
+// makes them suspect.
+//
+// This is kept free of Windows headers, with the real queries passed in, so the
+// hit rate can be measured against a mock device tree anywhere.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+enum class SetupQuery : uint32_t
+{
+	DeviceRegistryPropertyA,	// SetupDiGetDeviceRegistryProperty
+	DeviceRegistryPropertyW,
+	DevNodeRegistryPropertyA,	// CM_Get_DevNode_Registry_Property
+	DevNodeRegistryPropertyW,
+};
+
+struct SetupPropertyKey
+{
+	SetupQuery query;
+	uint32_t dev_inst;
+	uint32_t property;
+
+	bool operator<(const SetupPropertyKey& other) const
+	{
+		return std::tie(query, dev_inst, property) < std::tie(other.query, other.dev_inst, other.property);
+	}
+};
+
+// Outcome of a property query, with a status of zero for success. Failures are
+// kept too, as most devices lack most of the properties asked for.
+struct SetupPropertyResult
+{
+	uint32_t status{};
+	uint32_t type{};
+	std::vector<uint8_t> data;
+};
+
+// Arguments of a device information set request that was memoised.
+struct SetupClassKey
+{
+	uint8_t class_guid[16];
+	uint32_t flags;
+	bool wide;
+
+	bool operator<(const SetupClassKey& other) const
+	{
+		auto cmp = std::memcmp(class_guid, other.class_guid, sizeof(class_guid));
+		return cmp ? cmp < 0 : std::tie(flags, wide) < std::tie(other.flags, other.wide);
+	}
+};
+
+struct SetupMemoStats
+{
+	uint32_t hits{};
+	uint32_t misses{};
+};
+
+// Copy a result to the caller's buffer, returning the status they should see.
+// That's buffer_small if the data doesn't fit, with required set either way.
+inline uint32_t CopySetupProperty(const SetupPropertyResult& result, void* buffer, uint32_t size,
+	uint32_t& required, uint32_t buffer_small)
+{
+	required = static_cast<uint32_t>(result.data.size());
+
+	if (result.status)
+		return result.status;
+	else if (size < required || (!buffer && required))
+		return buffer_small;
+
+	if (required)
+		std::memcpy(buffer, result.data.data(), required);
+
+	return 0;
+}
+
+// Device information sets are lent to one user at a time, so callers that
+// modify theirs can't affect anyone else. Handles are opaque values here.
+class SetupMemo
+{
+public:
+	template <typename Query>
+	SetupPropertyResult Property(const SetupPropertyKey& key, Query&& query, SetupMemoStats& stats)
+	{
+		uint32_t generation;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (auto it = m_properties.find(key); it != m_properties.end())
+			{
+				++stats.hits;
+				return it->second;
+			}
+
+			generation = m_generation;
+		}
+
+		++stats.misses;
+		auto result = query();
+
+		// Drop a result that may predate a change during the query.
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_generation == generation)
+			m_properties[key] = result;
+
+		return result;
+	}
+
+	// Borrow a set opened by an earlier enumeration, if there is one not in use.
+	bool AcquireClass(const SetupClassKey& key, uintptr_t& handle, SetupMemoStats& stats)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_classes.find(key);
+		if (it == m_classes.end() || it->second.in_use)
+		{
+			++stats.misses;
+			return false;
+		}
+
+		++stats.hits;
+		it->second.in_use = true;
+		handle = it->second.handle;
+		return true;
+	}
+
+	// Keep a newly opened set for later enumerations, lent to the caller now.
+	// This fails if a set is already kept for the key, or there's been a change
+	// since the caller opened it, in which case the caller still owns it.
+	bool AddClass(const SetupClassKey& key, uintptr_t handle, uint32_t generation)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_generation != generation || m_classes.count(key))
+			return false;
+
+		m_classes[key] = ClassEntry{ handle, true };
+		return true;
+	}
+
+	// Return a set after use, which reports whether the caller must destroy it.
+	// That's true for sets we never kept, and those dropped while on loan.
+	bool ReleaseClass(uintptr_t handle)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (auto& [key, entry] : m_classes)
+		{
+			if (entry.handle == handle)
+			{
+				entry.in_use = false;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Forget everything, returning the sets not on loan, for the caller to
+	// destroy. Sets on loan are destroyed when they're released.
+	std::vector<uintptr_t> Invalidate()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<uintptr_t> unused;
+
+		++m_generation;
+		m_properties.clear();
+
+		for (auto& [key, entry] : m_classes)
+		{
+			if (!entry.in_use)
+				unused.push_back(entry.handle);
+		}
+
+		m_classes.clear();
+		return unused;
+	}
+
+	uint32_t Generation()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_generation;
+	}
+
+private:
+	struct ClassEntry
+	{
+		uintptr_t handle;
+		bool in_use;
+	};
+
+	std::mutex m_mutex;
+	uint32_t m_generation{ 0 };
+	std::map<SetupPropertyKey, SetupPropertyResult> m_properties;
+	std::map<SetupClassKey, ClassEntry> m_classes;
+};
@@ -0,0 +1,123 @@
+// Binary trace of DirectInput calls, HID notifications and policy decisions,
+// recorded by the shim when DIRTFIX_TRACE is set to an output file path.
+// Records are queued to a lock-free ring and written by a background thread,
+// so recording doesn't disturb the timings being measured.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+constexpr char TRACE_MAGIC[8]{ 'D', 'i', 'R', 'T', 'T', 'R', 'C', '\0' };
+constexpr uint32_t TRACE_VERSION{ 2 };	// 2: HidChange records carry the VID/PID and filtering
+
+enum class TraceEvent : uint8_t
+{
+	EnumDevices,	// hooked call, with arguments, duration and decision
+	HidChange,		// raw HID arrival or removal, DBT code in flags, VID/PID in dev_type, S_FALSE if filtered
+	Invalidate,		// debounced invalidation of cached state, latency in duration_us
+	Dropped,		// records lost to a full ring, count in duration_us
+	EnumDevicesBySemantics,	// hooked call, with dwGenre in dev_type
+	CostEstimate,	// estimate after a real enumeration in duration_us, adaptive budget in dev_type
+	SetupMemo,		// real enumeration time in duration_us, SetupAPI memo hits in dev_type, misses in flags
+};
+
+struct TraceHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t start_time;	// FILETIME at the start of the trace
+};
+
+struct TraceRecord
+{
+	uint64_t time_us;		// since the start of the trace
+	uint32_t thread_id;
+	uint32_t duration_us;
+	uint32_t dev_type;
+	uint32_t flags;
+	int32_t result;			// HRESULT
+	uint8_t event;			// TraceEvent
+	uint8_t decision;		// Decision
+	uint8_t mode;			// ShimMode
+	uint8_t reserved;
+};
+
+static_assert(sizeof(TraceHeader) == 24 && sizeof(TraceRecord) == 32, "trace layout must not change");
+
+// Bounded multi-producer single-consumer queue (after Dmitry Vyukov's design).
+// Producers never block: if the ring is full the record is dropped and counted.
+template <typename T, size_t Capacity>
+class TraceRing
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of 2");
+
+public:
+	TraceRing()
+	{
+		for (size_t i = 0; i < Capacity; ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	bool Push(const T& item)
+	{
+		auto pos = m_head.load(std::memory_order_relaxed);
+		Cell* cell;
+
+		for (;;)
+		{
+			cell = &m_cells[pos & (Capacity - 1)];
+			auto seq = cell->sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<ptrdiff_t>(seq - pos);
+
+			if (diff == 0)
+			{
+				if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				m_dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			else
+			{
+				pos = m_head.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->item = item;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Single consumer only.
+	bool Pop(T& item)
+	{
+		auto& cell = m_cells[m_tail & (Capacity - 1)];
+		if (cell.sequence.load(std::memory_order_acquire) != m_tail + 1)
+			return false;
+
+		item = cell.item;
+		cell.sequence.store(m_tail + Capacity, std::memory_order_release);
+		++m_tail;
+		return true;
+	}
+
+	// Number of records dropped since the last call.
+	uint32_t TakeDropped() { return m_dropped.exchange(0, std::memory_order_relaxed); }
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T item;
+	};
+
+	Cell m_cells[Capacity];
+	alignas(64) std::atomic<size_t> m_head{ 0 };
+	alignas(64) size_t m_tail{ 0 };
+	std::atomic<uint32_t> m_dropped{ 0 };
+};
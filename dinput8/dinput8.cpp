@@ -1,65 +1,2174 @@
 #include "pch.h"
+#include "CallCounter.h"
+#include "Debounce.h"
+#include "DeviceCache.h"
+#include "DevicePool.h"
+#include "DeviceState.h"
+#include "DiskCache.h"
+#include "HidFilter.h"
+#include "PollDetector.h"
+#include "Policy.h"
+#include "SemanticKey.h"
+#include "SetupMemo.h"
+#include "Trace.h"
+#include "../Common/GameDatabase.h"
+#include "../Common/ShimControl.h"
+#include "../Common/ShimStats.h"
 
 #pragma comment(lib, "detours.lib")		// from vcpkg
+#pragma comment(lib, "cfgmgr32.lib")
+#pragma comment(lib, "hid.lib")
+#pragma comment(lib, "setupapi.lib")
+#pragma comment(lib, "version.lib")
 
 constexpr auto APP_NAME{ "DirtFix" };
 constexpr auto MAX_ENUM_DEVICES_CALLS = 2;
+constexpr auto NOTIFY_QUIET_TIME = std::chrono::milliseconds(250);
+constexpr auto NOTIFY_MAX_DELAY = std::chrono::milliseconds(1000);
+constexpr auto CONFIG_FILE{ "DirtFix.ini" };
+constexpr auto DISK_CACHE_FILE{ "DirtFix.devices" };		// and .tmp while saving, both removed by DirtFix.exe
+constexpr uint64_t RAW_INPUT_VERIFY_US{ 250'000 };		// between checks against DirectInput
+constexpr uint32_t RAW_INPUT_MAX_MISMATCHES{ 32 };		// in a row before giving up on a device
+
+// Reference counting for the device pool, flagged so the device hooks don't
+// count the pool's own references as the game's.
+struct UnknownOps
+{
+	static inline thread_local bool active;
+
+	static void AddRef(IUnknown* pUnk) { active = true; pUnk->AddRef(); active = false; }
+	static void Release(IUnknown* pUnk) { active = true; pUnk->Release(); active = false; }
+};
+
+// Per-game settings, read once from DirtFix.ini next to the shim when it hooks.
+struct ShimConfig
+{
+	ShimPolicy policy{ ShimMode::Cached, MAX_ENUM_DEVICES_CALLS, DEFAULT_FRAME_BUDGET_US };
+	ThrottleKind throttle{ ThrottleKind::CountLimit };
+	ThrottleLimits limits{ MAX_ENUM_DEVICES_CALLS, DEFAULT_REFILL_US, DEFAULT_INTERVAL_US };
+	bool prewarm{ false };
+	bool setup_memo{ false };
+	bool raw_input{ false };
+	bool device_pool{ false };
+	HidFilter hid_filter;
+};
 
 decltype(&DirectInput8Create) g_pfnDirectInput8Create;
-decltype(IDirectInput8::lpVtbl->EnumDevices) g_pfnEnumDevices;
+decltype(&DispatchMessageA) g_pfnDispatchMessageA = DispatchMessageA;
+decltype(&DispatchMessageW) g_pfnDispatchMessageW = DispatchMessageW;
+decltype(&SetupDiGetClassDevsA) g_pfnSetupDiGetClassDevsA = SetupDiGetClassDevsA;
+decltype(&SetupDiGetClassDevsW) g_pfnSetupDiGetClassDevsW = SetupDiGetClassDevsW;
+decltype(&SetupDiDestroyDeviceInfoList) g_pfnSetupDiDestroyDeviceInfoList = SetupDiDestroyDeviceInfoList;
+decltype(&SetupDiGetDeviceRegistryPropertyA) g_pfnSetupDiGetDeviceRegistryPropertyA = SetupDiGetDeviceRegistryPropertyA;
+decltype(&SetupDiGetDeviceRegistryPropertyW) g_pfnSetupDiGetDeviceRegistryPropertyW = SetupDiGetDeviceRegistryPropertyW;
+decltype(&CM_Get_DevNode_Registry_PropertyA) g_pfnCM_Get_DevNode_Registry_PropertyA = CM_Get_DevNode_Registry_PropertyA;
+decltype(&CM_Get_DevNode_Registry_PropertyW) g_pfnCM_Get_DevNode_Registry_PropertyW = CM_Get_DevNode_Registry_PropertyW;
+HMODULE g_hinstDLL;
+bool g_forwardOnly;
+ShimConfig g_config;
+
+CallCounter g_callCounter;
+thread_local ThreadCalls t_calls;
+thread_local PollDetector t_poll;
+HWND g_hwndNotify;
+DWORD g_dwNotifyThreadId;
+DWORD g_dwRawInputThreadId;
+HANDLE g_hRefreshEvent;
+HANDLE g_hSaveEvent;
+bool g_validateDiskCache;
+std::mutex g_hookMutex;
+bool g_started;
+
+ShimStats* g_pStats;
+ShimControl* g_pControl;
+std::atomic<uint32_t> g_last_enum_us;
+std::atomic<uint32_t> g_prewarm_us;
+CostEstimate g_costEstimate;
+std::atomic<bool> g_withinBudget;
+SetupMemo g_setupMemo;
+DevicePool<IUnknown, UnknownOps> g_devicePool;	// devices of both interface types
+thread_local SetupMemoStats* t_pSetupMemoStats;	// set during real enumerations
+
+using TraceQueue = TraceRing<TraceRecord, 4096>;
+std::unique_ptr<TraceQueue> g_pTrace;
+uint64_t g_trace_start_us;
+
+///////////////////////////////////////////////////////////////////////////////
+
+uint64_t QpcMicroseconds()
+{
+	static const auto freq = [] { LARGE_INTEGER li; QueryPerformanceFrequency(&li); return li.QuadPart; }();
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	// Split to avoid overflow with long uptimes.
+	return (now.QuadPart / freq) * 1'000'000 + (now.QuadPart % freq) * 1'000'000 / freq;
+}
+
+class StopWatch
+{
+public:
+	uint32_t ElapsedUs() const { return static_cast<uint32_t>(QpcMicroseconds() - m_start_us); }
+
+private:
+	uint64_t m_start_us{ QpcMicroseconds() };
+};
+
+// Check the host executable against the game database, to see if it's a build
+// that already includes a fix.
+bool IsFixedHost()
+{
+	char szEXE[MAX_PATH]{};
+	GetModuleFileName(NULL, szEXE, _countof(szEXE));
+
+	DWORD dwHandle{};
+	std::vector<BYTE> data(GetFileVersionInfoSize(szEXE, &dwHandle));
+	if (data.empty() || !GetFileVersionInfo(szEXE, 0, static_cast<DWORD>(data.size()), data.data()))
+		return false;
+
+	struct LANGANDCODEPAGE { WORD wLanguage; WORD wCodePage; } *pLcp{};
+	UINT cbLcp{};
+	if (!VerQueryValue(data.data(), "\\VarFileInfo\\Translation", reinterpret_cast<LPVOID*>(&pLcp), &cbLcp) ||
+		cbLcp < sizeof(*pLcp))
+	{
+		return false;
+	}
+
+	char szKey[64]{};
+	sprintf_s(szKey, "\\StringFileInfo\\%04x%04x\\ProductName", pLcp->wLanguage, pLcp->wCodePage);
+
+	char* pszName{};
+	UINT cchName{};
+	if (!VerQueryValue(data.data(), szKey, reinterpret_cast<LPVOID*>(&pszName), &cchName))
+		return false;
+
+	// Unlike DirtFix.exe, a missing version here means we stay active.
+	sprintf_s(szKey, "\\StringFileInfo\\%04x%04x\\ProductVersion", pLcp->wLanguage, pLcp->wCodePage);
+
+	char* pszVersion{};
+	UINT cchVersion{};
+	if (!VerQueryValue(data.data(), szKey, reinterpret_cast<LPVOID*>(&pszVersion), &cchVersion))
+		return false;
+
+	return IsFixedVersion(pszName, ParseVersion(std::string(pszVersion, cchVersion)));
+}
+
+// Path of a file in the same directory as the shim.
+fs::path ShimFilePath(const char* pszFile)
+{
+	char szDLL[MAX_PATH]{};
+	GetModuleFileName(g_hinstDLL, szDLL, _countof(szDLL));
+	return fs::path(szDLL).remove_filename() / pszFile;
+}
+
+void LoadConfig()
+{
+	auto ini_path = ShimFilePath(CONFIG_FILE).string();
+	auto pszIni = ini_path.c_str();
+
+	char szValue[32]{};
+	GetPrivateProfileString("Policy", "Mode", "", szValue, _countof(szValue), pszIni);
+	ParseShimMode(szValue, g_config.policy.mode);
+
+	GetPrivateProfileString("Policy", "Throttle", "", szValue, _countof(szValue), pszIni);
+	ParseThrottleKind(szValue, g_config.throttle);
+
+	auto& limits = g_config.limits;
+	limits.max_calls = GetPrivateProfileInt("Policy", "MaxCalls", limits.max_calls, pszIni);
+	limits.refill_us = GetPrivateProfileInt("Policy", "RefillMs",
+		static_cast<UINT>(limits.refill_us / 1000), pszIni) * 1000ull;
+	limits.interval_us = GetPrivateProfileInt("Policy", "IntervalMs",
+		static_cast<UINT>(limits.interval_us / 1000), pszIni) * 1000ull;
+
+	g_config.policy.max_calls = limits.max_calls;
+	g_config.policy.budget_us = GetPrivateProfileInt("Policy", "FrameBudgetUs", g_config.policy.budget_us, pszIni);
+	g_config.prewarm = GetPrivateProfileInt("Startup", "PreWarm", g_config.prewarm, pszIni) != 0;
+	g_config.setup_memo = GetPrivateProfileInt("SetupApi", "Memoize", g_config.setup_memo, pszIni) != 0;
+	g_config.raw_input = GetPrivateProfileInt("RawInput", "Enabled", g_config.raw_input, pszIni) != 0;
+	g_config.device_pool = GetPrivateProfileInt("DevicePool", "Enabled", g_config.device_pool, pszIni) != 0;
+
+	auto& filter = g_config.hid_filter;
+	filter.enabled = GetPrivateProfileInt("HidFilter", "Enabled", filter.enabled, pszIni) != 0;
+
+	char szList[512]{};
+	GetPrivateProfileString("HidFilter", "Allow", "", szList, _countof(szList), pszIni);
+	filter.allow = ParseHidIdList(szList);
+	GetPrivateProfileString("HidFilter", "Deny", "", szList, _countof(szList), pszIni);
+	filter.deny = ParseHidIdList(szList);
+}
+
+// Map a named section shared with DirtFix.exe, reporting whether it's new.
+void* MapSharedSection(const std::string& name, size_t size, bool& created)
+{
+	auto hMap = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+		static_cast<DWORD>(size), name.c_str());
+	if (!hMap)
+		return nullptr;
+
+	created = GetLastError() != ERROR_ALREADY_EXISTS;
+	return MapViewOfFile(hMap, FILE_MAP_WRITE, 0, 0, size);
+}
+
+// Export latency histograms through a shared memory section named after our
+// process ID, for viewing with "DirtFix.exe /stats <pid>".
+void CreateStatsSection()
+{
+	bool created{};
+	auto pStats = reinterpret_cast<ShimStats*>(
+		MapSharedSection(ShimStatsName(GetCurrentProcessId()), sizeof(ShimStats), created));
+
+	if (pStats)
+	{
+		// New sections are zero filled, which is a valid empty histogram.
+		pStats->size = sizeof(ShimStats);
+		pStats->version = SHIM_STATS_VERSION;
+		g_pStats = pStats;
+	}
+}
+
+// Accept policy changes from "DirtFix.exe /policy <pid> ...".
+void CreateControlSection()
+{
+	bool created{};
+	auto pControl = reinterpret_cast<ShimControl*>(
+		MapSharedSection(ShimControlName(GetCurrentProcessId()), sizeof(ShimControl), created));
+
+	if (pControl)
+	{
+		if (created)
+		{
+			pControl->size = sizeof(ShimControl);
+			pControl->version = SHIM_CONTROL_VERSION;
+			pControl->Write(g_config.policy);
+		}
+
+		g_pControl = pControl;
+	}
+}
+
+// Each thread keeps the last policy it read, in case a write never finishes.
+ShimPolicy CurrentPolicy()
+{
+	thread_local ShimPolicy t_policy{ g_config.policy };
+	if (g_pControl)
+		g_pControl->Read(t_policy);
+
+	return t_policy;
+}
+
+void RecordTrace(TraceEvent event, uint32_t duration_us = 0, uint32_t dev_type = 0,
+	uint32_t flags = 0, HRESULT hr = S_OK, Decision decision = {}, ShimMode mode = {})
+{
+	if (!g_pTrace)
+		return;
+
+	TraceRecord record{};
+	record.time_us = QpcMicroseconds() - g_trace_start_us;
+	record.thread_id = GetCurrentThreadId();
+	record.duration_us = duration_us;
+	record.dev_type = dev_type;
+	record.flags = flags;
+	record.result = hr;
+	record.event = static_cast<uint8_t>(event);
+	record.decision = static_cast<uint8_t>(decision);
+	record.mode = static_cast<uint8_t>(mode);
+
+	g_pTrace->Push(record);
+}
+
+// Drain trace records to the output file, off the hooked threads.
+void TraceWriterThread(FILE* file)
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+
+	for (;;)
+	{
+		Sleep(100);
+
+		if (auto dropped = g_pTrace->TakeDropped())
+			RecordTrace(TraceEvent::Dropped, dropped);
+
+		TraceRecord record;
+		while (g_pTrace->Pop(record))
+			fwrite(&record, sizeof(record), 1, file);
+
+		fflush(file);
+	}
+}
+
+// Start recording if DIRTFIX_TRACE gives the path of a trace file to create.
+void StartTrace()
+{
+	char szPath[MAX_PATH]{};
+	if (!GetEnvironmentVariable("DIRTFIX_TRACE", szPath, _countof(szPath)))
+		return;
+
+	FILE* file{};
+	if (fopen_s(&file, szPath, "wb") || !file)
+		return;
+
+	FILETIME ft{};
+	GetSystemTimeAsFileTime(&ft);
+
+	TraceHeader header{};
+	std::copy(std::begin(TRACE_MAGIC), std::end(TRACE_MAGIC), header.magic);
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(TraceRecord);
+	header.start_time = (static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+	fwrite(&header, sizeof(header), 1, file);
+
+	g_trace_start_us = QpcMicroseconds();
+	g_pTrace = std::make_unique<TraceQueue>();
+	std::thread(TraceWriterThread, file).detach();
+}
+
+// Record the pass-through cost avoided by serving or failing a call.
+void RecordSavedCall()
+{
+	auto saved_us = g_last_enum_us.load(std::memory_order_relaxed);
+	if (g_pStats && saved_us)
+		g_pStats->enum_saved.Record(saved_us);
+}
+
+// Report the startup enumeration time hidden by pre-warming, on first use.
+void ReportPreWarmHit()
+{
+	if (auto prewarm_us = g_prewarm_us.exchange(0))
+	{
+		char szMsg[128]{};
+		sprintf_s(szMsg, "%s: pre-warm hid %ums of startup enumeration\n", APP_NAME, prewarm_us / 1000);
+		OutputDebugString(szMsg);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Lend out the device information set from an earlier enumeration, if it's
+// for the same plain query by DirectInput, rather than building a new one.
+template <typename Char>
+HDEVINFO MemoGetClassDevs(HDEVINFO(WINAPI* pfn)(const GUID*, const Char*, HWND, DWORD),
+	const GUID* ClassGuid, const Char* Enumerator, HWND hwndParent, DWORD Flags)
+{
+	auto pStats = t_pSetupMemoStats;
+	if (!pStats || !ClassGuid || Enumerator || (Flags & DIGCF_ALLCLASSES))
+		return pfn(ClassGuid, Enumerator, hwndParent, Flags);
+
+	SetupClassKey key{};
+	memcpy(key.class_guid, ClassGuid, sizeof(key.class_guid));
+	key.flags = Flags;
+	key.wide = std::is_same<Char, wchar_t>::value;
+
+	uintptr_t handle{};
+	if (g_setupMemo.AcquireClass(key, handle, *pStats))
+		return reinterpret_cast<HDEVINFO>(handle);
+
+	auto generation = g_setupMemo.Generation();
+	auto hDevInfo = pfn(ClassGuid, Enumerator, hwndParent, Flags);
+	if (hDevInfo != INVALID_HANDLE_VALUE)
+		g_setupMemo.AddClass(key, reinterpret_cast<uintptr_t>(hDevInfo), generation);
+
+	return hDevInfo;
+}
+
+HDEVINFO WINAPI Hooked_SetupDiGetClassDevsA(const GUID* ClassGuid, PCSTR Enumerator, HWND hwndParent, DWORD Flags)
+{
+	return MemoGetClassDevs(g_pfnSetupDiGetClassDevsA, ClassGuid, Enumerator, hwndParent, Flags);
+}
+
+HDEVINFO WINAPI Hooked_SetupDiGetClassDevsW(const GUID* ClassGuid, PCWSTR Enumerator, HWND hwndParent, DWORD Flags)
+{
+	return MemoGetClassDevs(g_pfnSetupDiGetClassDevsW, ClassGuid, Enumerator, hwndParent, Flags);
+}
+
+// Kept sets are only returned to the memo, ready for the next enumeration.
+BOOL WINAPI Hooked_SetupDiDestroyDeviceInfoList(HDEVINFO DeviceInfoSet)
+{
+	if (!g_setupMemo.ReleaseClass(reinterpret_cast<uintptr_t>(DeviceInfoSet)))
+		return TRUE;
+
+	return g_pfnSetupDiDestroyDeviceInfoList(DeviceInfoSet);
+}
+
+template <typename Func>
+BOOL MemoDeviceRegistryProperty(SetupQuery query, Func pfn, HDEVINFO DeviceInfoSet,
+	PSP_DEVINFO_DATA DeviceInfoData, DWORD Property, PDWORD PropertyRegDataType,
+	PBYTE PropertyBuffer, DWORD PropertyBufferSize, PDWORD RequiredSize)
+{
+	auto pStats = t_pSetupMemoStats;
+	if (!pStats || !DeviceInfoData)
+	{
+		return pfn(DeviceInfoSet, DeviceInfoData, Property, PropertyRegDataType,
+			PropertyBuffer, PropertyBufferSize, RequiredSize);
+	}
+
+	auto result = g_setupMemo.Property({ query, DeviceInfoData->DevInst, Property }, [&] {
+		SetupPropertyResult result;
+		DWORD dwType{}, dwSize{};
+
+		auto ok = pfn(DeviceInfoSet, DeviceInfoData, Property, &dwType, nullptr, 0, &dwSize);
+		if (!ok && GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+		{
+			result.data.resize(dwSize);
+			ok = pfn(DeviceInfoSet, DeviceInfoData, Property, &dwType, result.data.data(), dwSize, &dwSize);
+		}
+
+		result.status = ok ? ERROR_SUCCESS : GetLastError();
+		result.type = dwType;
+		result.data.resize(ok ? dwSize : 0);
+		return result;
+	}, *pStats);
+
+	uint32_t required{};
+	auto status = CopySetupProperty(result, PropertyBuffer, PropertyBufferSize, required, ERROR_INSUFFICIENT_BUFFER);
+
+	if (PropertyRegDataType && status == ERROR_SUCCESS)
+		*PropertyRegDataType = result.type;
+	if (RequiredSize && (status == ERROR_SUCCESS || status == ERROR_INSUFFICIENT_BUFFER))
+		*RequiredSize = required;
+
+	SetLastError(status);
+	return status == ERROR_SUCCESS;
+}
+
+BOOL WINAPI Hooked_SetupDiGetDeviceRegistryPropertyA(HDEVINFO DeviceInfoSet, PSP_DEVINFO_DATA DeviceInfoData,
+	DWORD Property, PDWORD PropertyRegDataType, PBYTE PropertyBuffer, DWORD PropertyBufferSize, PDWORD RequiredSize)
+{
+	return MemoDeviceRegistryProperty(SetupQuery::DeviceRegistryPropertyA, g_pfnSetupDiGetDeviceRegistryPropertyA,
+		DeviceInfoSet, DeviceInfoData, Property, PropertyRegDataType, PropertyBuffer, PropertyBufferSize, RequiredSize);
+}
+
+BOOL WINAPI Hooked_SetupDiGetDeviceRegistryPropertyW(HDEVINFO DeviceInfoSet, PSP_DEVINFO_DATA DeviceInfoData,
+	DWORD Property, PDWORD PropertyRegDataType, PBYTE PropertyBuffer, DWORD PropertyBufferSize, PDWORD RequiredSize)
+{
+	return MemoDeviceRegistryProperty(SetupQuery::DeviceRegistryPropertyW, g_pfnSetupDiGetDeviceRegistryPropertyW,
+		DeviceInfoSet, DeviceInfoData, Property, PropertyRegDataType, PropertyBuffer, PropertyBufferSize, RequiredSize);
+}
+
+template <typename Func>
+CONFIGRET MemoDevNodeRegistryProperty(SetupQuery query, Func pfn, DEVINST dnDevInst, ULONG ulProperty,
+	PULONG pulRegDataType, PVOID Buffer, PULONG pulLength, ULONG ulFlags)
+{
+	auto pStats = t_pSetupMemoStats;
+	if (!pStats || !pulLength || ulFlags)
+		return pfn(dnDevInst, ulProperty, pulRegDataType, Buffer, pulLength, ulFlags);
+
+	auto result = g_setupMemo.Property({ query, dnDevInst, ulProperty }, [&] {
+		SetupPropertyResult result;
+		ULONG ulType{}, ulLength{};
+
+		auto cr = pfn(dnDevInst, ulProperty, &ulType, nullptr, &ulLength, 0);
+		if (cr == CR_BUFFER_SMALL)
+		{
+			result.data.resize(ulLength);
+			cr = pfn(dnDevInst, ulProperty, &ulType, result.data.data(), &ulLength, 0);
+		}
+
+		result.status = cr;
+		result.type = ulType;
+		result.data.resize((cr == CR_SUCCESS) ? ulLength : 0);
+		return result;
+	}, *pStats);
+
+	uint32_t required{};
+	auto cr = CopySetupProperty(result, Buffer, *pulLength, required, CR_BUFFER_SMALL);
+
+	if (pulRegDataType && cr == CR_SUCCESS)
+		*pulRegDataType = result.type;
+	if (cr == CR_SUCCESS || cr == CR_BUFFER_SMALL)
+		*pulLength = required;
+
+	return cr;
+}
+
+CONFIGRET WINAPI Hooked_CM_Get_DevNode_Registry_PropertyA(DEVINST dnDevInst, ULONG ulProperty,
+	PULONG pulRegDataType, PVOID Buffer, PULONG pulLength, ULONG ulFlags)
+{
+	return MemoDevNodeRegistryProperty(SetupQuery::DevNodeRegistryPropertyA, g_pfnCM_Get_DevNode_Registry_PropertyA,
+		dnDevInst, ulProperty, pulRegDataType, Buffer, pulLength, ulFlags);
+}
+
+CONFIGRET WINAPI Hooked_CM_Get_DevNode_Registry_PropertyW(DEVINST dnDevInst, ULONG ulProperty,
+	PULONG pulRegDataType, PVOID Buffer, PULONG pulLength, ULONG ulFlags)
+{
+	return MemoDevNodeRegistryProperty(SetupQuery::DevNodeRegistryPropertyW, g_pfnCM_Get_DevNode_Registry_PropertyW,
+		dnDevInst, ulProperty, pulRegDataType, Buffer, pulLength, ulFlags);
+}
+
+// Drop the memo after a HID change, destroying the sets no one has on loan.
+void InvalidateSetupMemo()
+{
+	for (auto handle : g_setupMemo.Invalidate())
+		g_pfnSetupDiDestroyDeviceInfoList(reinterpret_cast<HDEVINFO>(handle));
+}
+
+// Called within a Detours transaction.
+void AttachSetupHooks()
+{
+	DetourAttach(&reinterpret_cast<PVOID&>(g_pfnSetupDiGetClassDevsA), Hooked_SetupDiGetClassDevsA);
+	DetourAttach(&reinterpret_cast<PVOID&>(g_pfnSetupDiGetClassDevsW), Hooked_SetupDiGetClassDevsW);
+	DetourAttach(&reinterpret_cast<PVOID&>(g_pfnSetupDiDestroyDeviceInfoList), Hooked_SetupDiDestroyDeviceInfoList);
+	DetourAttach(&reinterpret_cast<PVOID&>(g_pfnSetupDiGetDeviceRegistryPropertyA), Hooked_SetupDiGetDeviceRegistryPropertyA);
+	DetourAttach(&reinterpret_cast<PVOID&>(g_pfnSetupDiGetDeviceRegistryPropertyW), Hooked_SetupDiGetDeviceRegistryPropertyW);
+	DetourAttach(&reinterpret_cast<PVOID&>(g_pfnCM_Get_DevNode_Registry_PropertyA), Hooked_CM_Get_DevNode_Registry_PropertyA);
+	DetourAttach(&reinterpret_cast<PVOID&>(g_pfnCM_Get_DevNode_Registry_PropertyW), Hooked_CM_Get_DevNode_Registry_PropertyW);
+}
+
+void DetachSetupHooks()
+{
+	DetourDetach(&reinterpret_cast<PVOID&>(g_pfnSetupDiGetClassDevsA), Hooked_SetupDiGetClassDevsA);
+	DetourDetach(&reinterpret_cast<PVOID&>(g_pfnSetupDiGetClassDevsW), Hooked_SetupDiGetClassDevsW);
+	DetourDetach(&reinterpret_cast<PVOID&>(g_pfnSetupDiDestroyDeviceInfoList), Hooked_SetupDiDestroyDeviceInfoList);
+	DetourDetach(&reinterpret_cast<PVOID&>(g_pfnSetupDiGetDeviceRegistryPropertyA), Hooked_SetupDiGetDeviceRegistryPropertyA);
+	DetourDetach(&reinterpret_cast<PVOID&>(g_pfnSetupDiGetDeviceRegistryPropertyW), Hooked_SetupDiGetDeviceRegistryPropertyW);
+	DetourDetach(&reinterpret_cast<PVOID&>(g_pfnCM_Get_DevNode_Registry_PropertyA), Hooked_CM_Get_DevNode_Registry_PropertyA);
+	DetourDetach(&reinterpret_cast<PVOID&>(g_pfnCM_Get_DevNode_Registry_PropertyW), Hooked_CM_Get_DevNode_Registry_PropertyW);
+}
+
+// Time a pass-through enumeration, remembering its cost for RecordSavedCall.
+template <typename Func>
+HRESULT TimedEnumDevices(Func&& func)
+{
+	SetupMemoStats memo_stats;
+	t_pSetupMemoStats = &memo_stats;
+
+	StopWatch timer;
+	auto hr = func();
+	auto elapsed_us = timer.ElapsedUs();
+
+	t_pSetupMemoStats = nullptr;
+	if (g_config.setup_memo)
+		RecordTrace(TraceEvent::SetupMemo, elapsed_us, memo_stats.hits, memo_stats.misses);
+
+	g_last_enum_us.store(elapsed_us, std::memory_order_relaxed);
+	if (g_pStats)
+		g_pStats->enum_devices.Record(elapsed_us);
+
+	g_costEstimate.Record(elapsed_us);
+	RecordTrace(TraceEvent::CostEstimate, g_costEstimate.Estimate(), CurrentPolicy().budget_us);
+
+	return hr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Devices are held in both character forms, so one snapshot can serve callers
+// of either interface type.
+struct DeviceEntry
+{
+	DWORD dwDevType;
+	DIDEVICEINSTANCEA a;
+	DIDEVICEINSTANCEW w;
+};
+
+// Semantic enumeration also reports how well each device fits the action map.
+struct SemanticEntry
+{
+	DWORD dwDevType;
+	DeviceEntry device;
+	DWORD dwFlags;
+};
+
+DeviceCache<DeviceEntry> g_cache;
+DeviceCache<SemanticEntry, std::wstring> g_semanticCache;
+
+void ConvertString(const char* pszFrom, wchar_t (&szTo)[MAX_PATH])
+{
+	MultiByteToWideChar(CP_ACP, 0, pszFrom, -1, szTo, MAX_PATH);
+}
+
+void ConvertString(const wchar_t* pszFrom, char (&szTo)[MAX_PATH])
+{
+	WideCharToMultiByte(CP_ACP, 0, pszFrom, -1, szTo, MAX_PATH, nullptr, nullptr);
+}
+
+template <typename From, typename To>
+void ConvertInstance(const From& from, To& to)
+{
+	to.dwSize = sizeof(to);
+	to.guidInstance = from.guidInstance;
+	to.guidProduct = from.guidProduct;
+	to.dwDevType = from.dwDevType;
+	to.guidFFDriver = from.guidFFDriver;
+	to.wUsagePage = from.wUsagePage;
+	to.wUsage = from.wUsage;
+	ConvertString(from.tszInstanceName, to.tszInstanceName);
+	ConvertString(from.tszProductName, to.tszProductName);
+}
+
+DeviceEntry MakeDeviceEntry(const DIDEVICEINSTANCEA& instance)
+{
+	DeviceEntry entry{ instance.dwDevType, instance };
+	ConvertInstance(instance, entry.w);
+	return entry;
+}
+
+DeviceEntry MakeDeviceEntry(const DIDEVICEINSTANCEW& instance)
+{
+	DeviceEntry entry{ instance.dwDevType };
+	entry.w = instance;
+	ConvertInstance(instance, entry.a);
+	return entry;
+}
+
+// Types and original functions for each of the DirectInput8 interface types.
+template <typename Interface>
+struct DI8Traits;
+
+template <>
+struct DI8Traits<IDirectInput8A>
+{
+	using Char = char;
+	using Instance = DIDEVICEINSTANCEA;
+	using Device = IDirectInputDevice8A;
+	using ActionFormat = DIACTIONFORMATA;
+	using EnumCallback = LPDIENUMDEVICESCALLBACKA;
+	using SemanticsCallback = LPDIENUMDEVICESBYSEMANTICSCBA;
+
+	static inline decltype(IDirectInput8A::lpVtbl->EnumDevices) pfnEnumDevices;
+	static inline decltype(IDirectInput8A::lpVtbl->EnumDevicesBySemantics) pfnEnumDevicesBySemantics;
+	static inline decltype(IDirectInput8A::lpVtbl->CreateDevice) pfnCreateDevice;
+	static inline decltype(IDirectInputDevice8A::lpVtbl->GetDeviceState) pfnGetDeviceState;
+	static inline decltype(IDirectInputDevice8A::lpVtbl->Poll) pfnPoll;
+	static inline decltype(IDirectInputDevice8A::lpVtbl->SetDataFormat) pfnSetDataFormat;
+	static inline decltype(IDirectInputDevice8A::lpVtbl->QueryInterface) pfnQueryInterface;
+	static inline decltype(IDirectInputDevice8A::lpVtbl->AddRef) pfnAddRef;
+	static inline decltype(IDirectInputDevice8A::lpVtbl->Release) pfnRelease;
+	static inline decltype(pfnEnumDevices) pfnHookEnumDevices;
+	static inline decltype(pfnEnumDevicesBySemantics) pfnHookEnumDevicesBySemantics;
+	static inline decltype(pfnCreateDevice) pfnHookCreateDevice;
+	static inline decltype(pfnGetDeviceState) pfnHookGetDeviceState;
+	static inline decltype(pfnPoll) pfnHookPoll;
+	static inline decltype(pfnSetDataFormat) pfnHookSetDataFormat;
+	static inline decltype(pfnQueryInterface) pfnHookQueryInterface;
+	static inline decltype(pfnAddRef) pfnHookAddRef;
+	static inline decltype(pfnRelease) pfnHookRelease;
+	static inline std::atomic<bool> hooked{ false };
+
+	static const IID& Iid() { return IID_IDirectInput8A; }
+	static const Instance& Get(const DeviceEntry& entry) { return entry.a; }
+	static std::wstring Wide(const Char* psz) { wchar_t sz[MAX_PATH]{}; ConvertString(psz, sz); return sz; }
+};
+
+template <>
+struct DI8Traits<IDirectInput8W>
+{
+	using Char = wchar_t;
+	using Instance = DIDEVICEINSTANCEW;
+	using Device = IDirectInputDevice8W;
+	using ActionFormat = DIACTIONFORMATW;
+	using EnumCallback = LPDIENUMDEVICESCALLBACKW;
+	using SemanticsCallback = LPDIENUMDEVICESBYSEMANTICSCBW;
+
+	static inline decltype(IDirectInput8W::lpVtbl->EnumDevices) pfnEnumDevices;
+	static inline decltype(IDirectInput8W::lpVtbl->EnumDevicesBySemantics) pfnEnumDevicesBySemantics;
+	static inline decltype(IDirectInput8W::lpVtbl->CreateDevice) pfnCreateDevice;
+	static inline decltype(IDirectInputDevice8W::lpVtbl->GetDeviceState) pfnGetDeviceState;
+	static inline decltype(IDirectInputDevice8W::lpVtbl->Poll) pfnPoll;
+	static inline decltype(IDirectInputDevice8W::lpVtbl->SetDataFormat) pfnSetDataFormat;
+	static inline decltype(IDirectInputDevice8W::lpVtbl->QueryInterface) pfnQueryInterface;
+	static inline decltype(IDirectInputDevice8W::lpVtbl->AddRef) pfnAddRef;
+	static inline decltype(IDirectInputDevice8W::lpVtbl->Release) pfnRelease;
+	static inline decltype(pfnEnumDevices) pfnHookEnumDevices;
+	static inline decltype(pfnEnumDevicesBySemantics) pfnHookEnumDevicesBySemantics;
+	static inline decltype(pfnCreateDevice) pfnHookCreateDevice;
+	static inline decltype(pfnGetDeviceState) pfnHookGetDeviceState;
+	static inline decltype(pfnPoll) pfnHookPoll;
+	static inline decltype(pfnSetDataFormat) pfnHookSetDataFormat;
+	static inline decltype(pfnQueryInterface) pfnHookQueryInterface;
+	static inline decltype(pfnAddRef) pfnHookAddRef;
+	static inline decltype(pfnRelease) pfnHookRelease;
+	static inline std::atomic<bool> hooked{ false };
+
+	static const IID& Iid() { return IID_IDirectInput8W; }
+	static const Instance& Get(const DeviceEntry& entry) { return entry.w; }
+	static std::wstring Wide(const Char* psz) { return psz; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Log when adaptive mode switches between passing calls through and caching.
+void ReportAdaptiveSwitch(const ShimPolicy& policy, uint32_t cost_us)
+{
+	auto within_budget = IsWithinBudget(policy, cost_us);
+	if (g_withinBudget.exchange(within_budget) != within_budget)
+	{
+		char szMsg[128]{};
+		sprintf_s(szMsg, "%s: adaptive estimate %.1fms vs %.1fms budget, now %s\n",
+			APP_NAME, cost_us / 1000.0, policy.budget_us / 1000.0, within_budget ? "passing through" : "caching");
+		OutputDebugString(szMsg);
+	}
+}
+
+// Track the calling thread's timing, logging when it's first seen to poll.
+bool DetectPoller()
+{
+	auto was_poller = t_poll.IsPoller();
+	t_poll.Call(QpcMicroseconds());
+	auto is_poller = t_poll.IsPoller();
+
+	if (is_poller && !was_poller)
+	{
+		char szMsg[128]{};
+		sprintf_s(szMsg, "%s: thread %lu polls every %.1fs (jitter %.0fms)\n", APP_NAME,
+			GetCurrentThreadId(), t_poll.PeriodUs() / 1e6, t_poll.JitterUs() / 1e3);
+		OutputDebugString(szMsg);
+	}
+
+	return is_poller;
+}
+
+template <typename Throttle>
+Decision DecideCall(const ShimPolicy& policy, bool have_snapshot)
+{
+	CallState state{ have_snapshot, g_costEstimate.Estimate(), DetectPoller() };
+	if (policy.mode == ShimMode::Adaptive)
+		ReportAdaptiveSwitch(policy, state.cost_us);
+
+	return DecideEnumDevices(policy, state, [&] {
+		auto limits = g_config.limits;
+		limits.max_calls = policy.max_calls;
+		return Throttle::Allow(g_callCounter.Sync(t_calls), limits, QpcMicroseconds);
+	});
+}
+
+template <typename Interface>
+BOOL CALLBACK SnapshotCallback(const typename DI8Traits<Interface>::Instance* lpddi, LPVOID pvRef)
+{
+	reinterpret_cast<DeviceSnapshot<DeviceEntry>*>(pvRef)->Add(MakeDeviceEntry(*lpddi));
+	return DIENUM_CONTINUE;
+}
+
+// Enumerate all devices for the snapshot flags, then index the attached and
+// force feedback capabilities so any query using those flags can be answered.
+template <typename Interface>
+HRESULT CaptureSnapshot(Interface* pDI8, DWORD dwFlags, DeviceSnapshot<DeviceEntry>& snapshot)
+{
+	using Traits = DI8Traits<Interface>;
+
+	return TimedEnumDevices([&] {
+		auto hr = Traits::pfnEnumDevices(pDI8, DI8DEVCLASS_ALL, SnapshotCallback<Interface>, &snapshot, dwFlags);
+
+		if (SUCCEEDED(hr))
+		{
+			snapshot.UpdateCaps([&](const DeviceEntry& entry) {
+				uint32_t caps{};
+				if (pDI8->lpVtbl->GetDeviceStatus(pDI8, entry.a.guidInstance) == DI_OK)
+					caps |= EDFL_ATTACHEDONLY;
+				if (entry.a.guidFFDriver != GUID_NULL)
+					caps |= EDFL_FORCEFEEDBACK;
+				return caps;
+			});
+		}
+
+		return hr;
+	});
+}
+
+template <typename Interface, typename Throttle>
+HRESULT __stdcall Hooked_EnumDevices(
+	Interface* pThis,
+	DWORD dwDevType,
+	typename DI8Traits<Interface>::EnumCallback lpCallback,
+	LPVOID pvRef,
+	DWORD dwFlags)
+{
+	using Traits = DI8Traits<Interface>;
+
+	StopWatch timer;
+	auto policy = CurrentPolicy();
+
+	// Snapshots may be slightly stale while a background refresh is in progress.
+	auto snapshot_flags = SnapshotFlags(dwFlags);
+	auto reader = g_cache.Read();
+	auto snapshot = UsesSnapshots(policy.mode) ? reader.Find(snapshot_flags) : nullptr;
+	auto decision = DecideCall<Throttle>(policy, snapshot != nullptr);
+
+	auto forward = [&](const DeviceEntry& entry) {
+		return lpCallback(&Traits::Get(entry), pvRef) != DIENUM_STOP;
+	};
+
+	HRESULT hr{ DI_OK };
+
+	switch (decision)
+	{
+	case Decision::Replay:
+		// No lock is held, in case the game calls back into DirectInput.
+		snapshot->Replay(dwDevType, dwFlags, forward);
+
+		if (g_prewarm_us.load(std::memory_order_relaxed))
+			ReportPreWarmHit();
+
+		RecordSavedCall();
+		break;
+
+	case Decision::Fail:
+		// Fail the call, causing the game to skip any post-processing.
+		RecordSavedCall();
+		hr = DIERR_GENERIC;
+		break;
+
+	case Decision::PassThrough:
+		hr = TimedEnumDevices([&] {
+			return Traits::pfnEnumDevices(pThis, dwDevType, lpCallback, pvRef, dwFlags);
+		});
+		break;
+
+	case Decision::Capture:
+	{
+#ifdef _DEBUG
+		// In debug, play the bell sound every time a snapshot is captured.
+		MessageBeep(static_cast<UINT>(-1));
+#endif
+
+		// The full enumeration is indexed first, then filtered for the caller.
+		DeviceSnapshot<DeviceEntry> captured;
+		hr = CaptureSnapshot(pThis, snapshot_flags, captured);
+
+		if (SUCCEEDED(hr))
+		{
+			captured.Replay(dwDevType, dwFlags, forward);
+			g_cache.Store(snapshot_flags, std::move(captured));
+			SetEvent(g_hSaveEvent);
+		}
+		break;
+	}
+	}
+
+	RecordTrace(TraceEvent::EnumDevices, timer.ElapsedUs(), dwDevType, dwFlags, hr, decision, policy.mode);
+	return hr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Semantic results depend on the user and every action in the action map, as
+// well as the flags.
+template <typename Interface>
+std::wstring SemanticKey(
+	const typename DI8Traits<Interface>::Char* ptszUserName,
+	const typename DI8Traits<Interface>::ActionFormat* lpdiActionFormat,
+	DWORD dwFlags)
+{
+	wchar_t szGuid[40]{};
+	StringFromGUID2(lpdiActionFormat->guidActionMap, szGuid, _countof(szGuid));
+
+	auto key = std::wstring(szGuid);
+	key += L'|' + std::to_wstring(lpdiActionFormat->dwGenre);
+	key += L'|' + std::to_wstring(lpdiActionFormat->dwNumActions);
+	key += L'|' + std::to_wstring(dwFlags);
+	key += L'|' + (ptszUserName ? DI8Traits<Interface>::Wide(ptszUserName) : std::wstring());
+	AppendSemanticActions(key, lpdiActionFormat->rgoAction, lpdiActionFormat->dwNumActions);
+	return key;
+}
+
+template <typename Interface>
+struct SemanticCaptureContext
+{
+	typename DI8Traits<Interface>::SemanticsCallback lpCallback;
+	LPVOID pvRef;
+	bool stopped;
+	DeviceSnapshot<SemanticEntry> snapshot;
+};
+
+template <typename Interface>
+BOOL CALLBACK SemanticCaptureCallback(
+	const typename DI8Traits<Interface>::Instance* lpddi,
+	typename DI8Traits<Interface>::Device* lpdid,
+	DWORD dwFlags,
+	DWORD dwRemaining,
+	LPVOID pvRef)
+{
+	auto& ctx = *reinterpret_cast<SemanticCaptureContext<Interface>*>(pvRef);
+	ctx.snapshot.Add(SemanticEntry{ lpddi->dwDevType, MakeDeviceEntry(*lpddi), dwFlags });
+
+	if (!ctx.stopped)
+		ctx.stopped = ctx.lpCallback(lpddi, lpdid, dwFlags, dwRemaining, ctx.pvRef) == DIENUM_STOP;
+
+	return DIENUM_CONTINUE;
+}
+
+template <typename Interface, typename Throttle>
+HRESULT __stdcall Hooked_EnumDevicesBySemantics(
+	Interface* pThis,
+	const typename DI8Traits<Interface>::Char* ptszUserName,
+	typename DI8Traits<Interface>::ActionFormat* lpdiActionFormat,
+	typename DI8Traits<Interface>::SemanticsCallback lpCallback,
+	LPVOID pvRef,
+	DWORD dwFlags)
+{
+	using Traits = DI8Traits<Interface>;
+
+	if (!lpdiActionFormat || !lpCallback)
+		return Traits::pfnEnumDevicesBySemantics(pThis, ptszUserName, lpdiActionFormat, lpCallback, pvRef, dwFlags);
+
+	StopWatch timer;
+	auto policy = CurrentPolicy();
+	auto key = SemanticKey<Interface>(ptszUserName, lpdiActionFormat, dwFlags);
+
+	auto reader = g_semanticCache.Read();
+	auto snapshot = UsesSnapshots(policy.mode) ? reader.Find(key) : nullptr;
+	auto decision = DecideCall<Throttle>(policy, snapshot != nullptr);
+
+	HRESULT hr{ DI_OK };
+
+	switch (decision)
+	{
+	case Decision::Replay:
+	{
+		// The callback expects a device object for each device, as DirectInput
+		// creates them, which the caller must AddRef if it wants to keep it.
+		auto& devices = snapshot->Devices();
+		for (size_t i = 0; i < devices.size(); ++i)
+		{
+			auto& instance = Traits::Get(devices[i].device);
+			typename Traits::Device* pDevice{};
+
+			if (FAILED(pThis->lpVtbl->CreateDevice(pThis, instance.guidInstance, &pDevice, nullptr)))
+				continue;
+
+			auto dwRemaining = static_cast<DWORD>(devices.size() - i - 1);
+			auto ret = lpCallback(&instance, pDevice, devices[i].dwFlags, dwRemaining, pvRef);
+			pDevice->lpVtbl->Release(pDevice);
+
+			if (ret == DIENUM_STOP)
+				break;
+		}
+
+		RecordSavedCall();
+		break;
+	}
+
+	case Decision::Fail:
+		RecordSavedCall();
+		hr = DIERR_GENERIC;
+		break;
+
+	case Decision::PassThrough:
+		hr = TimedEnumDevices([&] {
+			return Traits::pfnEnumDevicesBySemantics(pThis, ptszUserName, lpdiActionFormat, lpCallback, pvRef, dwFlags);
+		});
+		break;
+
+	case Decision::Capture:
+	{
+		SemanticCaptureContext<Interface> ctx{ lpCallback, pvRef };
+		hr = TimedEnumDevices([&] {
+			return Traits::pfnEnumDevicesBySemantics(
+				pThis, ptszUserName, lpdiActionFormat, SemanticCaptureCallback<Interface>, &ctx, dwFlags);
+		});
+
+		if (SUCCEEDED(hr))
+			g_semanticCache.Store(key, std::move(ctx.snapshot));
+		break;
+	}
+	}
+
+	RecordTrace(TraceEvent::EnumDevicesBySemantics, timer.ElapsedUs(),
+		lpdiActionFormat->dwGenre, dwFlags, hr, decision, policy.mode);
+	return hr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool GetHidInterfacePaths(std::vector<std::string>& paths)
+{
+	auto pGuid = const_cast<GUID*>(&GUID_DEVINTERFACE_HID);
+	std::vector<char> list;
+	CONFIGRET cr;
+
+	do
+	{
+		ULONG ulLen{};
+		if (CM_Get_Device_Interface_List_Size(&ulLen, pGuid, nullptr, CM_GET_DEVICE_INTERFACE_LIST_PRESENT) != CR_SUCCESS)
+			return false;
+
+		list.resize(ulLen);
+		cr = CM_Get_Device_Interface_List(pGuid, nullptr, list.data(), ulLen, CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+	} while (cr == CR_BUFFER_SMALL);	// a device arrived between the calls
+
+	if (cr != CR_SUCCESS)
+		return false;
+
+	for (auto psz = list.data(); *psz; psz += strlen(psz) + 1)
+		paths.push_back(psz);
+
+	return true;
+}
+
+// Hash of the HID interfaces present, which identifies the device set that a
+// saved cache belongs to. This is much cheaper than a DirectInput enumeration.
+uint64_t HidInterfaceHash()
+{
+	std::vector<std::string> paths;
+	return GetHidInterfacePaths(paths) ? HashDevicePaths(std::move(paths)) : 0;
+}
+
+// Seed the cache from the last session, if the same HID devices are present.
+bool LoadDiskCache()
+{
+	std::ifstream file(ShimFilePath(DISK_CACHE_FILE), std::ifstream::in | std::ifstream::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	SnapshotMap<DeviceEntry> snapshots;
+	auto device_hash = HidInterfaceHash();
+	if (!device_hash || !ParseDiskCache(data, device_hash, snapshots))
+		return false;
+
+	g_cache.Replace(std::move(snapshots));
+	OutputDebugString("DirtFix: device snapshots loaded from disk cache\n");
+	return true;
+}
+
+// Write the current snapshots via a temporary file, so a game exiting part
+// way through can't leave a damaged cache. Failures are ignored, as the game
+// directory may not be writable.
+void SaveDiskCache()
+{
+	auto device_hash = HidInterfaceHash();
+	if (!device_hash)
+		return;
+
+	auto reader = g_cache.Read();
+	auto data = SerializeDiskCache(device_hash, reader.Snapshots());
+
+	auto path = ShimFilePath(DISK_CACHE_FILE);
+	auto temp_path = fs::path(path).replace_extension(".tmp");
+
+	{
+		std::ofstream file(temp_path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+		if (!file.write(reinterpret_cast<const char*>(data.data()), data.size()))
+			return;
+	}
+
+	MoveFileEx(temp_path.string().c_str(), path.string().c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+// Re-capture every snapshot in the cache, publishing them together when done.
+// Any stored by game threads in the meantime are kept.
+template <typename Interface>
+bool RefreshCache(Interface*& pDI8)
+{
+	using Traits = DI8Traits<Interface>;
+
+	// Use our own interface, calling the original enumeration function.
+	if (!pDI8 && FAILED(g_pfnDirectInput8Create(GetModuleHandle(NULL),
+			DIRECTINPUT_VERSION, Traits::Iid(), reinterpret_cast<LPVOID*>(&pDI8), nullptr)))
+	{
+		return false;
+	}
+
+	auto sampled = g_cache.Sample();
+	SnapshotMap<DeviceEntry> snapshots;
+
+	for (auto& entry : sampled)
+	{
+		DeviceSnapshot<DeviceEntry> snapshot;
+		if (SUCCEEDED(CaptureSnapshot(pDI8, entry.first, snapshot)))
+			snapshots[entry.first] = std::make_shared<const DeviceSnapshot<DeviceEntry>>(std::move(snapshot));
+	}
+
+	g_cache.Refresh(sampled, std::move(snapshots));
+	return true;
+}
+
+// Background thread to perform the expensive enumerations after a HID change,
+// so game threads never wait for them. Changes made during a refresh leave
+// the event signalled, so a burst of them is covered by at most one more pass.
+// This also validates snapshots loaded from disk, and saves new ones.
+void RefreshThread()
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+
+	IDirectInput8A* pDI8A{};
+	IDirectInput8W* pDI8W{};
+	HANDLE ahEvents[]{ g_hRefreshEvent, g_hSaveEvent };
+
+	for (;;)
+	{
+		if (WaitForMultipleObjects(_countof(ahEvents), ahEvents, FALSE, INFINITE) != WAIT_OBJECT_0)
+		{
+			SaveDiskCache();
+			continue;
+		}
+
+		// Semantic results depend on the caller's action map, which we can't
+		// safely keep, so they're recaptured on the next call instead.
+		g_semanticCache.Clear();
+
+		auto refreshed = DI8Traits<IDirectInput8W>::hooked ?
+			RefreshCache(pDI8W) : RefreshCache(pDI8A);
+
+		if (!refreshed)
+			g_cache.Clear();
+
+		SaveDiskCache();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Time message dispatch on game threads, which includes any wait for the
+// DINPUT8 lock taken by its window procedure hook. The shim's own threads
+// pump messages too, but aren't part of the game's message loop.
+template <typename Func>
+LRESULT TimedDispatch(Func&& func)
+{
+	auto thread_id = GetCurrentThreadId();
+	if (!g_pStats || thread_id == g_dwNotifyThreadId || thread_id == g_dwRawInputThreadId)
+		return func();
+
+	StopWatch timer;
+	auto lResult = func();
+	g_pStats->msg_dispatch.Record(timer.ElapsedUs());
+
+	return lResult;
+}
+
+LRESULT WINAPI Hooked_DispatchMessageA(const MSG* lpMsg)
+{
+	return TimedDispatch([&] { return g_pfnDispatchMessageA(lpMsg); });
+}
+
+LRESULT WINAPI Hooked_DispatchMessageW(const MSG* lpMsg)
+{
+	return TimedDispatch([&] { return g_pfnDispatchMessageW(lpMsg); });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+auto TickTime()
+{
+	return std::chrono::milliseconds(GetTickCount64());
+}
+
+// State owned by the notification thread.
+struct NotifyState
+{
+	Debouncer debouncer{ NOTIFY_QUIET_TIME, NOTIFY_MAX_DELAY };
+	std::map<std::string, HidDeviceInfo> devices;	// keyed by lower-case path
+};
+
+std::string HidPathKey(std::string path)
+{
+	std::transform(path.begin(), path.end(), path.begin(),
+		[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return path;
+}
+
+// Identify a HID interface from its path, and from its top-level collection
+// usage if it's present. No access rights are needed to read the usage.
+HidDeviceInfo QueryHidDevice(const std::string& path)
+{
+	auto info = ParseHidInterfacePath(path);
+
+	auto hDevice = CreateFile(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hDevice != INVALID_HANDLE_VALUE)
+	{
+		PHIDP_PREPARSED_DATA pPreparsed{};
+		if (HidD_GetPreparsedData(hDevice, &pPreparsed))
+		{
+			HIDP_CAPS caps{};
+			if (HidP_GetCaps(pPreparsed, &caps) == HIDP_STATUS_SUCCESS)
+			{
+				info.usage_page = caps.UsagePage;
+				info.usage = caps.Usage;
+				info.has_usage = true;
+			}
+
+			HidD_FreePreparsedData(pPreparsed);
+		}
+
+		CloseHandle(hDevice);
+	}
+
+	return info;
+}
+
+LRESULT CALLBACK HidNotifySubclassProc(
+	HWND hWnd,
+	UINT uMsg,
+	WPARAM wParam,
+	LPARAM lParam,
+	UINT_PTR /*uIdSubclass*/,
+	DWORD_PTR dwRefData)
+{
+	auto p = reinterpret_cast<PDEV_BROADCAST_DEVICEINTERFACE>(lParam);
+
+	if (uMsg == WM_DEVICECHANGE &&
+		(wParam == DBT_DEVICEARRIVAL || wParam == DBT_DEVICEREMOVECOMPLETE) &&
+		p->dbcc_devicetype == DBT_DEVTYP_DEVICEINTERFACE &&
+		p->dbcc_classguid == GUID_DEVINTERFACE_HID)
+	{
+		// Device nodes may have changed, whether or not the snapshots care.
+		if (g_config.setup_memo)
+			InvalidateSetupMemo();
+
+		auto& state = *reinterpret_cast<NotifyState*>(dwRefData);
+		std::string path(p->dbcc_name);
+		auto key = HidPathKey(path);
+		HidDeviceInfo info;
+
+		// Pooled devices are only released once their hardware is gone.
+		if (g_config.device_pool && wParam == DBT_DEVICEREMOVECOMPLETE)
+			g_devicePool.Remove(key);
+
+		// Removed devices can't be queried, so use what we saw on arrival.
+		if (wParam == DBT_DEVICEARRIVAL)
+			info = state.devices[key] = QueryHidDevice(path);
+		else if (auto it = state.devices.find(key); it != state.devices.end())
+		{
+			info = it->second;
+			state.devices.erase(it);
+		}
+		else
+			info = ParseHidInterfacePath(path);
+
+		auto invalidate = ShouldInvalidate(g_config.hid_filter, info);
+		if (invalidate)
+			state.debouncer.Event(TickTime());
+
+		RecordTrace(TraceEvent::HidChange, 0, (static_cast<uint32_t>(info.vid) << 16) | info.pid,
+			static_cast<uint32_t>(wParam), invalidate ? S_OK : S_FALSE);
+	}
+
+	return DefSubclassProc(hWnd, uMsg, wParam, lParam);
+}
+
+// Thread owning a message-only window to receive HID change notifications,
+// as the game thread that created DirectInput may not pump messages.
+void NotifyThread()
+{
+	NotifyState state;
+	auto& debouncer = state.debouncer;
+	g_dwNotifyThreadId = GetCurrentThreadId();
+
+	// Identify the devices already present, for when they're removed.
+	std::vector<std::string> paths;
+	if (GetHidInterfacePaths(paths))
+	{
+		for (auto& path : paths)
+			state.devices[HidPathKey(path)] = QueryHidDevice(path);
+	}
+
+	g_hwndNotify = CreateWindow("static", "", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, GetModuleHandle(NULL), 0L);
+	SetWindowSubclass(g_hwndNotify, HidNotifySubclassProc, 0, reinterpret_cast<DWORD_PTR>(&state));
+
+	DEV_BROADCAST_DEVICEINTERFACE dbdi{};
+	dbdi.dbcc_size = sizeof(dbdi);
+	dbdi.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+	dbdi.dbcc_classguid = GUID_DEVINTERFACE_HID;
+	RegisterDeviceNotification(g_hwndNotify, &dbdi, DEVICE_NOTIFY_WINDOW_HANDLE);
+
+	for (;;)
+	{
+		auto timeout = debouncer.Timeout(TickTime());
+		auto dwTimeout = timeout ? static_cast<DWORD>(timeout->count()) : INFINITE;
+
+		if (MsgWaitForMultipleObjects(0, nullptr, FALSE, dwTimeout, QS_ALLINPUT) == WAIT_OBJECT_0)
+		{
+			MSG msg;
+			while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+				DispatchMessage(&msg);
+		}
+
+		// Invalidate once for each burst of changes.
+		if (debouncer.Poll(TickTime()))
+		{
+			g_callCounter.Reset();
+			SetEvent(g_hRefreshEvent);
+			RecordTrace(TraceEvent::Invalidate, static_cast<uint32_t>(debouncer.Latency().count() * 1000));
+
+			char szMsg[128]{};
+			sprintf_s(szMsg, "%s: HID change invalidated after %lldms (%d events merged)\n",
+				APP_NAME, static_cast<long long>(debouncer.Latency().count()), debouncer.Merged());
+			OutputDebugString(szMsg);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Joystick state from Raw Input, shared by the DirectInput devices for the
+// same HID interface.
+struct RawFeed
+{
+	Seqlock<HidJoyState> state;
+};
+
+// Raw Input feed for a DirectInput device, and what we know of its setup.
+struct DeviceFeed
+{
+	std::shared_ptr<RawFeed> raw;		// null for devices we can't feed
+	Seqlock<AxisRanges> ranges;
+	std::mutex ranges_mutex;			// for writers
+	std::atomic<uint64_t> next_verify_us{ 0 };
+	std::atomic<bool> verified{ false };
+	std::atomic<bool> disabled{ false };
+	std::atomic<uint32_t> mismatches{ 0 };
+	std::atomic<HRESULT> poll_hr{ DI_NOEFFECT };
+	std::atomic<DWORD> format_size{ 0 };	// of the joystick data format set, or 0 for any other
+};
+
+std::mutex g_rawFeedMutex;
+std::map<std::string, std::shared_ptr<RawFeed>> g_rawFeeds;		// keyed by lower-case path
+std::shared_mutex g_deviceFeedMutex;
+std::map<const void*, std::shared_ptr<DeviceFeed>> g_deviceFeeds;
+std::vector<PVOID> g_deviceHookTargets;		// under g_hookMutex
+std::atomic<HWND> g_hwndRawInput;				// set while it receives the controller usages
+
+constexpr USHORT RAW_INPUT_USAGES[]{ HID_USAGE_JOYSTICK, HID_USAGE_GAMEPAD, HID_USAGE_MULTI_AXIS };
+
+static_assert(sizeof(DIJOYSTATE) == 80 && offsetof(DIJOYSTATE, rgbButtons) == offsetof(JoyState, buttons) &&
+	offsetof(DIJOYSTATE2, rgbButtons) == offsetof(JoyState, buttons) &&
+	offsetof(DIJOYSTATE2, lVX) == sizeof(JoyState), "JoyState must match the DirectInput layouts");
+
+std::shared_ptr<RawFeed> GetRawFeed(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(g_rawFeedMutex);
+
+	auto& feed = g_rawFeeds[key];
+	if (!feed)
+		feed = std::make_shared<RawFeed>();
+
+	return feed;
+}
+
+// Per-device parsing state owned by the Raw Input thread.
+struct RawDevice
+{
+	std::shared_ptr<RawFeed> feed;
+	std::vector<BYTE> preparsed;
+	std::vector<HIDP_VALUE_CAPS> value_caps;
+	HidJoyState state;
+};
+
+struct RawInputState
+{
+	std::map<HANDLE, RawDevice> devices;
+	std::vector<BYTE> buffer;
+};
+
+bool OpenRawDevice(HANDLE hDevice, RawDevice& device)
+{
+	UINT cch{};
+	GetRawInputDeviceInfo(hDevice, RIDI_DEVICENAME, nullptr, &cch);
+	std::string name(cch, '\0');
+	if (!cch || GetRawInputDeviceInfo(hDevice, RIDI_DEVICENAME, name.data(), &cch) == static_cast<UINT>(-1))
+		return false;
+
+	// Match the form of the paths DirectInput reports.
+	name.resize(strlen(name.c_str()));
+	if (name.compare(0, 4, R"(\??\)") == 0)
+		name[1] = '\\';
+
+	UINT cb{};
+	GetRawInputDeviceInfo(hDevice, RIDI_PREPARSEDDATA, nullptr, &cb);
+	device.preparsed.resize(cb);
+	if (!cb || GetRawInputDeviceInfo(hDevice, RIDI_PREPARSEDDATA, device.preparsed.data(), &cb) == static_cast<UINT>(-1))
+		return false;
+
+	auto pPreparsed = reinterpret_cast<PHIDP_PREPARSED_DATA>(device.preparsed.data());
+	HIDP_CAPS caps{};
+	if (HidP_GetCaps(pPreparsed, &caps) != HIDP_STATUS_SUCCESS)
+		return false;
+
+	auto num_values = caps.NumberInputValueCaps;
+	device.value_caps.resize(num_values);
+	if (num_values && HidP_GetValueCaps(HidP_Input, device.value_caps.data(), &num_values, pPreparsed) != HIDP_STATUS_SUCCESS)
+		return false;
+
+	device.value_caps.resize(num_values);
+	device.feed = GetRawFeed(HidPathKey(name));
+	return true;
+}
+
+// Extract the values and buttons from one input report, for the portable parser.
+void ParseRawReport(RawDevice& device, BYTE* pReport, ULONG cbReport)
+{
+	auto pPreparsed = reinterpret_cast<PHIDP_PREPARSED_DATA>(device.preparsed.data());
+	auto pReportChars = reinterpret_cast<PCHAR>(pReport);
+	std::vector<HidValue> values;
+
+	for (auto& caps : device.value_caps)
+	{
+		uint32_t first = caps.IsRange ? caps.Range.UsageMin : caps.NotRange.Usage;
+		uint32_t last = caps.IsRange ? caps.Range.UsageMax : caps.NotRange.Usage;
+
+		for (auto usage = first; usage <= last; ++usage)
+		{
+			// Values in other reports aren't present in this one.
+			ULONG value{};
+			if (HidP_GetUsageValue(HidP_Input, caps.UsagePage, caps.LinkCollection, static_cast<USAGE>(usage),
+					&value, pPreparsed, pReportChars, cbReport) != HIDP_STATUS_SUCCESS)
+			{
+				continue;
+			}
+
+			auto signed_value = static_cast<int32_t>(value);
+			if (caps.LogicalMin < 0 && caps.BitSize && caps.BitSize < 32 && (value & (1ul << (caps.BitSize - 1))))
+				signed_value = static_cast<int32_t>(value | ~((1ul << caps.BitSize) - 1));
+
+			values.push_back(HidValue{ caps.UsagePage, static_cast<uint16_t>(usage),
+				signed_value, caps.LogicalMin, caps.LogicalMax });
+		}
+	}
+
+	USAGE usages[JOY_BUTTONS]{};
+	ULONG num_usages{ JOY_BUTTONS };
+	auto has_buttons = HidP_GetUsages(HidP_Input, HID_PAGE_BUTTON, 0, usages, &num_usages,
+		pPreparsed, pReportChars, cbReport) == HIDP_STATUS_SUCCESS;
+
+	std::vector<uint16_t> buttons(usages, usages + (has_buttons ? num_usages : 0));
+	ApplyHidReport(device.state, values, has_buttons, buttons);
+	device.feed->state.Write(device.state);
+}
+
+LRESULT CALLBACK RawInputSubclassProc(
+	HWND hWnd,
+	UINT uMsg,
+	WPARAM wParam,
+	LPARAM lParam,
+	UINT_PTR /*uIdSubclass*/,
+	DWORD_PTR dwRefData)
+{
+	auto& state = *reinterpret_cast<RawInputState*>(dwRefData);
+
+	if (uMsg == WM_INPUT)
+	{
+		auto hRawInput = reinterpret_cast<HRAWINPUT>(lParam);
+		UINT cb{};
+		GetRawInputData(hRawInput, RID_INPUT, nullptr, &cb, sizeof(RAWINPUTHEADER));
+		state.buffer.resize(cb);
+
+		auto pRaw = reinterpret_cast<RAWINPUT*>(state.buffer.data());
+		if (cb && GetRawInputData(hRawInput, RID_INPUT, pRaw, &cb, sizeof(RAWINPUTHEADER)) == cb &&
+			pRaw->header.dwType == RIM_TYPEHID)
+		{
+			auto it = state.devices.find(pRaw->header.hDevice);
+			if (it == state.devices.end())
+			{
+				// Devices we can't parse are remembered without a feed.
+				RawDevice device;
+				if (!OpenRawDevice(pRaw->header.hDevice, device))
+					device.feed.reset();
+
+				it = state.devices.emplace(pRaw->header.hDevice, std::move(device)).first;
+			}
+
+			auto& hid = pRaw->data.hid;
+			for (DWORD i = 0; it->second.feed && i < hid.dwCount; ++i)
+				ParseRawReport(it->second, hid.bRawData + i * hid.dwSizeHid, hid.dwSizeHid);
+		}
+	}
+	else if (uMsg == WM_INPUT_DEVICE_CHANGE && wParam == GIDC_REMOVAL)
+	{
+		// Leave it to DirectInput to report the device is gone.
+		if (auto it = state.devices.find(reinterpret_cast<HANDLE>(lParam)); it != state.devices.end())
+		{
+			if (it->second.feed)
+			{
+				it->second.state.removed = true;
+				it->second.feed->state.Write(it->second.state);
+			}
+
+			state.devices.erase(it);
+		}
+	}
+
+	return DefSubclassProc(hWnd, uMsg, wParam, lParam);
+}
+
+// Count the controller usages registered for Raw Input in this process, and
+// those whose reports go to a window other than ours. Registrations are per
+// process, so registering a usage takes it from any window that had it.
+bool GetRawInputOwners(HWND hwnd, size_t& ours, size_t& others)
+{
+	UINT num_devices{};
+	GetRegisteredRawInputDevices(nullptr, &num_devices, sizeof(RAWINPUTDEVICE));
+
+	std::vector<RAWINPUTDEVICE> devices(num_devices);
+	if (num_devices &&
+		GetRegisteredRawInputDevices(devices.data(), &num_devices, sizeof(RAWINPUTDEVICE)) == static_cast<UINT>(-1))
+	{
+		return false;
+	}
+
+	ours = others = 0;
+	for (UINT i = 0; i < num_devices; ++i)
+	{
+		auto& device = devices[i];
+		if (device.usUsagePage != HID_PAGE_GENERIC_DESKTOP ||
+			std::find(std::begin(RAW_INPUT_USAGES), std::end(RAW_INPUT_USAGES), device.usUsage) == std::end(RAW_INPUT_USAGES))
+		{
+			continue;
+		}
 
-std::mutex g_mutex;
-std::map<DWORD, int> g_mEnumCalls;
-HWND g_hwndNotify;
+		if (hwnd && device.hwndTarget == hwnd)
+			++ours;
+		else
+			++others;
+	}
 
-///////////////////////////////////////////////////////////////////////////////
+	return true;
+}
 
-HRESULT __stdcall Hooked_EnumDevices(
-	IDirectInput8* pThis,
-	DWORD dwDevType,
-	LPDIENUMDEVICESCALLBACK lpCallback,
-	LPVOID pvRef,
-	DWORD dwFlags)
+// Check we still receive the controller reports, as the game may register for
+// them after us. If it has, the feed is stale, and left to the game for good.
+bool IsRawInputOwned()
+{
+	auto hwnd = g_hwndRawInput.load();
+	size_t ours{}, others{};
+	if (!hwnd)
+		return false;
+	else if (GetRawInputOwners(hwnd, ours, others) && ours == std::size(RAW_INPUT_USAGES))
+		return true;
+
+	if (g_hwndRawInput.exchange(nullptr))
+		OutputDebugString("DirtFix: game registered for controller raw input, passing device state through\n");
+
+	return false;
+}
+
+// Thread owning a message-only window to receive input reports from game
+// controllers, independently of DirectInput. If the game reads any of them
+// through Raw Input itself, it keeps them, and DirectInput is left to serve.
+void RawInputThread()
+{
+	RawInputState state;
+	g_dwRawInputThreadId = GetCurrentThreadId();
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
+
+	size_t ours{}, others{};
+	if (!GetRawInputOwners(NULL, ours, others) || others)
+	{
+		OutputDebugString("DirtFix: game uses controller raw input, passing device state through\n");
+		return;
+	}
+
+	auto hwnd = CreateWindow("static", "", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, GetModuleHandle(NULL), 0L);
+	SetWindowSubclass(hwnd, RawInputSubclassProc, 0, reinterpret_cast<DWORD_PTR>(&state));
+
+	RAWINPUTDEVICE rid[std::size(RAW_INPUT_USAGES)]{};
+	for (size_t i = 0; i < _countof(rid); ++i)
+		rid[i] = RAWINPUTDEVICE{ HID_PAGE_GENERIC_DESKTOP, RAW_INPUT_USAGES[i], RIDEV_INPUTSINK | RIDEV_DEVNOTIFY, hwnd };
+
+	if (!RegisterRawInputDevices(rid, _countof(rid), sizeof(RAWINPUTDEVICE)))
+	{
+		OutputDebugString("DirtFix: failed to register for raw input, passing device state through\n");
+		return;
+	}
+
+	g_hwndRawInput = hwnd;
+
+	MSG msg;
+	while (GetMessage(&msg, NULL, 0, 0) > 0)
+		DispatchMessage(&msg);
+}
+
+// Read the ranges the game has set for each joystick axis.
+template <typename Device>
+AxisRanges ReadAxisRanges(Device* pDevice)
+{
+	constexpr DWORD offsets[JOY_AXES]{ DIJOFS_X, DIJOFS_Y, DIJOFS_Z, DIJOFS_RX, DIJOFS_RY, DIJOFS_RZ,
+		DIJOFS_SLIDER(0), DIJOFS_SLIDER(1) };
+	AxisRanges ranges;
+
+	for (size_t i = 0; i < JOY_AXES; ++i)
+	{
+		DIPROPRANGE dipr{};
+		dipr.diph.dwSize = sizeof(dipr);
+		dipr.diph.dwHeaderSize = sizeof(dipr.diph);
+		dipr.diph.dwObj = offsets[i];
+		dipr.diph.dwHow = DIPH_BYOFFSET;
+
+		if (SUCCEEDED(pDevice->lpVtbl->GetProperty(pDevice, DIPROP_RANGE, &dipr.diph)))
+			ranges.axes[i] = AxisRange{ dipr.lMin, dipr.lMax };
+	}
+
+	return ranges;
+}
+
+// Find the lower-case HID interface path of a device, or empty if it has none.
+template <typename Device>
+std::string DevicePathKey(Device* pDevice)
+{
+	DIPROPGUIDANDPATH dipgp{};
+	dipgp.diph.dwSize = sizeof(dipgp);
+	dipgp.diph.dwHeaderSize = sizeof(dipgp.diph);
+	dipgp.diph.dwHow = DIPH_DEVICE;
+
+	if (FAILED(pDevice->lpVtbl->GetProperty(pDevice, DIPROP_GUIDANDPATH, &dipgp.diph)))
+		return {};
+
+	char szPath[MAX_PATH]{};
+	ConvertString(dipgp.wszPath, szPath);
+	return HidPathKey(szPath);
+}
+
+std::shared_ptr<DeviceFeed> FindDeviceFeed(const void* pDevice)
+{
+	std::shared_lock<std::shared_mutex> lock(g_deviceFeedMutex);
+	auto it = g_deviceFeeds.find(pDevice);
+	return (it != g_deviceFeeds.end()) ? it->second : nullptr;
+}
+
+// Find the feed for a device by its HID interface path, on first use.
+template <typename Device>
+std::shared_ptr<DeviceFeed> OpenDeviceFeed(Device* pDevice)
+{
+	if (auto feed = FindDeviceFeed(pDevice))
+		return feed;
+
+	auto feed = std::make_shared<DeviceFeed>();
+
+	auto key = DevicePathKey(pDevice);
+	if (!key.empty())
+	{
+		feed->raw = GetRawFeed(key);
+		feed->ranges.Write(ReadAxisRanges(pDevice));
+	}
+
+	std::unique_lock<std::shared_mutex> lock(g_deviceFeedMutex);
+	return g_deviceFeeds.emplace(pDevice, feed).first->second;
+}
+
+void StoreJoyState(const JoyState& state, DWORD cbData, LPVOID lpvData)
+{
+	if (cbData == sizeof(DIJOYSTATE2))
+	{
+		memset(lpvData, 0, cbData);
+		memcpy(lpvData, &state, sizeof(state));
+	}
+	else
+		memcpy(lpvData, &state, sizeof(DIJOYSTATE));
+}
+
+JoyState LoadJoyState(DWORD cbData, LPCVOID lpvData)
 {
+	JoyState state{};
+	memcpy(&state, lpvData, (cbData == sizeof(DIJOYSTATE2)) ? sizeof(state) : sizeof(DIJOYSTATE));
+	return state;
+}
+
+// Test whether a data format places the standard joystick objects where the
+// DIJOYSTATE structures have them, as c_dfDIJoystick and c_dfDIJoystick2 do,
+// returning the size of the state it describes, or 0 if it doesn't. The game
+// may build its own format with the same size, so the objects are checked.
+DWORD JoystickFormatSize(LPCDIDATAFORMAT lpdf)
+{
+	if (!lpdf || lpdf->dwSize != sizeof(DIDATAFORMAT) || lpdf->dwObjSize != sizeof(DIOBJECTDATAFORMAT) ||
+		(lpdf->dwDataSize != sizeof(DIJOYSTATE) && lpdf->dwDataSize != sizeof(DIJOYSTATE2)) ||
+		!(lpdf->dwFlags & DIDF_ABSAXIS))
+	{
+		return 0;
+	}
+
+	static const std::pair<const GUID*, DWORD> axes[JOY_AXES]{
+		{ &GUID_XAxis, DIJOFS_X }, { &GUID_YAxis, DIJOFS_Y }, { &GUID_ZAxis, DIJOFS_Z },
+		{ &GUID_RxAxis, DIJOFS_RX }, { &GUID_RyAxis, DIJOFS_RY }, { &GUID_RzAxis, DIJOFS_RZ },
+		{ &GUID_Slider, DIJOFS_SLIDER(0) }, { &GUID_Slider, DIJOFS_SLIDER(1) } };
+
+	// Both formats map the state we serve, then velocities and forces we zero.
+	auto served_size = std::min<DWORD>(lpdf->dwDataSize, sizeof(JoyState));
+	auto num_buttons = served_size - DIJOFS_BUTTON0;
+
+	for (DWORD i = 0; i < lpdf->dwNumObjs; ++i)
 	{
-		std::lock_guard<std::mutex> lock(g_mutex);
-		if (++g_mEnumCalls[GetCurrentThreadId()] > MAX_ENUM_DEVICES_CALLS)
+		auto& odf = lpdf->rgodf[i];
+		auto type = DIDFT_GETTYPE(odf.dwType);
+
+		// Objects chosen by instance may be ones we'd map differently.
+		if (DIDFT_GETINSTANCE(odf.dwType) != DIDFT_GETINSTANCE(DIDFT_ANYINSTANCE) || odf.dwOfs >= lpdf->dwDataSize)
+			return 0;
+		else if (odf.dwOfs >= served_size)
+			continue;
+
+		if (type & DIDFT_BUTTON)
+		{
+			if ((odf.pguid && *odf.pguid != GUID_Button) || odf.dwOfs - DIJOFS_BUTTON0 >= num_buttons)
+				return 0;
+		}
+		else if (type & DIDFT_POV)
 		{
-			// Fail the call, causing the game to skip any post-processing.
-			return DIERR_GENERIC;
+			if ((odf.pguid && *odf.pguid != GUID_POV) || odf.dwOfs < DIJOFS_POV(0) || odf.dwOfs > DIJOFS_POV(3) ||
+				(odf.dwOfs - DIJOFS_POV(0)) % sizeof(DWORD))
+			{
+				return 0;
+			}
 		}
+		else if (type & DIDFT_AXIS)
+		{
+			auto aspect = odf.dwFlags & DIDOI_ASPECTMASK;
+			auto it = std::find_if(std::begin(axes), std::end(axes), [&](auto& axis) {
+				return odf.pguid && *odf.pguid == *axis.first && odf.dwOfs == axis.second;
+			});
+
+			if (it == std::end(axes) || (aspect && aspect != DIDOI_ASPECTPOSITION))
+				return 0;
+		}
+		else
+			return 0;
 	}
 
-#ifdef _DEBUG
-	// In debug, play the bell sound every time a call is passed through.
-	MessageBeep(static_cast<UINT>(-1));
-#endif
+	return lpdf->dwDataSize;
+}
+
+// Compare DirectInput's view with ours, so we only take over devices where the
+// two agree, and stop if they persistently differ.
+template <typename Device>
+void VerifyDeviceFeed(Device* pDevice, DeviceFeed& feed, const HidJoyState& hid, const AxisRanges& ranges,
+	DWORD cbData, LPCVOID lpvData, uint64_t now_us)
+{
+	auto num_buttons = (cbData == sizeof(DIJOYSTATE2)) ? JOY_BUTTONS : sizeof(DIJOYSTATE::rgbButtons);
+
+	if (IsJoyStateMatch(ToJoyState(hid, ranges), LoadJoyState(cbData, lpvData), ranges, num_buttons))
+	{
+		feed.mismatches = 0;
+		feed.next_verify_us = now_us + RAW_INPUT_VERIFY_US;
+		feed.verified = true;
+		return;
+	}
+
+	feed.verified = false;
+
+	// The game may have changed the axis ranges since we read them.
+	{
+		std::lock_guard<std::mutex> lock(feed.ranges_mutex);
+		feed.ranges.Write(ReadAxisRanges(pDevice));
+	}
+
+	if (++feed.mismatches == RAW_INPUT_MAX_MISMATCHES)
+	{
+		feed.disabled = true;
+		OutputDebugString("DirtFix: raw input state disagrees with DirectInput, passing device through\n");
+	}
+}
+
+// Serve joystick state from Raw Input while it's been seen to agree with
+// DirectInput, passing a call through periodically to check it still does.
+// Only devices set to a standard joystick data format are served.
+template <typename Interface>
+HRESULT __stdcall Hooked_GetDeviceState(typename DI8Traits<Interface>::Device* pThis, DWORD cbData, LPVOID lpvData)
+{
+	using Traits = DI8Traits<Interface>;
+
+	auto feed = FindDeviceFeed(pThis);
+	if (!lpvData || !feed || !cbData || feed->format_size != cbData)
+		return Traits::pfnGetDeviceState(pThis, cbData, lpvData);
+
+	auto now_us = QpcMicroseconds();
+
+	HidJoyState hid;
+	AxisRanges ranges;
+	auto have_state = feed->raw && !feed->disabled && g_hwndRawInput.load() && feed->raw->state.Read(hid) &&
+		!hid.unsupported && !hid.removed && feed->ranges.Read(ranges);
+
+	if (have_state && feed->verified && now_us < feed->next_verify_us)
+	{
+		StoreJoyState(ToJoyState(hid, ranges), cbData, lpvData);
+		return DI_OK;
+	}
+
+	auto hr = Traits::pfnGetDeviceState(pThis, cbData, lpvData);
 
-	return g_pfnEnumDevices(pThis, dwDevType, lpCallback, pvRef, dwFlags);
+	// Failures, such as lost acquisition, are for DirectInput to report.
+	if (FAILED(hr) || (have_state && !IsRawInputOwned()))
+		feed->verified = false;
+	else if (have_state)
+		VerifyDeviceFeed(pThis, *feed, hid, ranges, cbData, lpvData, now_us);
+
+	return hr;
+}
+
+// Devices being served from Raw Input don't need polling, except before the
+// periodic check, so that DirectInput's state is current.
+template <typename Interface>
+HRESULT __stdcall Hooked_Poll(typename DI8Traits<Interface>::Device* pThis)
+{
+	using Traits = DI8Traits<Interface>;
+
+	auto feed = FindDeviceFeed(pThis);
+	if (feed && feed->verified && feed->format_size && g_hwndRawInput.load() &&
+		QpcMicroseconds() < feed->next_verify_us)
+	{
+		return feed->poll_hr;
+	}
+
+	auto hr = Traits::pfnPoll(pThis);
+	if (feed)
+		feed->poll_hr = hr;
+
+	return hr;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-LRESULT CALLBACK HidNotifySubclassProc(
-	HWND hWnd,
-	UINT uMsg,
-	WPARAM wParam,
-	LPARAM lParam,
-	UINT_PTR /*uIdSubclass*/,
-	DWORD_PTR /*dwRefData*/)
+// Flatten a data format for comparison, including the GUIDs it points to.
+std::vector<uint8_t> FlattenDataFormat(LPCDIDATAFORMAT lpdf)
 {
-	auto p = reinterpret_cast<PDEV_BROADCAST_DEVICEINTERFACE>(lParam);
+	std::vector<uint8_t> flat;
+	auto append = [&](const void* p, size_t size) {
+		auto pb = static_cast<const uint8_t*>(p);
+		flat.insert(flat.end(), pb, pb + size);
+	};
 
-	if (uMsg == WM_DEVICECHANGE &&
-		(wParam == DBT_DEVICEARRIVAL || wParam == DBT_DEVICEREMOVECOMPLETE) &&
-		p->dbcc_devicetype == DBT_DEVTYP_DEVICEINTERFACE &&
-		p->dbcc_classguid == GUID_DEVINTERFACE_HID)
+	append(lpdf, offsetof(DIDATAFORMAT, rgodf));
+
+	for (DWORD i = 0; i < lpdf->dwNumObjs; ++i)
 	{
-		std::lock_guard<std::mutex> lock(g_mutex);
-		g_mEnumCalls.clear();
+		auto& odf = lpdf->rgodf[i];
+		GUID guid = odf.pguid ? *odf.pguid : GUID_NULL;
+		append(&guid, sizeof(guid));
+		flat.push_back(odf.pguid ? 1 : 0);
+		append(&odf.dwOfs, sizeof(odf) - offsetof(DIOBJECTDATAFORMAT, dwOfs));
 	}
 
-	return DefSubclassProc(hWnd, uMsg, wParam, lParam);
+	return flat;
+}
+
+// Hand back a pooled device if the game asks for one it created earlier.
+template <typename Interface>
+HRESULT __stdcall Hooked_CreateDevice(
+	Interface* pThis,
+	REFGUID rguid,
+	typename DI8Traits<Interface>::Device** lplpDirectInputDevice,
+	LPUNKNOWN pUnkOuter)
+{
+	using Traits = DI8Traits<Interface>;
+
+	if (pUnkOuter || !lplpDirectInputDevice)
+		return Traits::pfnCreateDevice(pThis, rguid, lplpDirectInputDevice, pUnkOuter);
+
+	DevicePoolKey key{};
+	memcpy(key.instance_guid, &rguid, sizeof(key.instance_guid));
+	key.creator = pThis;
+
+	if (auto pUnk = g_devicePool.Lend(key))
+	{
+		*lplpDirectInputDevice = reinterpret_cast<typename Traits::Device*>(pUnk);
+		return DI_OK;
+	}
+
+	auto hr = Traits::pfnCreateDevice(pThis, rguid, lplpDirectInputDevice, pUnkOuter);
+	if (SUCCEEDED(hr))
+	{
+		auto pDevice = *lplpDirectInputDevice;
+		g_devicePool.Add(key, reinterpret_cast<IUnknown*>(pDevice), DevicePathKey(pDevice));
+	}
+
+	return hr;
+}
+
+// Note which devices have a joystick data format, for the Raw Input feed, and
+// skip setting the same format again on a device handed back from the pool.
+template <typename Interface>
+HRESULT __stdcall Hooked_SetDataFormat(typename DI8Traits<Interface>::Device* pThis, LPCDIDATAFORMAT lpdf)
+{
+	auto pUnk = reinterpret_cast<IUnknown*>(pThis);
+	auto poolable = g_config.device_pool && lpdf &&
+		lpdf->dwSize == sizeof(DIDATAFORMAT) && lpdf->dwObjSize == sizeof(DIOBJECTDATAFORMAT);
+
+	std::vector<uint8_t> format;
+	if (poolable)
+	{
+		format = FlattenDataFormat(lpdf);
+		if (g_devicePool.IsFormatSet(pUnk, format))
+			return DI_OK;
+	}
+
+	auto hr = DI8Traits<Interface>::pfnSetDataFormat(pThis, lpdf);
+	if (FAILED(hr))
+		return hr;
+
+	if (poolable)
+		g_devicePool.SetFormat(pUnk, format);
+
+	// A new format also resets the axis ranges, so the feed must be checked again.
+	if (g_config.raw_input)
+	{
+		auto format_size = JoystickFormatSize(lpdf);
+		if (auto feed = format_size ? OpenDeviceFeed(pThis) : FindDeviceFeed(pThis))
+		{
+			feed->format_size = format_size;
+			feed->verified = false;
+		}
+	}
+
+	return hr;
+}
+
+// Count the references the game takes on pooled devices.
+template <typename Interface>
+ULONG __stdcall Hooked_DeviceAddRef(typename DI8Traits<Interface>::Device* pThis)
+{
+	auto refs = DI8Traits<Interface>::pfnAddRef(pThis);
+
+	if (g_config.device_pool && !UnknownOps::active)
+		g_devicePool.AddLoanRef(reinterpret_cast<IUnknown*>(pThis));
+
+	return refs;
+}
+
+// References to a device's other interfaces can't be told apart from those of
+// its internals, so a device queried by the game is no longer pooled.
+template <typename Interface>
+HRESULT __stdcall Hooked_DeviceQueryInterface(typename DI8Traits<Interface>::Device* pThis, REFIID riid, LPVOID* ppvObj)
+{
+	auto hr = DI8Traits<Interface>::pfnQueryInterface(pThis, riid, ppvObj);
+
+	if (SUCCEEDED(hr) && g_config.device_pool && !UnknownOps::active)
+		g_devicePool.Forget(reinterpret_cast<IUnknown*>(pThis));
+
+	return hr;
+}
+
+// Return devices to the pool when the game releases the last reference it was
+// lent, and forget the Raw Input feeds of those freed, as their address may be
+// reused.
+template <typename Interface>
+ULONG __stdcall Hooked_DeviceRelease(typename DI8Traits<Interface>::Device* pThis)
+{
+	auto pUnk = reinterpret_cast<IUnknown*>(pThis);
+	auto returning = g_config.device_pool && !UnknownOps::active && g_devicePool.ReleaseLoanRef(pUnk);
+	auto refs = DI8Traits<Interface>::pfnRelease(pThis);
+
+	if (!refs)
+	{
+		std::unique_lock<std::shared_mutex> lock(g_deviceFeedMutex);
+		g_deviceFeeds.erase(pThis);
+	}
+	else if (returning)
+	{
+		// Leave it as a new device would be, apart from its data format.
+		pThis->lpVtbl->Unacquire(pThis);
+		g_devicePool.Return(pUnk);
+	}
+
+	return refs;
+}
+
+// One-time setup when the first DirectInput interface is hooked.
+void StartShim()
+{
+	DetourTransactionBegin();
+	DetourUpdateThread(GetCurrentThread());
+	DetourAttach(&reinterpret_cast<PVOID&>(g_pfnDispatchMessageA), Hooked_DispatchMessageA);
+	DetourAttach(&reinterpret_cast<PVOID&>(g_pfnDispatchMessageW), Hooked_DispatchMessageW);
+	if (g_config.setup_memo)
+		AttachSetupHooks();
+	DetourTransactionCommit();
+
+	CreateStatsSection();
+	CreateControlSection();
+	StartTrace();
+
+	g_hRefreshEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	g_hSaveEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	g_validateDiskCache = LoadDiskCache();
+	std::thread(RefreshThread).detach();
+	std::thread(NotifyThread).detach();
+
+	if (g_config.raw_input)
+		std::thread(RawInputThread).detach();
+
+	g_started = true;
+}
+
+// Hook the enumeration functions for each interface type the game creates,
+// which all share the same device snapshots.
+template <typename Interface>
+void HookInterface(Interface* pDI8)
+{
+	using Traits = DI8Traits<Interface>;
+	std::lock_guard<std::mutex> lock(g_hookMutex);
+
+	if (Traits::pfnEnumDevices)
+		return;
+	else if (!g_started)
+		StartShim();
+
+	Traits::pfnEnumDevices = pDI8->lpVtbl->EnumDevices;
+	Traits::pfnEnumDevicesBySemantics = pDI8->lpVtbl->EnumDevicesBySemantics;
+
+	if (g_config.device_pool)
+	{
+		Traits::pfnCreateDevice = pDI8->lpVtbl->CreateDevice;
+		Traits::pfnHookCreateDevice = &Hooked_CreateDevice<Interface>;
+	}
+
+	// All device types share an implementation, so the keyboard, which is
+	// always present, reveals the functions to hook for joysticks. The ANSI and
+	// Unicode interfaces may share it too, in which case it's hooked only once.
+	typename Traits::Device* pDevice{};
+	if ((g_config.raw_input || g_config.device_pool) &&
+		SUCCEEDED(pDI8->lpVtbl->CreateDevice(pDI8, GUID_SysKeyboard, &pDevice, nullptr)))
+	{
+		auto pTarget = reinterpret_cast<PVOID>(pDevice->lpVtbl->Release);
+		if (std::find(g_deviceHookTargets.begin(), g_deviceHookTargets.end(), pTarget) == g_deviceHookTargets.end())
+		{
+			g_deviceHookTargets.push_back(pTarget);
+			Traits::pfnRelease = pDevice->lpVtbl->Release;
+			Traits::pfnHookRelease = &Hooked_DeviceRelease<Interface>;
+
+			if (g_config.device_pool)
+			{
+				Traits::pfnQueryInterface = pDevice->lpVtbl->QueryInterface;
+				Traits::pfnAddRef = pDevice->lpVtbl->AddRef;
+				Traits::pfnHookQueryInterface = &Hooked_DeviceQueryInterface<Interface>;
+				Traits::pfnHookAddRef = &Hooked_DeviceAddRef<Interface>;
+			}
+
+			if (g_config.raw_input)
+			{
+				Traits::pfnGetDeviceState = pDevice->lpVtbl->GetDeviceState;
+				Traits::pfnPoll = pDevice->lpVtbl->Poll;
+				Traits::pfnHookGetDeviceState = &Hooked_GetDeviceState<Interface>;
+				Traits::pfnHookPoll = &Hooked_Poll<Interface>;
+			}
+
+			Traits::pfnSetDataFormat = pDevice->lpVtbl->SetDataFormat;
+			Traits::pfnHookSetDataFormat = &Hooked_SetDataFormat<Interface>;
+		}
+
+		pDevice->lpVtbl->Release(pDevice);
+	}
+
+	// Instantiate the hooks for the configured throttle, to avoid run-time dispatch.
+	WithThrottle(g_config.throttle, [](auto throttle) {
+		using Throttle = decltype(throttle);
+		Traits::pfnHookEnumDevices = &Hooked_EnumDevices<Interface, Throttle>;
+		Traits::pfnHookEnumDevicesBySemantics = &Hooked_EnumDevicesBySemantics<Interface, Throttle>;
+	});
+
+	DetourTransactionBegin();
+	DetourUpdateThread(GetCurrentThread());
+	DetourAttach(&reinterpret_cast<PVOID&>(Traits::pfnEnumDevices),
+		reinterpret_cast<PVOID>(Traits::pfnHookEnumDevices));
+	DetourAttach(&reinterpret_cast<PVOID&>(Traits::pfnEnumDevicesBySemantics),
+		reinterpret_cast<PVOID>(Traits::pfnHookEnumDevicesBySemantics));
+	if (Traits::pfnCreateDevice)
+	{
+		DetourAttach(&reinterpret_cast<PVOID&>(Traits::pfnCreateDevice),
+			reinterpret_cast<PVOID>(Traits::pfnHookCreateDevice));
+	}
+	if (Traits::pfnRelease)
+	{
+		DetourAttach(&reinterpret_cast<PVOID&>(Traits::pfnRelease), reinterpret_cast<PVOID>(Traits::pfnHookRelease));
+	}
+	if (Traits::pfnAddRef)
+	{
+		DetourAttach(&reinterpret_cast<PVOID&>(Traits::pfnAddRef), reinterpret_cast<PVOID>(Traits::pfnHookAddRef));
+		DetourAttach(&reinterpret_cast<PVOID&>(Traits::pfnQueryInterface),
+			reinterpret_cast<PVOID>(Traits::pfnHookQueryInterface));
+	}
+	if (Traits::pfnGetDeviceState)
+	{
+		DetourAttach(&reinterpret_cast<PVOID&>(Traits::pfnGetDeviceState),
+			reinterpret_cast<PVOID>(Traits::pfnHookGetDeviceState));
+		DetourAttach(&reinterpret_cast<PVOID&>(Traits::pfnPoll), reinterpret_cast<PVOID>(Traits::pfnHookPoll));
+	}
+	if (Traits::pfnSetDataFormat)
+	{
+		DetourAttach(&reinterpret_cast<PVOID&>(Traits::pfnSetDataFormat),
+			reinterpret_cast<PVOID>(Traits::pfnHookSetDataFormat));
+	}
+	DetourTransactionCommit();
+
+	// The refresh thread can now call the original functions for this interface.
+	Traits::hooked = true;
+
+	// Check any snapshots from disk with a real enumeration, off the game threads.
+	if (std::exchange(g_validateDiskCache, false))
+		SetEvent(g_hRefreshEvent);
+}
+
+template <typename Interface>
+void DetachInterfaceHooks()
+{
+	using Traits = DI8Traits<Interface>;
+
+	if (Traits::pfnEnumDevices)
+	{
+		DetourDetach(&reinterpret_cast<PVOID&>(Traits::pfnEnumDevices),
+			reinterpret_cast<PVOID>(Traits::pfnHookEnumDevices));
+		DetourDetach(&reinterpret_cast<PVOID&>(Traits::pfnEnumDevicesBySemantics),
+			reinterpret_cast<PVOID>(Traits::pfnHookEnumDevicesBySemantics));
+	}
+
+	if (Traits::pfnCreateDevice)
+	{
+		DetourDetach(&reinterpret_cast<PVOID&>(Traits::pfnCreateDevice),
+			reinterpret_cast<PVOID>(Traits::pfnHookCreateDevice));
+	}
+
+	if (Traits::pfnRelease)
+		DetourDetach(&reinterpret_cast<PVOID&>(Traits::pfnRelease), reinterpret_cast<PVOID>(Traits::pfnHookRelease));
+
+	if (Traits::pfnAddRef)
+	{
+		DetourDetach(&reinterpret_cast<PVOID&>(Traits::pfnAddRef), reinterpret_cast<PVOID>(Traits::pfnHookAddRef));
+		DetourDetach(&reinterpret_cast<PVOID&>(Traits::pfnQueryInterface),
+			reinterpret_cast<PVOID>(Traits::pfnHookQueryInterface));
+	}
+
+	if (Traits::pfnGetDeviceState)
+	{
+		DetourDetach(&reinterpret_cast<PVOID&>(Traits::pfnGetDeviceState),
+			reinterpret_cast<PVOID>(Traits::pfnHookGetDeviceState));
+		DetourDetach(&reinterpret_cast<PVOID&>(Traits::pfnPoll), reinterpret_cast<PVOID>(Traits::pfnHookPoll));
+	}
+
+	if (Traits::pfnSetDataFormat)
+	{
+		DetourDetach(&reinterpret_cast<PVOID&>(Traits::pfnSetDataFormat),
+			reinterpret_cast<PVOID>(Traits::pfnHookSetDataFormat));
+	}
+}
+
+// Capture the base snapshot on our own interface, publishing it only if the
+// game hasn't already captured one itself in the meantime.
+void PreWarmThread(IDirectInput8W* pDI8)
+{
+	DeviceSnapshot<DeviceEntry> snapshot;
+	StopWatch timer;
+
+	if (SUCCEEDED(CaptureSnapshot(pDI8, DIEDFL_ALLDEVICES, snapshot)))
+	{
+		auto elapsed_us = timer.ElapsedUs();
+
+		if (g_cache.Insert(DIEDFL_ALLDEVICES, std::move(snapshot)))
+		{
+			g_prewarm_us = elapsed_us;
+			SetEvent(g_hSaveEvent);
+		}
+		else
+		{
+			OutputDebugString("DirtFix: pre-warm finished after the first enumeration\n");
+		}
+	}
+
+	pDI8->lpVtbl->Release(pDI8);
+}
+
+// Start enumerating as soon as DirectInput is loaded, in the hope of finishing
+// before the game asks. Hooking our own interface first means the background
+// enumeration calls the original function, rather than code being patched.
+void StartPreWarm()
+{
+	IDirectInput8W* pDI8{};
+	if (FAILED(g_pfnDirectInput8Create(GetModuleHandle(NULL), DIRECTINPUT_VERSION,
+			IID_IDirectInput8W, reinterpret_cast<LPVOID*>(&pDI8), nullptr)))
+	{
+		return;
+	}
+
+	HookInterface(pDI8);
+
+	// Snapshots from the disk cache are already being checked in the background.
+	if (g_cache.Read().Find(DIEDFL_ALLDEVICES))
+		pDI8->lpVtbl->Release(pDI8);
+	else
+		std::thread(PreWarmThread, pDI8).detach();
 }
 
 extern "C"
@@ -92,6 +2201,17 @@ DirectInput8Create(HINSTANCE hinst, DWORD dwVersion, REFIID riidltf, LPVOID* ppv
 
 		g_pfnDirectInput8Create =
 			(decltype(g_pfnDirectInput8Create))GetProcAddress(hmodDInput8, "DirectInput8Create");
+
+		// Fixed game builds get a pure forwarder, without any hooks or threads.
+		g_forwardOnly = g_pfnDirectInput8Create && IsFixedHost();
+
+		if (g_pfnDirectInput8Create && !g_forwardOnly)
+		{
+			LoadConfig();
+
+			if (g_config.prewarm)
+				StartPreWarm();
+		}
 	}
 
 	if (!g_pfnDirectInput8Create)
@@ -99,40 +2219,35 @@ DirectInput8Create(HINSTANCE hinst, DWORD dwVersion, REFIID riidltf, LPVOID* ppv
 
 	hr = g_pfnDirectInput8Create(hinst, dwVersion, riidltf, ppvOut, punkOuter);
 
-	if (SUCCEEDED(hr) && (g_pfnEnumDevices == nullptr) &&
-		(riidltf == IID_IDirectInput8A || (riidltf == IID_IDirectInput8W)))
+	if (SUCCEEDED(hr) && !g_forwardOnly)
 	{
-		auto pDI8 = reinterpret_cast<IDirectInput8*>(*ppvOut);
-		g_pfnEnumDevices = pDI8->lpVtbl->EnumDevices;
-
-		DetourTransactionBegin();
-		DetourUpdateThread(GetCurrentThread());
-		DetourAttach(&reinterpret_cast<PVOID&>(g_pfnEnumDevices), Hooked_EnumDevices);
-		DetourTransactionCommit();
-
-		g_hwndNotify = CreateWindow("static", "", 0, 0, 0, 0, 0, NULL, NULL, GetModuleHandle(NULL), 0L);
-		SetWindowSubclass(g_hwndNotify, HidNotifySubclassProc, 0, 0);
-
-		DEV_BROADCAST_DEVICEINTERFACE dbdi{};
-		dbdi.dbcc_size = sizeof(dbdi);
-		dbdi.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
-		dbdi.dbcc_classguid = GUID_DEVINTERFACE_HID;
-		RegisterDeviceNotification(g_hwndNotify, &dbdi, DEVICE_NOTIFY_WINDOW_HANDLE);
+		if (riidltf == IID_IDirectInput8A)
+			HookInterface(reinterpret_cast<IDirectInput8A*>(*ppvOut));
+		else if (riidltf == IID_IDirectInput8W)
+			HookInterface(reinterpret_cast<IDirectInput8W*>(*ppvOut));
 	}
 
 	return hr;
 }
 
 BOOL APIENTRY DllMain(
-	_In_ HMODULE /*hinstDLL*/,
+	_In_ HMODULE hinstDLL,
 	_In_ DWORD  dwReason,
 	_In_ LPVOID /*lpvReserved*/)
 {
-	if ((dwReason == DLL_PROCESS_DETACH) && (g_pfnEnumDevices != nullptr))
+	if (dwReason == DLL_PROCESS_ATTACH)
+		g_hinstDLL = hinstDLL;
+
+	if ((dwReason == DLL_PROCESS_DETACH) && g_started)
 	{
 		DetourTransactionBegin();
 		DetourUpdateThread(GetCurrentThread());
-		DetourDetach(&reinterpret_cast<PVOID&>(g_pfnEnumDevices), Hooked_EnumDevices);
+		DetachInterfaceHooks<IDirectInput8A>();
+		DetachInterfaceHooks<IDirectInput8W>();
+		DetourDetach(&reinterpret_cast<PVOID&>(g_pfnDispatchMessageA), Hooked_DispatchMessageA);
+		DetourDetach(&reinterpret_cast<PVOID&>(g_pfnDispatchMessageW), Hooked_DispatchMessageW);
+		if (g_config.setup_memo)
+			DetachSetupHooks();
 		DetourTransactionCommit();
 	}
 
@@ -13,11 +13,24 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <commctrl.h>
+#include <setupapi.h>
+#include <cfgmgr32.h>
 #include <dbt.h>
+#include <hidsdi.h>
 #include "detours.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <map>
+#include <string>
 #include <filesystem>
 namespace fs = std::filesystem;
 
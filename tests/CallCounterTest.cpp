@@ -0,0 +1,138 @@
+// CallCounter reset semantics, and a benchmark of per-thread counting against
+// the locked map of thread IDs it replaced, with 1 to 32 threads calling at once.
+
+#include "Test.h"
+#include "CallCounter.h"
+
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	thread_local ThreadCalls t_calls;
+
+	// The accounting the EnumDevices hook used before CallCounter.
+	class LockedCallMap
+	{
+	public:
+		int Increment()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return ++m_calls[std::this_thread::get_id()];
+		}
+
+		void Reset()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_calls.clear();
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::map<std::thread::id, int> m_calls;
+	};
+
+	// Run calls on the given number of threads at once, returning the mean ns
+	// per call across all of them.
+	template <typename Func>
+	double TimeThreads(int num_threads, uint32_t calls_per_thread, Func&& func)
+	{
+		std::atomic<int> ready{ 0 };
+		std::atomic<bool> go{ false };
+		std::vector<std::thread> threads;
+
+		for (int i = 0; i < num_threads; ++i)
+		{
+			threads.emplace_back([&] {
+				++ready;
+				while (!go)
+					std::this_thread::yield();
+
+				for (uint32_t j = 0; j < calls_per_thread; ++j)
+					func();
+			});
+		}
+
+		while (ready != num_threads)
+			std::this_thread::yield();
+
+		auto start = std::chrono::steady_clock::now();
+		go = true;
+		for (auto& thread : threads)
+			thread.join();
+
+		auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+		return elapsed.count() / (static_cast<double>(num_threads) * calls_per_thread);
+	}
+}
+
+TEST(CountsPerThread)
+{
+	CallCounter counter;
+	ThreadCalls main_calls{};
+
+	CHECK(counter.Increment(main_calls) == 1);
+	CHECK(counter.Increment(main_calls) == 2);
+
+	uint32_t other_count{ 0 };
+	std::thread([&] {
+		ThreadCalls calls{};
+		other_count = counter.Increment(calls);
+	}).join();
+
+	CHECK(other_count == 1);
+	CHECK(counter.Increment(main_calls) == 3);
+}
+
+TEST(ResetIsLazy)
+{
+	CallCounter counter;
+	ThreadCalls calls{};
+	counter.Increment(calls);
+	calls.last_us = 1234;
+
+	counter.Reset();
+	CHECK(calls.count == 1);		// untouched until the thread next calls
+
+	auto& synced = counter.Sync(calls);
+	CHECK(&synced == &calls);
+	CHECK(calls.count == 0 && calls.last_us == 0);
+	CHECK(counter.Increment(calls) == 1);
+}
+
+TEST(ZeroInitialisedStateIsReset)
+{
+	// A thread_local starts zeroed, which must never match a live generation.
+	CallCounter counter;
+	ThreadCalls calls{ 0, 99, 99 };
+	CHECK(counter.Increment(calls) == 1);
+}
+
+TEST(ThreadScalingBenchmark)
+{
+	constexpr uint32_t CALLS_PER_THREAD{ 200'000 };
+
+	CallCounter counter;
+	LockedCallMap locked;
+	for (int num_threads : { 1, 2, 4, 8, 16, 32 })
+	{
+		locked.Reset();
+		std::atomic<uint64_t> locked_total{ 0 };
+		auto locked_ns = TimeThreads(num_threads, CALLS_PER_THREAD, [&] {
+			if (locked.Increment() == static_cast<int>(CALLS_PER_THREAD))
+				locked_total += CALLS_PER_THREAD;
+		});
+
+		counter.Reset();
+		std::atomic<uint64_t> total{ 0 };
+		auto counter_ns = TimeThreads(num_threads, CALLS_PER_THREAD, [&] {
+			if (counter.Increment(t_calls) == CALLS_PER_THREAD)
+				total += CALLS_PER_THREAD;
+		});
+
+		CHECK(locked_total == static_cast<uint64_t>(num_threads) * CALLS_PER_THREAD);
+		CHECK(total == static_cast<uint64_t>(num_threads) * CALLS_PER_THREAD);
+		std::printf("  %2d threads: %.2fns CallCounter, %.2fns locked map\n", num_threads, counter_ns, locked_ns);
+	}
+}
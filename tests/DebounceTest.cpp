@@ -0,0 +1,99 @@
+// Debouncer driven by a fake clock, so bursts and deadlines are exact.
+
+#include "Test.h"
+#include "Debounce.h"
+
+using namespace std::chrono_literals;
+
+namespace
+{
+	// Time source advanced by hand, with the debouncer it drives.
+	struct FakeClock
+	{
+		Debouncer debouncer{ 50ms, 200ms };
+		Debouncer::Time now{ 1000ms };
+
+		void Event() { debouncer.Event(now); }
+		bool Advance(Debouncer::Time elapsed) { now += elapsed; return debouncer.Poll(now); }
+	};
+}
+
+TEST(IdleNeverFires)
+{
+	FakeClock clock;
+	CHECK(!clock.debouncer.Timeout(clock.now));
+	CHECK(!clock.Advance(10s));
+}
+
+TEST(FiresAfterQuietPeriod)
+{
+	FakeClock clock;
+	clock.Event();
+	CHECK(clock.debouncer.Timeout(clock.now) == 50ms);
+
+	CHECK(!clock.Advance(49ms));
+	CHECK(clock.Advance(1ms));
+	CHECK(clock.debouncer.Latency() == 50ms);
+	CHECK(clock.debouncer.Merged() == 1);
+
+	// Only once per burst.
+	CHECK(!clock.Advance(1s));
+}
+
+TEST(BurstIsMerged)
+{
+	// Arrivals for several HID interfaces of one controller.
+	FakeClock clock;
+	for (int i = 0; i < 5; ++i)
+	{
+		clock.Event();
+		CHECK(!clock.Advance(10ms));
+	}
+
+	CHECK(clock.debouncer.Timeout(clock.now) == 40ms);
+	CHECK(clock.Advance(40ms));
+	CHECK(clock.debouncer.Merged() == 5);
+	CHECK(clock.debouncer.Latency() == 90ms);
+}
+
+TEST(MaxDelayBoundsLatency)
+{
+	// Events that keep arriving within the quiet period can't delay it forever.
+	FakeClock clock;
+	auto fired = false;
+	int events{ 0 };
+
+	while (!fired)
+	{
+		clock.Event();
+		++events;
+		fired = clock.Advance(30ms);
+	}
+
+	CHECK(clock.debouncer.Latency() == 210ms);
+	CHECK(clock.debouncer.Merged() == events);
+	CHECK(events == 7);
+}
+
+TEST(LateCheckFiresImmediately)
+{
+	FakeClock clock;
+	clock.Event();
+	clock.now += 500ms;
+	CHECK(clock.debouncer.Timeout(clock.now) == 0ms);
+	CHECK(clock.debouncer.Poll(clock.now));
+	CHECK(clock.debouncer.Latency() == 500ms);
+}
+
+TEST(NextBurstStartsAfresh)
+{
+	FakeClock clock;
+	clock.Event();
+	clock.Event();
+	CHECK(clock.Advance(50ms));
+
+	clock.Event();
+	CHECK(clock.Advance(50ms));
+	CHECK(clock.debouncer.Merged() == 1);
+	CHECK(clock.debouncer.Latency() == 50ms);
+}
@@ -0,0 +1,185 @@
+// DeviceCache under concurrent readers and writers, and the merge of a
+// background refresh with snapshots stored while it ran.
+
+#include "Test.h"
+#include "DeviceCache.h"
+
+#include <atomic>
+#include <thread>
+
+namespace
+{
+	// Every device in a snapshot carries the generation that built it, so a
+	// reader seeing a mixture has seen a map that was modified in place.
+	struct TaggedInstance
+	{
+		uint32_t dwDevType;
+		uint32_t generation;
+	};
+
+	DeviceSnapshot<TaggedInstance> Generation(uint32_t generation, size_t num_devices = 8)
+	{
+		DeviceSnapshot<TaggedInstance> snapshot;
+		for (size_t i = 0; i < num_devices; ++i)
+			snapshot.Add(TaggedInstance{ DEVTYPE_JOYSTICK, generation });
+
+		return snapshot;
+	}
+
+	uint32_t GenerationOf(const DeviceSnapshot<TaggedInstance>* snapshot)
+	{
+		return snapshot ? snapshot->Devices().front().generation : 0;
+	}
+
+	SnapshotMap<TaggedInstance> Refreshed(const SnapshotMap<TaggedInstance>& sampled, uint32_t generation)
+	{
+		SnapshotMap<TaggedInstance> refreshed;
+		for (auto& entry : sampled)
+			refreshed[entry.first] = std::make_shared<const DeviceSnapshot<TaggedInstance>>(Generation(generation));
+
+		return refreshed;
+	}
+}
+
+TEST(ReadersSeeWholeSnapshots)
+{
+	constexpr int NUM_READERS{ 4 };
+	constexpr uint32_t NUM_KEYS{ 4 };
+	constexpr uint32_t NUM_GENERATIONS{ 2000 };
+
+	DeviceCache<TaggedInstance> cache;
+	std::atomic<bool> done{ false };
+	std::atomic<int> torn{ 0 };
+	std::atomic<uint64_t> reads{ 0 };
+	std::atomic<int> readers_started{ 0 };
+
+	std::vector<std::thread> readers;
+	for (int i = 0; i < NUM_READERS; ++i)
+	{
+		readers.emplace_back([&] {
+			++readers_started;
+			while (!done)
+			{
+				auto reader = cache.Read();
+				for (uint32_t key = 0; key < NUM_KEYS; ++key)
+				{
+					auto snapshot = reader.Find(key);
+					auto generation = GenerationOf(snapshot);
+					if (snapshot && !snapshot->Replay(DEVCLASS_ALL, 0,
+						[&](const TaggedInstance& instance) { return instance.generation == generation; }))
+					{
+						++torn;
+					}
+				}
+
+				++reads;
+			}
+		});
+	}
+
+	while (readers_started != NUM_READERS)
+		std::this_thread::yield();
+
+	// Alternate between single stores and whole refreshes, as the shim does.
+	for (uint32_t generation = 1; generation <= NUM_GENERATIONS; ++generation)
+	{
+		if (generation % 4)
+			cache.Store(generation % NUM_KEYS, Generation(generation));
+		else
+		{
+			auto sampled = cache.Sample();
+			cache.Refresh(sampled, Refreshed(sampled, generation));
+		}
+	}
+
+	auto reads_during_writes = reads.load();
+	done = true;
+	for (auto& reader : readers)
+		reader.join();
+
+	CHECK(torn == 0);
+	CHECK(reads_during_writes > 0);
+	std::printf("  %llu reads during %u writes\n", static_cast<unsigned long long>(reads_during_writes), NUM_GENERATIONS);
+}
+
+TEST(ReaderHeldAcrossWrites)
+{
+	DeviceCache<TaggedInstance> cache;
+	cache.Store(0, Generation(1));
+
+	// Writers never wait for readers, so this completes while one is active.
+	auto reader = cache.Read();
+	std::thread writer([&] {
+		for (uint32_t generation = 2; generation < 100; ++generation)
+			cache.Store(0, Generation(generation));
+	});
+	writer.join();
+
+	CHECK(GenerationOf(reader.Find(0)) == 1);
+	CHECK(GenerationOf(cache.Read().Find(0)) == 99);
+}
+
+TEST(RefreshReplacesSampled)
+{
+	DeviceCache<TaggedInstance> cache;
+	cache.Store(0, Generation(1));
+	cache.Store(1, Generation(1));
+
+	auto sampled = cache.Sample();
+	cache.Refresh(sampled, Refreshed(sampled, 2));
+
+	auto reader = cache.Read();
+	CHECK(GenerationOf(reader.Find(0)) == 2);
+	CHECK(GenerationOf(reader.Find(1)) == 2);
+}
+
+TEST(RefreshKeepsNewerStores)
+{
+	DeviceCache<TaggedInstance> cache;
+	cache.Store(0, Generation(1));
+	cache.Store(1, Generation(1));
+
+	auto sampled = cache.Sample();
+	auto refreshed = Refreshed(sampled, 2);
+
+	// Changes made while the refresh was running.
+	cache.Store(0, Generation(3));
+	cache.Store(2, Generation(3));
+	cache.Refresh(sampled, std::move(refreshed));
+
+	auto reader = cache.Read();
+	CHECK(GenerationOf(reader.Find(0)) == 3);
+	CHECK(GenerationOf(reader.Find(1)) == 2);
+	CHECK(GenerationOf(reader.Find(2)) == 3);
+}
+
+TEST(RefreshDoesNotRestoreCleared)
+{
+	DeviceCache<TaggedInstance> cache;
+	cache.Store(0, Generation(1));
+
+	auto sampled = cache.Sample();
+	auto refreshed = Refreshed(sampled, 2);
+
+	// A device change invalidated everything while the refresh was running.
+	cache.Clear();
+	cache.Refresh(sampled, std::move(refreshed));
+
+	CHECK(cache.Read().Snapshots().empty());
+}
+
+TEST(RefreshDropsFailed)
+{
+	DeviceCache<TaggedInstance> cache;
+	cache.Store(0, Generation(1));
+	cache.Store(1, Generation(1));
+
+	auto sampled = cache.Sample();
+	auto refreshed = Refreshed(sampled, 2);
+	refreshed.erase(1);
+	cache.Refresh(sampled, std::move(refreshed));
+
+	auto reader = cache.Read();
+	CHECK(GenerationOf(reader.Find(0)) == 2);
+	CHECK(reader.Find(1) == nullptr);
+}
@@ -0,0 +1,164 @@
+// DeviceCache snapshots and replay, compared against a mock enumerator that
+// stands in for IDirectInput8::EnumDevices.
+
+#include "Test.h"
+#include "DeviceCache.h"
+
+#include <string>
+
+namespace
+{
+	struct MockInstance
+	{
+		uint32_t dwDevType;
+		uint32_t id;
+		bool attached;
+		bool force_feedback;
+	};
+
+	// A keyboard, a mouse, and a mix of attached and force feedback controllers.
+	std::vector<MockInstance> MockDevices(size_t num_controllers)
+	{
+		std::vector<MockInstance> devices{
+			{ DEVTYPE_KEYBOARD, 0, true, false },
+			{ DEVTYPE_MOUSE, 1, true, false },
+		};
+
+		for (uint32_t i = 0; i < num_controllers; ++i)
+		{
+			auto dev_type = (i % 3) ? DEVTYPE_JOYSTICK : 0x15;		// DI8DEVTYPE_GAMEPAD
+			devices.push_back(MockInstance{ dev_type | 0x100, 2 + i, (i % 2) == 0, (i % 4) == 0 });
+		}
+
+		return devices;
+	}
+
+	uint32_t MockCaps(const MockInstance& instance)
+	{
+		return (instance.attached ? EDFL_ATTACHEDONLY : 0) | (instance.force_feedback ? EDFL_FORCEFEEDBACK : 0);
+	}
+
+	// Filter the way DirectInput does, which is what replay must reproduce.
+	template <typename Callback>
+	void MockEnumDevices(const std::vector<MockInstance>& devices, uint32_t filter, uint32_t flags, Callback&& callback)
+	{
+		for (auto& device : devices)
+		{
+			DeviceIndexEntry entry{ static_cast<uint8_t>(DevTypeClass(device.dwDevType)),
+				static_cast<uint8_t>(device.dwDevType), static_cast<uint16_t>(MockCaps(device)) };
+
+			if (IsIndexMatch(filter, flags, entry) && !callback(device))
+				break;
+		}
+	}
+
+	DeviceSnapshot<MockInstance> Capture(const std::vector<MockInstance>& devices)
+	{
+		DeviceSnapshot<MockInstance> snapshot;
+		for (auto& device : devices)
+			snapshot.Add(device, MockCaps(device));
+
+		return snapshot;
+	}
+
+	std::vector<uint32_t> ReplayIds(const DeviceSnapshot<MockInstance>& snapshot, uint32_t filter, uint32_t flags)
+	{
+		std::vector<uint32_t> ids;
+		snapshot.Replay(filter, flags, [&](const MockInstance& instance) { ids.push_back(instance.id); return true; });
+		return ids;
+	}
+}
+
+TEST(DevTypeClasses)
+{
+	CHECK(DevTypeClass(DEVTYPE_MOUSE) == DEVCLASS_POINTER);
+	CHECK(DevTypeClass(DEVTYPE_SCREENPOINTER) == DEVCLASS_POINTER);
+	CHECK(DevTypeClass(DEVTYPE_KEYBOARD) == DEVCLASS_KEYBOARD);
+	CHECK(DevTypeClass(DEVTYPE_JOYSTICK | 0x200) == DEVCLASS_GAMECTRL);
+	CHECK(DevTypeClass(DEVTYPE_1STPERSON) == DEVCLASS_GAMECTRL);
+	CHECK(DevTypeClass(0x11) == DEVCLASS_DEVICE);
+	CHECK(SnapshotFlags(EDFL_ATTACHEDONLY | EDFL_FORCEFEEDBACK | 0x10) == 0x10);
+}
+
+TEST(ReplayMatchesEnumeration)
+{
+	auto devices = MockDevices(12);
+	auto snapshot = Capture(devices);
+	CHECK(snapshot.size() == devices.size());
+
+	for (uint32_t filter : { DEVCLASS_ALL, DEVCLASS_DEVICE, DEVCLASS_POINTER, DEVCLASS_KEYBOARD, DEVCLASS_GAMECTRL,
+		DEVTYPE_JOYSTICK, 0x15u, DEVTYPE_1STPERSON })
+	{
+		for (uint32_t flags : { 0u, EDFL_ATTACHEDONLY, EDFL_FORCEFEEDBACK, EDFL_ATTACHEDONLY | EDFL_FORCEFEEDBACK })
+		{
+			std::vector<uint32_t> expected;
+			MockEnumDevices(devices, filter, flags, [&](const MockInstance& instance) { expected.push_back(instance.id); return true; });
+			CHECK(ReplayIds(snapshot, filter, flags) == expected);
+		}
+	}
+}
+
+TEST(ReplayStopsWhenAsked)
+{
+	auto snapshot = Capture(MockDevices(8));
+
+	size_t calls{ 0 };
+	auto complete = snapshot.Replay(DEVCLASS_ALL, 0, [&](const MockInstance&) { return ++calls < 3; });
+	CHECK(!complete);
+	CHECK(calls == 3);
+
+	CHECK(snapshot.Replay(DEVCLASS_KEYBOARD, 0, [](const MockInstance&) { return true; }));
+}
+
+TEST(UpdateCapsAfterCapture)
+{
+	auto devices = MockDevices(4);
+	DeviceSnapshot<MockInstance> snapshot;
+	for (auto& device : devices)
+		snapshot.Add(device);
+
+	CHECK(ReplayIds(snapshot, DEVCLASS_ALL, EDFL_ATTACHEDONLY).empty());
+
+	snapshot.UpdateCaps(MockCaps);
+	CHECK(ReplayIds(snapshot, DEVCLASS_ALL, EDFL_ATTACHEDONLY) == ReplayIds(Capture(devices), DEVCLASS_ALL, EDFL_ATTACHEDONLY));
+}
+
+TEST(StoreInsertAndClear)
+{
+	DeviceCache<MockInstance> cache;
+	CHECK(!cache.Read().Find(0));
+
+	cache.Store(0, Capture(MockDevices(2)));
+	CHECK(!cache.Insert(0, Capture(MockDevices(5))));
+	CHECK(cache.Insert(0x10, Capture(MockDevices(1))));
+
+	{
+		auto reader = cache.Read();
+		CHECK(reader.Find(0) && reader.Find(0)->size() == 4);
+		CHECK(reader.Find(0x10) && reader.Find(0x10)->size() == 3);
+		CHECK(reader.Snapshots().size() == 2);
+
+		// A reader keeps the map it started with, whatever's published since.
+		cache.Clear();
+		CHECK(reader.Find(0) != nullptr);
+	}
+
+	CHECK(cache.Read().Snapshots().empty());
+}
+
+TEST(ReplayVersusEnumerationBenchmark)
+{
+	auto devices = MockDevices(16);
+	DeviceCache<MockInstance> cache;
+	cache.Store(0, Capture(devices));
+
+	size_t enumerated{ 0 }, replayed{ 0 };
+	Benchmark("mock enumeration", 100'000, [&](size_t) {
+		MockEnumDevices(devices, DEVCLASS_GAMECTRL, EDFL_ATTACHEDONLY, [&](const MockInstance&) { ++enumerated; return true; });
+	});
+	Benchmark("cached replay", 100'000, [&](size_t) {
+		cache.Read().Find(0)->Replay(DEVCLASS_GAMECTRL, EDFL_ATTACHEDONLY, [&](const MockInstance&) { ++replayed; return true; });
+	});
+
+	CHECK(enumerated == replayed);
+}
@@ -0,0 +1,269 @@
+// DevicePool loans against a mock COM object, driven through the same steps
+// as the shim's CreateDevice, AddRef, QueryInterface and Release hooks.
+
+#include "Test.h"
+#include "DevicePool.h"
+
+#include <memory>
+#include <thread>
+
+namespace
+{
+	struct MockDevice
+	{
+		int refs{ 1 };
+		bool acquired{};
+		bool destroyed{};
+	};
+
+	// The real reference counting, which the hooks call through to.
+	struct MockOps
+	{
+		static void AddRef(MockDevice* device) { ++device->refs; }
+		static void Release(MockDevice* device) { RealRelease(device); }
+
+		static int RealRelease(MockDevice* device)
+		{
+			auto refs = --device->refs;
+			if (!refs)
+				device->destroyed = true;
+			return refs;
+		}
+	};
+
+	using Pool = DevicePool<MockDevice, MockOps>;
+
+	const uint8_t WHEEL_GUID[16]{ 0x10, 0x20 };
+	const uint8_t PEDALS_GUID[16]{ 0x30, 0x40 };
+	int s_dinput_a, s_dinput_w;		// stand-ins for the creating interfaces
+
+	DevicePoolKey Key(const uint8_t (&guid)[16], const void* creator = &s_dinput_a)
+	{
+		DevicePoolKey key{ {}, creator };
+		std::memcpy(key.instance_guid, guid, sizeof(key.instance_guid));
+		return key;
+	}
+
+	// The game's view of the device, through the hooked methods.
+	struct MockGame
+	{
+		explicit MockGame(Pool& pool) : pool(pool) {}
+
+		Pool& pool;
+		std::vector<std::unique_ptr<MockDevice>> created;
+
+		MockDevice* CreateDevice(const DevicePoolKey& key, const std::string& tag = "wheel")
+		{
+			if (auto device = pool.Lend(key))
+				return device;
+
+			created.push_back(std::make_unique<MockDevice>());
+			auto device = created.back().get();
+			pool.Add(key, device, tag);
+			return device;
+		}
+
+		void AddRef(MockDevice* device)
+		{
+			pool.AddLoanRef(device);
+			MockOps::AddRef(device);
+		}
+
+		void QueryInterface(MockDevice* device)
+		{
+			MockOps::AddRef(device);
+			pool.Forget(device);
+		}
+
+		int Release(MockDevice* device)
+		{
+			auto returning = pool.ReleaseLoanRef(device);
+			auto refs = MockOps::RealRelease(device);
+
+			if (refs && returning)
+			{
+				device->acquired = false;
+				pool.Return(device);
+			}
+
+			return refs;
+		}
+	};
+}
+
+TEST(ReturnedOnLastRelease)
+{
+	Pool pool;
+	MockGame game{ pool };
+
+	auto device = game.CreateDevice(Key(WHEEL_GUID));
+	CHECK(device->refs == 2);
+	CHECK(pool.Size() == 1);
+
+	device->acquired = true;
+	game.Release(device);
+	CHECK(device->refs == 1);
+	CHECK(!device->acquired && !device->destroyed);
+
+	// The same object comes back for the next request.
+	CHECK(game.CreateDevice(Key(WHEEL_GUID)) == device);
+	CHECK(game.created.size() == 1);
+	CHECK(device->refs == 2);
+}
+
+TEST(CountsReferencesTheGameAdds)
+{
+	Pool pool;
+	MockGame game{ pool };
+
+	auto device = game.CreateDevice(Key(WHEEL_GUID));
+	game.AddRef(device);
+	game.AddRef(device);
+
+	game.Release(device);
+	game.Release(device);
+	CHECK(pool.Lend(Key(WHEEL_GUID)) == nullptr);			// still on loan
+
+	game.Release(device);
+	CHECK(device->refs == 1);
+	CHECK(pool.Lend(Key(WHEEL_GUID)) == device);
+}
+
+TEST(OneLoanAtATime)
+{
+	Pool pool;
+	MockGame game{ pool };
+
+	auto first = game.CreateDevice(Key(WHEEL_GUID));
+	auto second = game.CreateDevice(Key(WHEEL_GUID));
+	CHECK(first != second);
+	CHECK(pool.Size() == 1);
+
+	// The second isn't pooled, so releasing it destroys it as usual.
+	CHECK(game.Release(second) == 0 && second->destroyed);
+	game.Release(first);
+	CHECK(first->refs == 1 && !first->destroyed);
+}
+
+TEST(KeyedByCreator)
+{
+	Pool pool;
+	MockGame game{ pool };
+
+	auto device = game.CreateDevice(Key(WHEEL_GUID, &s_dinput_a));
+	game.Release(device);
+
+	CHECK(pool.Lend(Key(WHEEL_GUID, &s_dinput_w)) == nullptr);
+	CHECK(pool.Lend(Key(PEDALS_GUID, &s_dinput_a)) == nullptr);
+	CHECK(pool.Lend(Key(WHEEL_GUID, &s_dinput_a)) == device);
+}
+
+TEST(QueriedDeviceIsForgotten)
+{
+	Pool pool;
+	MockGame game{ pool };
+
+	auto device = game.CreateDevice(Key(WHEEL_GUID));
+	game.QueryInterface(device);
+	CHECK(pool.Size() == 0);
+	CHECK(device->refs == 2);
+
+	// Released as any other object, through both interfaces.
+	game.Release(device);
+	CHECK(game.Release(device) == 0 && device->destroyed);
+}
+
+TEST(RemovedWhileIdle)
+{
+	Pool pool;
+	MockGame game{ pool };
+
+	auto wheel = game.CreateDevice(Key(WHEEL_GUID), "wheel");
+	auto pedals = game.CreateDevice(Key(PEDALS_GUID), "pedals");
+	game.Release(wheel);
+	game.Release(pedals);
+
+	pool.Remove("wheel");
+	CHECK(wheel->destroyed && !pedals->destroyed);
+	CHECK(pool.Size() == 1);
+}
+
+TEST(RemovedWhileLent)
+{
+	Pool pool;
+	MockGame game{ pool };
+
+	auto device = game.CreateDevice(Key(WHEEL_GUID), "wheel");
+	pool.Remove("wheel");
+	CHECK(!device->destroyed && device->refs == 1);
+
+	// The game's release is the last.
+	CHECK(game.Release(device) == 0 && device->destroyed);
+}
+
+TEST(FormatCheckedOncePerLoan)
+{
+	Pool pool;
+	MockGame game{ pool };
+	const std::vector<uint8_t> joystick{ 1, 2, 3 }, other{ 4 };
+
+	auto device = game.CreateDevice(Key(WHEEL_GUID));
+	CHECK(!pool.IsFormatSet(device, joystick));			// not lent, created
+	pool.SetFormat(device, joystick);
+	game.Release(device);
+
+	game.CreateDevice(Key(WHEEL_GUID));
+	CHECK(!pool.IsFormatSet(device, other));
+	game.Release(device);
+
+	game.CreateDevice(Key(WHEEL_GUID));
+	CHECK(pool.IsFormatSet(device, joystick));
+	CHECK(!pool.IsFormatSet(device, joystick));			// the game may have changed it since
+}
+
+TEST(ConcurrentLoans)
+{
+	// Threads borrowing and returning devices of their own, so the pool's map
+	// and lock are shared but each mock count is only touched by one thread.
+	constexpr int NUM_THREADS{ 4 };
+	constexpr int LOANS{ 20'000 };
+
+	Pool pool;
+	std::vector<MockDevice> devices(NUM_THREADS);
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < NUM_THREADS; ++i)
+	{
+		const uint8_t guid[16]{ static_cast<uint8_t>(i) };
+		auto key = Key(guid);
+		auto device = &devices[i];
+
+		// Created, then released by the game, leaving only the pool's reference.
+		pool.Add(key, device, "device");
+		CHECK(pool.ReleaseLoanRef(device));
+		MockOps::RealRelease(device);
+		pool.Return(device);
+
+		threads.emplace_back([&pool, key, device] {
+			for (int j = 0; j < LOANS; ++j)
+			{
+				if (pool.Lend(key) != device || !pool.ReleaseLoanRef(device))
+					continue;
+
+				MockOps::RealRelease(device);
+				pool.Return(device);
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	for (auto& device : devices)
+		CHECK(device.refs == 1 && !device.destroyed);
+
+	pool.Remove("device");
+	CHECK(pool.Size() == 0);
+	for (auto& device : devices)
+		CHECK(device.destroyed);
+}
@@ -0,0 +1,221 @@
+// Raw Input report parsing and scaling to DirectInput units, and the seqlock
+// that publishes the result, with benchmarks of the per-frame read path.
+
+#include "Test.h"
+#include "DeviceState.h"
+
+#include <climits>
+#include <mutex>
+
+namespace
+{
+	HidValue Axis(uint16_t usage, int32_t value, int32_t logical_min = 0, int32_t logical_max = 1023)
+	{
+		return HidValue{ HID_PAGE_GENERIC_DESKTOP, usage, value, logical_min, logical_max };
+	}
+
+	// A state whose every field derives from one counter, so a mixture of two
+	// writes is easy to spot.
+	JoyState Pattern(uint32_t n)
+	{
+		JoyState state{};
+		for (auto& axis : state.axes)
+			axis = static_cast<int32_t>(n);
+		for (auto& pov : state.povs)
+			pov = n;
+		for (auto& button : state.buttons)
+			button = static_cast<uint8_t>(n);
+
+		return state;
+	}
+
+	bool IsPattern(const JoyState& state)
+	{
+		auto expected = Pattern(static_cast<uint32_t>(state.axes[0]));
+		return !std::memcmp(&state, &expected, sizeof(state));
+	}
+}
+
+TEST(HatPositions)
+{
+	CHECK(HatToPov(0, 0, 7) == 0);
+	CHECK(HatToPov(2, 0, 7) == 9000);
+	CHECK(HatToPov(7, 0, 7) == 31500);
+	CHECK(HatToPov(8, 0, 7) == JOY_POV_CENTERED);			// null state
+	CHECK(HatToPov(1, 1, 8) == 0);
+	CHECK(HatToPov(0, 1, 8) == JOY_POV_CENTERED);
+	CHECK(HatToPov(3, 0, 3) == 27000);						// four-way hat
+	CHECK(HatToPov(0, 5, 5) == JOY_POV_CENTERED);			// bad range
+}
+
+TEST(AxisScaling)
+{
+	AxisRange range;
+	CHECK(ScaleAxis(0, 0, 1023, range) == 0);
+	CHECK(ScaleAxis(1023, 0, 1023, range) == 65535);
+	CHECK(ScaleAxis(-32768, -32768, 32767, range) == 0);
+	CHECK(ScaleAxis(32767, -32768, 32767, range) == 65535);
+	CHECK(ScaleAxis(2000, 0, 1023, range) == 65535);			// out of range clamps
+	CHECK(ScaleAxis(5, 10, 10, range) == 0);
+
+	AxisRange centred{ -1000, 1000 };
+	CHECK(ScaleAxis(511, 0, 1023, centred) == -1);
+	CHECK(ScaleAxis(512, 0, 1023, centred) == 1);
+
+	// Extreme logical ranges mustn't overflow.
+	AxisRange wide{ INT32_MIN, INT32_MAX };
+	CHECK(ScaleAxis(INT32_MAX - 1, INT32_MIN, INT32_MAX, wide) == INT32_MAX - 1);
+}
+
+TEST(ReportsMerge)
+{
+	HidJoyState hid;
+	ApplyHidReport(hid, { Axis(HID_USAGE_X, 512), Axis(HID_USAGE_X + 1, 0), Axis(HID_USAGE_HAT_SWITCH, 2, 0, 7),
+		Axis(HID_USAGE_SLIDER, 255, 0, 255) }, true, { 1, 3 });
+	CHECK(!hid.unsupported);
+	CHECK(hid.present == ((1u << 0) | (1u << 1) | (1u << 6)));
+
+	// A report without buttons leaves them as they were.
+	ApplyHidReport(hid, { Axis(HID_USAGE_X, 1023) }, false, {});
+
+	auto state = ToJoyState(hid, AxisRanges{});
+	CHECK(state.axes[0] == 65535);
+	CHECK(state.axes[1] == 0);
+	CHECK(state.axes[2] == 0);								// not present
+	CHECK(state.axes[6] == 65535);
+	CHECK(state.povs[0] == 9000 && state.povs[1] == JOY_POV_CENTERED);
+	CHECK(state.buttons[0] == 0x80 && state.buttons[1] == 0 && state.buttons[2] == 0x80);
+
+	// An empty button list in a report that has them releases them all.
+	ApplyHidReport(hid, {}, true, {});
+	CHECK(ToJoyState(hid, AxisRanges{}).buttons[0] == 0);
+}
+
+TEST(SlidersAndDials)
+{
+	HidJoyState hid;
+	ApplyHidReport(hid, { Axis(HID_USAGE_DIAL, 1), Axis(HID_USAGE_SLIDER, 2) }, false, {});
+	CHECK(!hid.unsupported);
+	CHECK(hid.values[6] == 1 && hid.values[7] == 2);
+
+	ApplyHidReport(hid, { Axis(HID_USAGE_SLIDER, 1), Axis(HID_USAGE_SLIDER, 2), Axis(HID_USAGE_SLIDER, 3) }, false, {});
+	CHECK(hid.unsupported);
+}
+
+TEST(UnsupportedReports)
+{
+	struct Case
+	{
+		std::vector<HidValue> values;
+		std::vector<uint16_t> buttons;
+	};
+
+	const Case cases[]{
+		{ { HidValue{ HID_PAGE_SIMULATION, 0xc8, 0, 0, 10 } }, {} },		// steering
+		{ { Axis(0x40, 0) }, {} },											// Vx
+		{ { Axis(HID_USAGE_HAT_SWITCH, 0), Axis(HID_USAGE_HAT_SWITCH, 0), Axis(HID_USAGE_HAT_SWITCH, 0),
+			Axis(HID_USAGE_HAT_SWITCH, 0), Axis(HID_USAGE_HAT_SWITCH, 0) }, {} },
+		{ {}, { 0 } },
+		{ {}, { JOY_BUTTONS + 1 } },
+	};
+
+	for (auto& test : cases)
+	{
+		HidJoyState hid;
+		ApplyHidReport(hid, test.values, !test.buttons.empty(), test.buttons);
+		CHECK(hid.unsupported);
+	}
+}
+
+TEST(StateComparison)
+{
+	AxisRanges ranges;
+	auto ours = Pattern(1000);
+	auto theirs = ours;
+
+	theirs.axes[0] -= 256;
+	CHECK(IsJoyStateMatch(ours, theirs, ranges));
+	theirs.axes[0] -= 2;
+	CHECK(!IsJoyStateMatch(ours, theirs, ranges));
+
+	theirs = ours;
+	theirs.povs[3] = JOY_POV_CENTERED;
+	CHECK(!IsJoyStateMatch(ours, theirs, ranges));
+
+	// DIJOYSTATE only has 32 buttons to compare.
+	theirs = ours;
+	theirs.buttons[40] ^= 0x80;
+	CHECK(!IsJoyStateMatch(ours, theirs, ranges));
+	CHECK(IsJoyStateMatch(ours, theirs, ranges, 32));
+}
+
+TEST(SeqlockEmptyUntilWritten)
+{
+	Seqlock<JoyState> seqlock;
+	JoyState state{};
+	CHECK(!seqlock.Read(state));
+
+	seqlock.Write(Pattern(7));
+	CHECK(seqlock.Read(state) && IsPattern(state) && state.axes[0] == 7);
+}
+
+TEST(SeqlockNeverTears)
+{
+	constexpr int NUM_READERS{ 3 };
+
+	Seqlock<JoyState> seqlock;
+	seqlock.Write(Pattern(1));
+
+	std::atomic<bool> done{ false };
+	std::atomic<uint64_t> reads{ 0 }, torn{ 0 }, backwards{ 0 };
+	std::vector<std::thread> readers;
+
+	for (int i = 0; i < NUM_READERS; ++i)
+	{
+		readers.emplace_back([&] {
+			uint32_t last{ 0 };
+			JoyState state;
+			while (!done)
+			{
+				if (!seqlock.Read(state))
+					continue;
+
+				auto n = static_cast<uint32_t>(state.axes[0]);
+				torn += !IsPattern(state);
+				backwards += n < last;
+				last = n;
+				++reads;
+			}
+		});
+	}
+
+	for (uint32_t n = 2; n < 200'000; ++n)
+		seqlock.Write(Pattern(n));
+
+	done = true;
+	for (auto& reader : readers)
+		reader.join();
+
+	CHECK(torn == 0);
+	CHECK(backwards == 0);
+	std::printf("  %llu reads during 200000 writes\n", static_cast<unsigned long long>(reads.load()));
+}
+
+TEST(ReadPathBenchmark)
+{
+	Seqlock<JoyState> seqlock;
+	seqlock.Write(Pattern(1));
+	std::mutex mutex;
+	auto shared = Pattern(1);
+
+	HidJoyState hid;
+	ApplyHidReport(hid, { Axis(HID_USAGE_X, 100), Axis(HID_USAGE_X + 1, 200), Axis(HID_USAGE_RZ, 300),
+		Axis(HID_USAGE_HAT_SWITCH, 4, 0, 7) }, true, { 1, 5, 9 });
+
+	JoyState state{};
+	uint64_t sum{ 0 };
+	Benchmark("seqlock read", 1'000'000, [&](size_t) { seqlock.Read(state); sum += state.axes[0]; });
+	Benchmark("mutex copy", 1'000'000, [&](size_t) { std::lock_guard<std::mutex> lock(mutex); state = shared; sum += state.axes[0]; });
+	Benchmark("convert", 1'000'000, [&](size_t) { state = ToJoyState(hid, AxisRanges{}); sum += state.axes[0]; });
+	CHECK(sum > 0);
+}
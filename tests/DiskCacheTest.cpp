@@ -0,0 +1,193 @@
+// DiskCache round trips, and fuzzing of the parser with damaged files. Most
+// mutations are given a fresh checksum, so they reach the parsing beyond it.
+
+#include "Test.h"
+#include "DiskCache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <random>
+
+namespace
+{
+	struct DiskInstance
+	{
+		uint32_t dwDevType;
+		uint8_t guid[16];
+		char name[32];
+	};
+
+	constexpr uint64_t DEVICE_HASH{ 0x1234'5678'9abc'def0ull };
+
+	SnapshotMap<DiskInstance> SampleSnapshots()
+	{
+		SnapshotMap<DiskInstance> snapshots;
+		for (uint32_t flags : { 0u, 0x10u })
+		{
+			DeviceSnapshot<DiskInstance> snapshot;
+			for (uint8_t i = 0; i < 3 + flags / 8; ++i)
+			{
+				DiskInstance instance{ DEVTYPE_JOYSTICK, { i, static_cast<uint8_t>(flags) }, "Wheel" };
+				snapshot.Add(instance, (i % 2) ? EDFL_ATTACHEDONLY : EDFL_FORCEFEEDBACK);
+			}
+
+			snapshots[flags] = std::make_shared<const DeviceSnapshot<DiskInstance>>(std::move(snapshot));
+		}
+
+		return snapshots;
+	}
+
+	void UpdateChecksum(std::vector<uint8_t>& data)
+	{
+		if (data.size() < sizeof(DiskCacheHeader))
+			return;
+
+		auto checksum = Fnv1a(data.data() + sizeof(DiskCacheHeader), data.size() - sizeof(DiskCacheHeader));
+		std::memcpy(data.data() + offsetof(DiskCacheHeader, checksum), &checksum, sizeof(checksum));
+	}
+
+	size_t TotalDevices(const SnapshotMap<DiskInstance>& snapshots)
+	{
+		size_t total{ 0 };
+		for (auto& snapshot : snapshots)
+			total += snapshot.second->size();
+
+		return total;
+	}
+}
+
+TEST(RoundTrip)
+{
+	auto snapshots = SampleSnapshots();
+	auto data = SerializeDiskCache(DEVICE_HASH, snapshots);
+
+	SnapshotMap<DiskInstance> loaded;
+	CHECK(ParseDiskCache(data, DEVICE_HASH, loaded));
+	CHECK(loaded.size() == snapshots.size());
+
+	for (auto& [flags, snapshot] : snapshots)
+	{
+		auto& other = loaded[flags];
+		CHECK(other && other->size() == snapshot->size());
+		for (size_t i = 0; other && i < snapshot->size(); ++i)
+		{
+			CHECK(!std::memcmp(&other->Devices()[i], &snapshot->Devices()[i], sizeof(DiskInstance)));
+			CHECK(other->Index()[i].caps == snapshot->Index()[i].caps);
+		}
+	}
+
+	CHECK(SerializeDiskCache(DEVICE_HASH, loaded) == data);
+}
+
+TEST(RejectsOtherDevicesAndBuilds)
+{
+	auto data = SerializeDiskCache(DEVICE_HASH, SampleSnapshots());
+	SnapshotMap<DiskInstance> loaded;
+	CHECK(!ParseDiskCache(data, DEVICE_HASH + 1, loaded));
+
+	struct OtherInstance { uint32_t dwDevType; };
+	SnapshotMap<OtherInstance> other;
+	CHECK(!ParseDiskCache(data, DEVICE_HASH, other));
+
+	auto version = data;
+	version[offsetof(DiskCacheHeader, version)]++;
+	UpdateChecksum(version);
+	CHECK(!ParseDiskCache(version, DEVICE_HASH, loaded));
+	CHECK(loaded.empty());
+}
+
+TEST(DevicePathHash)
+{
+	auto hash = HashDevicePaths({ R"(\\?\hid#vid_046d&pid_c24f)", R"(\\?\hid#vid_044f&pid_b65d)" });
+	CHECK(hash == HashDevicePaths({ R"(\\?\HID#VID_044F&PID_B65D)", R"(\\?\hid#vid_046d&pid_c24f)" }));
+	CHECK(hash != HashDevicePaths({ R"(\\?\hid#vid_046d&pid_c24f)" }));
+
+	// The terminators keep the boundaries between paths.
+	CHECK(HashDevicePaths({ "ab", "c" }) != HashDevicePaths({ "a", "bc" }));
+}
+
+TEST(EveryTruncationFails)
+{
+	auto data = SerializeDiskCache(DEVICE_HASH, SampleSnapshots());
+	for (size_t size = 0; size < data.size(); ++size)
+	{
+		std::vector<uint8_t> truncated(data.begin(), data.begin() + size);
+		UpdateChecksum(truncated);
+
+		SnapshotMap<DiskInstance> loaded;
+		CHECK(!ParseDiskCache(truncated, DEVICE_HASH, loaded));
+	}
+}
+
+TEST(OversizedCountsFail)
+{
+	// A snapshot claiming more devices than allowed, with none present.
+	auto data = SerializeDiskCache(DEVICE_HASH, SnapshotMap<DiskInstance>{});
+	DiskSnapshotHeader snapshot_header{ 0, MAX_DISK_CACHE_DEVICES + 1 };
+	data.insert(data.end(), reinterpret_cast<uint8_t*>(&snapshot_header), reinterpret_cast<uint8_t*>(&snapshot_header + 1));
+	data[offsetof(DiskCacheHeader, num_snapshots)] = 1;
+	UpdateChecksum(data);
+
+	SnapshotMap<DiskInstance> loaded;
+	CHECK(!ParseDiskCache(data, DEVICE_HASH, loaded));
+
+	// Header counts that don't match the data.
+	data = SerializeDiskCache(DEVICE_HASH, SampleSnapshots());
+	for (uint8_t num_snapshots : { 0, 1, 3, 255 })
+	{
+		auto changed = data;
+		changed[offsetof(DiskCacheHeader, num_snapshots)] = num_snapshots;
+		UpdateChecksum(changed);
+		CHECK(!ParseDiskCache(changed, DEVICE_HASH, loaded));
+	}
+}
+
+TEST(Fuzz)
+{
+	constexpr int ITERATIONS{ 50'000 };
+
+	auto original = SerializeDiskCache(DEVICE_HASH, SampleSnapshots());
+	std::mt19937 rng{ 12345 };
+	int parsed{ 0 };
+
+	for (int i = 0; i < ITERATIONS; ++i)
+	{
+		auto data = original;
+		auto mutations = 1 + rng() % 8;
+
+		for (uint32_t j = 0; j < mutations; ++j)
+		{
+			auto pos = rng() % data.size();
+			switch (rng() % 5)
+			{
+			case 0: data[pos] ^= static_cast<uint8_t>(1 << (rng() % 8)); break;
+			case 1: data[pos] = static_cast<uint8_t>(rng()); break;
+			case 2: data.resize(std::max<size_t>(pos, 1)); break;
+			case 3: data.insert(data.begin() + pos, static_cast<uint8_t>(rng())); break;
+			case 4: std::memset(data.data() + pos, 0xff, std::min<size_t>(4, data.size() - pos)); break;
+			}
+		}
+
+		// Leave the occasional checksum stale, so only changes to the unchecked
+		// parts of the header can parse.
+		auto stale = (i % 16) == 0;
+		if (!stale)
+			UpdateChecksum(data);
+
+		SnapshotMap<DiskInstance> loaded;
+		if (!ParseDiskCache(data, DEVICE_HASH, loaded))
+			continue;
+
+		++parsed;
+		CHECK(!stale || std::equal(data.begin() + sizeof(DiskCacheHeader), data.end(),
+			original.begin() + sizeof(DiskCacheHeader), original.end()));
+		CHECK(TotalDevices(loaded) <= MAX_DISK_CACHE_DEVICES);
+
+		// Whatever parses must survive another round trip unchanged.
+		SnapshotMap<DiskInstance> reloaded;
+		CHECK(ParseDiskCache(SerializeDiskCache(DEVICE_HASH, loaded), DEVICE_HASH, reloaded));
+		CHECK(TotalDevices(reloaded) == TotalDevices(loaded));
+	}
+
+	std::printf("  %d of %d mutations parsed\n", parsed, ITERATIONS);
+}
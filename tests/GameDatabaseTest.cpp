@@ -0,0 +1,201 @@
+// The game table shared by the shim and DirtFix.exe: version parsing and the
+// lookups made on it, and checks that neither binary keeps a copy of its own.
+
+#include "Test.h"
+#include "GameDatabase.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	std::string Lower(std::string_view s)
+	{
+		std::string lower(s);
+		std::transform(lower.begin(), lower.end(), lower.begin(),
+			[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return lower;
+	}
+
+	std::string ReadSource(const char* path)
+	{
+		std::ifstream file(std::string(DIRTFIX_SOURCE_DIR) + "/" + path);
+		std::stringstream text;
+		text << file.rdbuf();
+		return text.str();
+	}
+
+	// The string literals in a source file, skipping comments and character
+	// literals, which is enough to find a table copied into it.
+	std::vector<std::string> StringLiterals(const std::string& source)
+	{
+		std::vector<std::string> literals;
+		for (size_t i = 0; i < source.size(); ++i)
+		{
+			if (!source.compare(i, 2, "//"))
+				i = source.find('\n', i);
+			else if (!source.compare(i, 2, "/*"))
+				i = source.find("*/", i + 2) + 1;
+			else if (source[i] == '\'')
+				i = source.find('\'', i + 1 + (source[i + 1] == '\\') + 1);
+			else if (source[i] == '"')
+			{
+				std::string literal;
+				for (++i; i < source.size() && source[i] != '"'; ++i)
+				{
+					if (source[i] == '\\' && i + 1 < source.size())
+						literal += source[i++];
+					literal += source[i];
+				}
+				literals.push_back(literal);
+			}
+
+			if (i == std::string::npos)
+				break;
+		}
+
+		return literals;
+	}
+
+	// Every name the table holds, lower-cased, as a copy might spell them.
+	std::vector<std::string> TableNames()
+	{
+		std::vector<std::string> names;
+		for (auto dir : GAME_DIRS)
+			names.push_back(Lower(dir));
+		for (auto name : GAME_EXE_NAMES)
+			names.push_back(Lower(name));
+		for (auto& game : FIXED_GAMES)
+			names.push_back(Lower(game.product_name));
+
+		return names;
+	}
+}
+
+TEST(ParseVersionFormats)
+{
+	CHECK(ParseVersion("1, 10, 129, 1631") == MakeVersion(1, 10, 129, 1631));
+	CHECK(ParseVersion("1.10.129.1631") == MakeVersion(1, 10, 129, 1631));
+	CHECK(ParseVersion(" 1 , 2 ") == MakeVersion(1, 2, 0, 0));
+	CHECK(ParseVersion("65535.65535.65535.65535") == MakeVersion(65535, 65535, 65535, 65535));
+	CHECK(ParseVersion("0.0.0.1") == 1);
+}
+
+TEST(ParseVersionMissingFields)
+{
+	CHECK(ParseVersion("1") == MakeVersion(1, 0, 0, 0));
+	CHECK(ParseVersion("1.10") == MakeVersion(1, 10, 0, 0));
+	CHECK(ParseVersion("1..3") == MakeVersion(1, 0, 3, 0));
+	CHECK(ParseVersion(".5") == MakeVersion(0, 5, 0, 0));
+	CHECK(ParseVersion("1.2.3.4.5") == MakeVersion(1, 2, 3, 4));
+}
+
+TEST(ParseVersionMalformed)
+{
+	CHECK(ParseVersion("") == 0);
+	CHECK(ParseVersion("   ") == 0);
+	CHECK(ParseVersion("...") == 0);
+	CHECK(ParseVersion("v1.2") == 0);
+	CHECK(ParseVersion("1.2 beta") == MakeVersion(1, 2, 0, 0));		// stops at the text
+	CHECK(ParseVersion(std::string_view("1.2\0.3", 6)) == MakeVersion(1, 2, 0, 0));
+}
+
+TEST(ParseVersionOverflow)
+{
+	// Parts too large to be real aren't wrapped into plausible versions.
+	CHECK(ParseVersion("65536") == 0);
+	CHECK(ParseVersion("1.10.65665.0") == 0);						// would wrap to 1.10.129
+	CHECK(ParseVersion("1.2.3.99999999999999999999999") == 0);
+	CHECK(ParseVersion("00000000000000000000001.2") == MakeVersion(1, 2, 0, 0));
+}
+
+TEST(FixedVersionBoundaries)
+{
+	for (auto& game : FIXED_GAMES)
+	{
+		std::string name(game.product_name);
+		CHECK(!IsFixedVersion(name, game.fixed_version - 1));
+		CHECK(IsFixedVersion(name, game.fixed_version));
+		CHECK(IsFixedVersion(name, game.fixed_version + 1));
+		CHECK(IsFixedVersion(name, UINT64_MAX));		// DirtFix.exe's missing version
+		CHECK(!IsFixedVersion(name, 0));				// the shim's unreadable version
+
+		// Product names come from version resources, so are matched exactly.
+		CHECK(!IsFixedVersion(Lower(name), game.fixed_version));
+		CHECK(!IsFixedVersion(name + " ", game.fixed_version));
+		CHECK(IsSupportedProduct(name));
+	}
+
+	CHECK(!IsFixedVersion("DiRT Rally", UINT64_MAX));
+	CHECK(!IsFixedVersion("", UINT64_MAX));
+}
+
+TEST(KnownGameExeIgnoresCase)
+{
+	for (auto name : GAME_EXE_NAMES)
+	{
+		auto upper = Lower(name);
+		std::transform(upper.begin(), upper.end(), upper.begin(),
+			[](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+
+		CHECK(IsKnownGameExe(name));
+		CHECK(IsKnownGameExe(Lower(name)));
+		CHECK(IsKnownGameExe(upper));
+		CHECK(!IsKnownGameExe(std::string(name) + " "));
+		CHECK(!IsKnownGameExe("x" + std::string(name)));
+		CHECK(!IsKnownGameExe(name.substr(0, name.size() - 1)));
+	}
+
+	CHECK(!IsKnownGameExe(""));
+	CHECK(!IsKnownGameExe("DiRT Rally.exe"));
+}
+
+TEST(TableIsConsistent)
+{
+	CHECK(IsGameDatabaseValid());
+
+	// Names are compared ignoring case on Windows, so must differ by more.
+	auto names = TableNames();
+	auto exe_names = std::vector<std::string>(names.begin() + std::size(GAME_DIRS),
+		names.begin() + std::size(GAME_DIRS) + std::size(GAME_EXE_NAMES));
+	std::sort(exe_names.begin(), exe_names.end());
+	CHECK(std::adjacent_find(exe_names.begin(), exe_names.end()) == exe_names.end());
+
+	for (auto name : GAME_EXE_NAMES)
+		CHECK(name.size() > 4 && Lower(name.substr(name.size() - 4)) == ".exe");
+}
+
+TEST(BinariesShareTheTable)
+{
+	// Both binaries must take the games from the shared header, and neither
+	// may spell out a directory, executable or fixed product of its own.
+	const char* sources[]{ "dinput8/dinput8.cpp", "DirtFix/DirtFix.cpp" };
+	auto names = TableNames();
+
+	for (auto path : sources)
+	{
+		auto source = ReadSource(path);
+		CHECK(!source.empty());
+		CHECK(source.find("#include \"../Common/GameDatabase.h\"") != std::string::npos);
+
+		for (auto& literal : StringLiterals(source))
+		{
+			auto copied = std::find(names.begin(), names.end(), Lower(literal)) != names.end();
+			if (copied)
+				std::printf("  %s has its own \"%s\"\n", path, literal.c_str());
+			CHECK(!copied);
+		}
+	}
+
+	// And each uses the parts of it that it relies on.
+	auto shim = ReadSource("dinput8/dinput8.cpp");
+	CHECK(shim.find("IsFixedVersion(") != std::string::npos);
+	CHECK(shim.find("ParseVersion(") != std::string::npos);
+
+	auto tool = ReadSource("DirtFix/DirtFix.cpp");
+	for (auto use : { "GAME_DIRS", "IsKnownGameExe(", "IsSupportedProduct(", "IsFixedVersion(", "ParseVersion(" })
+		CHECK(tool.find(use) != std::string::npos);
+}
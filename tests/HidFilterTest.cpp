@@ -0,0 +1,130 @@
+// Table-driven checks of HID path parsing, ID lists and the invalidation
+// decision for the kinds of device that come and go during play.
+
+#include "Test.h"
+#include "HidFilter.h"
+
+namespace
+{
+	struct PathCase
+	{
+		const char* path;
+		bool has_ids;
+		uint16_t vid;
+		uint16_t pid;
+	};
+
+	const PathCase PATH_CASES[]{
+		{ R"(\\?\HID#VID_045E&PID_028E&IG_00#3&2a51c6a0&0&0000#{4d1e55b2-f16f-11cf-88cb-001111000030})", true, 0x045e, 0x028e },
+		{ R"(\\?\hid#vid_046d&pid_c24f#7&1b9e5ad4&0&0000#{4d1e55b2-f16f-11cf-88cb-001111000030})", true, 0x046d, 0xc24f },
+		{ R"(\\?\HID#{00001124-0000-1000-8000-00805f9b34fb}_VID&0002054c_PID&09cc&Col01#9&2bb1e06&0&0000#{4d1e55b2-f16f-11cf-88cb-001111000030})", true, 0x054c, 0x09cc },
+		{ R"(\\?\HID#VID_28DE&PID_2102&MI_00#8&f1d3bfc&0&0000#{4d1e55b2-f16f-11cf-88cb-001111000030})", true, 0x28de, 0x2102 },
+		{ R"(\\?\HID#VID_12G4&PID_0001#1#{4d1e55b2-f16f-11cf-88cb-001111000030})", false, 0, 0 },
+		{ R"(\\?\HID#VID_045E#1#{4d1e55b2-f16f-11cf-88cb-001111000030})", false, 0, 0 },
+		{ R"(\\?\HID#VID_045)", false, 0, 0 },
+		{ R"(\\?\HID#ConvertedDevice&Col01#5&2c9b0f4b&0&0000#{4d1e55b2-f16f-11cf-88cb-001111000030})", false, 0, 0 },
+		{ "", false, 0, 0 },
+	};
+
+	struct ListCase
+	{
+		const char* list;
+		std::vector<HidId> ids;
+	};
+
+	const ListCase LIST_CASES[]{
+		{ "", {} },
+		{ "046D:C29B", { { 0x046d, 0xc29b, false } } },
+		{ "046d:c29b, 28DE:*", { { 0x046d, 0xc29b, false }, { 0x28de, 0, true } } },
+		{ " 28 DE : 2102 ,,", { { 0x28de, 0x2102, false } } },
+		{ "046D:C29, 046D:C29BB, 46D:C29B, 046D-C29B, XYZW:0000, 045E:*x", {} },
+		{ "bad, 045E:028E", { { 0x045e, 0x028e, false } } },
+	};
+
+	HidDeviceInfo Present(uint16_t vid, uint16_t pid, uint16_t usage_page, uint16_t usage)
+	{
+		return HidDeviceInfo{ vid, pid, true, usage_page, usage, true };
+	}
+
+	HidDeviceInfo Removed(uint16_t vid, uint16_t pid)
+	{
+		return HidDeviceInfo{ vid, pid, true, 0, 0, false };
+	}
+
+	struct DecisionCase
+	{
+		const char* description;
+		HidDeviceInfo info;
+		bool invalidate;
+	};
+
+	const HidFilter VR_FILTER{ true, ParseHidIdList("046D:C29B"), ParseHidIdList("28DE:*, 046D:0A87") };
+
+	const DecisionCase DECISION_CASES[]{
+		{ "joystick", Present(0x044f, 0xb10a, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_JOYSTICK), true },
+		{ "gamepad", Present(0x045e, 0x028e, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GAMEPAD), true },
+		{ "multi-axis", Present(0x046d, 0xc626, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_MULTI_AXIS), true },
+		{ "simulation page", Present(0x0eb7, 0x0e04, HID_PAGE_SIMULATION, 0xc8), true },
+		{ "game page", Present(0x1234, 0x0001, HID_PAGE_GAME, 0x01), true },
+		{ "keyboard", Present(0x1532, 0x0203, HID_PAGE_GENERIC_DESKTOP, 0x06), false },
+		{ "headset consumer control", Present(0x1038, 0x12ad, 0x0c, 0x01), false },
+		{ "RGB vendor page", Present(0x1b1c, 0x1b2d, 0xff42, 0x01), false },
+		{ "denied vendor", Present(0x28de, 0x2300, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GAMEPAD), false },
+		{ "denied product", Present(0x046d, 0x0a87, 0x0c, 0x01), false },
+		{ "allowed despite usage", Present(0x046d, 0xc29b, 0xff00, 0x01), true },
+		{ "removed, usage unknown", Removed(0x1038, 0x12ad), true },
+		{ "removed, denied", Removed(0x28de, 0x2102), false },
+		{ "unidentified", HidDeviceInfo{}, true },
+	};
+}
+
+TEST(InterfacePaths)
+{
+	for (auto& test : PATH_CASES)
+	{
+		auto info = ParseHidInterfacePath(test.path);
+		CHECK(info.has_ids == test.has_ids);
+		CHECK(!test.has_ids || (info.vid == test.vid && info.pid == test.pid));
+		CHECK(!info.has_usage);
+	}
+}
+
+TEST(IdLists)
+{
+	for (auto& test : LIST_CASES)
+	{
+		auto ids = ParseHidIdList(test.list);
+		CHECK(ids.size() == test.ids.size());
+		for (size_t i = 0; i < ids.size() && i < test.ids.size(); ++i)
+		{
+			CHECK(ids[i].vid == test.ids[i].vid && ids[i].pid == test.ids[i].pid &&
+				ids[i].any_pid == test.ids[i].any_pid);
+		}
+	}
+}
+
+TEST(Decisions)
+{
+	for (auto& test : DECISION_CASES)
+	{
+		auto invalidate = ShouldInvalidate(VR_FILTER, test.info);
+		if (invalidate != test.invalidate)
+			std::printf("  %s\n", test.description);
+		CHECK(invalidate == test.invalidate);
+	}
+}
+
+TEST(DisabledAlwaysInvalidates)
+{
+	auto filter = VR_FILTER;
+	filter.enabled = false;
+
+	for (auto& test : DECISION_CASES)
+		CHECK(ShouldInvalidate(filter, test.info));
+}
+
+TEST(DenyBeatsAllow)
+{
+	HidFilter filter{ true, ParseHidIdList("28DE:2102"), ParseHidIdList("28DE:*") };
+	CHECK(!ShouldInvalidate(filter, Present(0x28de, 0x2102, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GAMEPAD)));
+}
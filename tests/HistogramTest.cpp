@@ -0,0 +1,111 @@
+// Histogram bucketing, its error bound, and percentiles of known samples.
+
+#include "Test.h"
+#include "Histogram.h"
+
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+namespace
+{
+	// Static so it starts zeroed, as it would in shared memory.
+	Histogram s_histogram;
+
+	void ResetHistogram()
+	{
+		for (auto& bucket : s_histogram.counts)
+			bucket = 0;
+		s_histogram.total_us = 0;
+	}
+}
+
+TEST(SmallValuesAreExact)
+{
+	for (uint32_t value = 0; value < HIST_SUB_COUNT; ++value)
+	{
+		CHECK(Histogram::BucketIndex(value) == static_cast<int>(value));
+		CHECK(Histogram::BucketValue(Histogram::BucketIndex(value)) == value);
+	}
+}
+
+TEST(BucketsCoverEveryValue)
+{
+	CHECK(Histogram::BucketIndex(UINT32_MAX) == HIST_BUCKETS - 1);
+	CHECK(Histogram::BucketValue(HIST_BUCKETS - 1) == UINT32_MAX);
+
+	// Each bucket starts just after the previous one ends.
+	for (int index = 1; index < HIST_BUCKETS; ++index)
+	{
+		auto first = Histogram::BucketValue(index - 1) + 1;
+		CHECK(Histogram::BucketIndex(first) == index);
+		CHECK(Histogram::BucketIndex(Histogram::BucketValue(index)) == index);
+	}
+}
+
+TEST(ErrorWithinSixteenth)
+{
+	for (uint64_t value = 1; value <= UINT32_MAX; value = value * 3 / 2 + 1)
+	{
+		auto bucket_value = Histogram::BucketValue(Histogram::BucketIndex(static_cast<uint32_t>(value)));
+		CHECK(bucket_value >= value);
+		CHECK(bucket_value - value <= value / HIST_SUB_COUNT);
+	}
+}
+
+TEST(PercentilesOfUniformSamples)
+{
+	ResetHistogram();
+	CHECK(s_histogram.Percentile(50) == 0);
+
+	for (uint32_t value = 1; value <= 1000; ++value)
+		s_histogram.Record(value);
+
+	CHECK(s_histogram.Count() == 1000);
+	CHECK(s_histogram.total_us == 500500);
+
+	for (auto [percent, expected] : { std::pair{ 50.0, 500u }, { 90.0, 900u }, { 99.0, 990u }, { 100.0, 1000u } })
+	{
+		auto value = s_histogram.Percentile(percent);
+		CHECK(value >= expected && value - expected <= expected / HIST_SUB_COUNT);
+	}
+}
+
+TEST(PercentileOfOutlier)
+{
+	ResetHistogram();
+	for (int i = 0; i < 999; ++i)
+		s_histogram.Record(100);
+	s_histogram.Record(1'000'000);
+
+	CHECK(s_histogram.Percentile(99) == Histogram::BucketValue(Histogram::BucketIndex(100)));
+	CHECK(s_histogram.Percentile(100) == Histogram::BucketValue(Histogram::BucketIndex(1'000'000)));
+}
+
+TEST(ConcurrentRecording)
+{
+	constexpr int NUM_THREADS{ 4 };
+	constexpr uint32_t SAMPLES{ 100'000 };
+
+	ResetHistogram();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < NUM_THREADS; ++i)
+	{
+		threads.emplace_back([] {
+			for (uint32_t value = 0; value < SAMPLES; ++value)
+				s_histogram.Record(value % 5000);
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	CHECK(s_histogram.Count() == NUM_THREADS * SAMPLES);
+}
+
+TEST(RecordBenchmark)
+{
+	ResetHistogram();
+	Benchmark("Record", 1'000'000, [](size_t i) { s_histogram.Record(static_cast<uint32_t>(i * 2654435761u)); });
+	Benchmark("Percentile", 10'000, [](size_t) { s_histogram.Percentile(99); });
+}
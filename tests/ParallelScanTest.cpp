@@ -0,0 +1,270 @@
+// ParallelScan ordering, bounds and abandonment, with a benchmark over a
+// synthetic tree of volumes whose tasks each take a while, like a disk seek.
+
+#include "Test.h"
+#include "ParallelScan.h"
+
+#include <stdexcept>
+
+using namespace std::chrono_literals;
+
+namespace
+{
+	// Blocks tasks until opened, like a drive that has stopped responding.
+	class Gate
+	{
+	public:
+		void Wait()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [&] { return m_open; });
+		}
+
+		void Open()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_open = true;
+			m_cv.notify_all();
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		bool m_open{ false };
+	};
+
+	// Tracks how many tasks are running at once, overall and per volume.
+	struct Concurrency
+	{
+		std::mutex mutex;
+		std::map<std::string, int> running;
+		int total{ 0 };
+		int max_total{ 0 };
+		int max_per_volume{ 0 };
+
+		void Enter(const std::string& volume)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			max_total = std::max(max_total, ++total);
+			max_per_volume = std::max(max_per_volume, ++running[volume]);
+		}
+
+		void Leave(const std::string& volume)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			--total;
+			--running[volume];
+		}
+	};
+
+	// Threads abandoned by one test mustn't count against the next.
+	bool WaitForAbandonedThreads()
+	{
+		auto deadline = std::chrono::steady_clock::now() + 5s;
+		while (g_abandonedScanThreads && std::chrono::steady_clock::now() < deadline)
+			std::this_thread::sleep_for(1ms);
+
+		return g_abandonedScanThreads == 0;
+	}
+
+	std::string Volume(size_t i)
+	{
+		return std::string(1, static_cast<char>('c' + i % 24)) + ":";
+	}
+}
+
+TEST(ResultsInAddOrder)
+{
+	ParallelScan<size_t> scan;
+	for (size_t i = 0; i < 40; ++i)
+	{
+		scan.Add(Volume(i % 5), [i] {
+			std::this_thread::sleep_for(std::chrono::microseconds((40 - i) * 20));
+			return i;
+		});
+	}
+
+	CHECK(scan.Size() == 40);
+	auto results = scan.Run(10s);
+	CHECK(scan.Size() == 0);
+	CHECK(results.size() == 40);
+
+	for (size_t i = 0; i < results.size(); ++i)
+		CHECK(results[i] && *results[i] == i);
+}
+
+TEST(VolumesRunSeriallyOnBoundedThreads)
+{
+	Concurrency concurrency;
+	ParallelScan<bool> scan;
+
+	for (size_t i = 0; i < 3 * SCAN_MAX_THREADS * 4; ++i)
+	{
+		auto volume = Volume(i % (3 * SCAN_MAX_THREADS));
+		scan.Add(volume, [&, volume] {
+			concurrency.Enter(volume);
+			std::this_thread::sleep_for(1ms);
+			concurrency.Leave(volume);
+			return true;
+		});
+	}
+
+	auto results = scan.Run(10s);
+	CHECK(std::all_of(results.begin(), results.end(), [](auto& result) { return result.has_value(); }));
+	CHECK(concurrency.max_per_volume == 1);
+	CHECK(concurrency.max_total > 1);
+	CHECK(concurrency.max_total <= static_cast<int>(SCAN_MAX_THREADS));
+}
+
+TEST(ProgressIsSerialised)
+{
+	std::vector<size_t> finished;
+	std::atomic<int> in_progress{ 0 };
+	auto overlapped = false;
+
+	ParallelScan<int> scan;
+	for (int i = 0; i < 30; ++i)
+		scan.Add(Volume(i), [i] { return i; });
+
+	auto results = scan.Run(10s, [&](size_t count, const std::optional<int>& result) {
+		overlapped |= ++in_progress > 1;
+		finished.push_back(count);
+		CHECK(result.has_value());
+		--in_progress;
+	});
+
+	CHECK(!overlapped);
+	CHECK(finished.size() == 30);
+	for (size_t i = 0; i < finished.size(); ++i)
+		CHECK(finished[i] == i + 1);
+}
+
+TEST(FailedTasksHaveNoResult)
+{
+	ParallelScan<int> scan;
+	scan.Add("c:", [] { return 1; });
+	scan.Add("c:", []() -> int { throw std::runtime_error("access denied"); });
+	scan.Add("d:", [] { return 3; });
+
+	auto results = scan.Run(10s);
+	CHECK(results[0] == 1);
+	CHECK(!results[1]);
+	CHECK(results[2] == 3);
+}
+
+TEST(SlowVolumeIsAbandoned)
+{
+	Gate gate;
+	std::atomic<bool> saw_abandoned{ false };
+	std::atomic<int> later_tasks{ 0 };
+	std::vector<size_t> progress;
+
+	{
+		ParallelScan<int> scan;
+		scan.Add("c:", [] { return 1; });
+		scan.Add("z:", [&] {
+			gate.Wait();
+			saw_abandoned = IsScanAbandoned();
+			return 2;
+		});
+		scan.Add("z:", [&] { ++later_tasks; return 3; });
+
+		auto start = std::chrono::steady_clock::now();
+		auto results = scan.Run(100ms, [&](size_t finished, const std::optional<int>&) { progress.push_back(finished); });
+		auto elapsed = std::chrono::steady_clock::now() - start;
+
+		CHECK(elapsed < 5s);
+		CHECK(results[0] == 1 && !results[1] && !results[2]);
+		CHECK(g_abandonedScanThreads == 1);
+	}
+
+	// The drive wakes up after the scan has gone: nothing more is reported,
+	// and the rest of its tasks are skipped.
+	gate.Open();
+	CHECK(WaitForAbandonedThreads());
+	CHECK(saw_abandoned);
+	CHECK(later_tasks == 0);
+	CHECK(progress.size() == 1);
+}
+
+TEST(AbandonedThreadsLimitLaterScans)
+{
+	Gate gate;
+	{
+		ParallelScan<int> scan;
+		for (size_t i = 0; i < SCAN_MAX_THREADS + 2; ++i)
+			scan.Add(Volume(i), [&] { gate.Wait(); return 1; });
+
+		scan.Run(50ms);
+		CHECK(g_abandonedScanThreads == SCAN_MAX_THREADS);
+	}
+
+	// No threads are free, so a scan now finds nothing rather than adding more.
+	std::atomic<bool> ran{ false };
+	{
+		ParallelScan<int> scan;
+		scan.Add("c:", [&] { ran = true; return 1; });
+		auto results = scan.Run(50ms);
+		CHECK(!results[0]);
+	}
+
+	gate.Open();
+	CHECK(WaitForAbandonedThreads());
+	CHECK(!ran);
+
+	ParallelScan<int> scan;
+	scan.Add("c:", [] { return 1; });
+	CHECK(scan.Run(10s)[0] == 1);
+}
+
+TEST(CancelStopsWaiting)
+{
+	Gate gate;
+	std::atomic<bool> cancel{ false };
+	{
+		ParallelScan<int> scan;
+		scan.Add("c:", [] { return 1; });
+		scan.Add("z:", [&] { gate.Wait(); return 2; });
+
+		std::thread canceller([&] { std::this_thread::sleep_for(20ms); cancel = true; });
+		auto start = std::chrono::steady_clock::now();
+		auto results = scan.Run(60s, nullptr, &cancel);
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		canceller.join();
+
+		CHECK(elapsed < 10s);
+		CHECK(results[0] == 1 && !results[1]);
+	}
+
+	gate.Open();
+	CHECK(WaitForAbandonedThreads());
+}
+
+TEST(SyntheticTreeBenchmark)
+{
+	// Each volume holds game directories that take a couple of ms to check.
+	constexpr size_t NUM_VOLUMES{ 6 };
+	constexpr size_t DIRS_PER_VOLUME{ 10 };
+	constexpr auto CHECK_TIME{ 2ms };
+
+	auto check_dir = [&](size_t i) { std::this_thread::sleep_for(CHECK_TIME); return i; };
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < NUM_VOLUMES * DIRS_PER_VOLUME; ++i)
+		check_dir(i);
+	auto serial = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+	ParallelScan<size_t> scan;
+	for (size_t i = 0; i < NUM_VOLUMES * DIRS_PER_VOLUME; ++i)
+		scan.Add(Volume(i % NUM_VOLUMES), [&, i] { return check_dir(i); });
+
+	start = std::chrono::steady_clock::now();
+	auto results = scan.Run(60s);
+	auto parallel = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+	for (size_t i = 0; i < results.size(); ++i)
+		CHECK(results[i] == i);
+
+	std::printf("  %zu volumes of %zu dirs: serial %.1fms, parallel %.1fms\n",
+		NUM_VOLUMES, DIRS_PER_VOLUME, serial.count(), parallel.count());
+}
@@ -0,0 +1,506 @@
+// PeFile against fixture images built in memory, with version resources and
+// imports laid out as linkers write them, and against malformed variants.
+
+#include "Test.h"
+#include "PeFile.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct StringTable
+	{
+		std::string name;			// such as "080904b0"
+		std::u16string product_name;
+		std::u16string product_version;
+	};
+
+	struct Fixture
+	{
+		bool pe32plus{ true };
+		uint16_t machine{ PE_MACHINE_AMD64 };
+		std::vector<std::string> imports;
+		std::vector<std::string> delay_imports;
+		bool has_version{ true };
+		uint16_t language{ 0x0809 };
+		uint16_t code_page{ 0x04b0 };
+		std::vector<StringTable> tables{ { "080904b0", u"Test Game", u"1.2.3.4" } };
+	};
+
+	// Where the builder put things, for tests that damage them.
+	struct Layout
+	{
+		size_t optional_header{};
+		size_t section_header{};
+		size_t resource{};
+		size_t version{};
+		size_t import_table{};
+	};
+
+	constexpr uint32_t SECTION_RVA{ 0x1000 };
+	constexpr size_t SECTION_OFFSET{ 0x200 };
+
+	class Bytes
+	{
+	public:
+		std::vector<uint8_t> data;
+
+		size_t Align(size_t alignment)
+		{
+			data.resize((data.size() + alignment - 1) / alignment * alignment);
+			return data.size();
+		}
+
+		template <typename T>
+		size_t Append(T value)
+		{
+			auto offset = data.size();
+			data.resize(offset + sizeof(T));
+			std::memcpy(data.data() + offset, &value, sizeof(T));
+			return offset;
+		}
+
+		size_t Append(const std::string& s)
+		{
+			auto offset = data.size();
+			data.insert(data.end(), s.begin(), s.end());
+			data.push_back(0);
+			return offset;
+		}
+
+		size_t Append(const std::u16string& s)
+		{
+			auto offset = data.size();
+			for (auto c : s)
+				Append(static_cast<uint16_t>(c));
+			Append(uint16_t{ 0 });
+			return offset;
+		}
+
+		void Append(const std::vector<uint8_t>& bytes) { data.insert(data.end(), bytes.begin(), bytes.end()); }
+
+		template <typename T>
+		void Put(size_t offset, T value) { std::memcpy(data.data() + offset, &value, sizeof(T)); }
+	};
+
+	// A version resource block: length, value length, type, key, then the
+	// value and children, each aligned to 4 bytes.
+	std::vector<uint8_t> VersionBlock(const std::u16string& key, const std::vector<uint8_t>& value,
+		uint16_t value_length, uint16_t type, const std::vector<std::vector<uint8_t>>& children = {})
+	{
+		Bytes block;
+		block.Append(uint16_t{ 0 });
+		block.Append(value_length);
+		block.Append(type);
+		block.Append(key);
+		block.Align(4);
+		block.Append(value);
+
+		for (auto& child : children)
+		{
+			block.Align(4);
+			block.Append(child);
+		}
+
+		block.Put(0, static_cast<uint16_t>(block.data.size()));
+		return block.data;
+	}
+
+	std::vector<uint8_t> TextValue(const std::u16string& s)
+	{
+		Bytes value;
+		value.Append(s);
+		return value.data;
+	}
+
+	std::vector<uint8_t> VersionResource(const Fixture& fixture)
+	{
+		std::vector<std::vector<uint8_t>> tables;
+		for (auto& table : fixture.tables)
+		{
+			std::vector<std::vector<uint8_t>> strings{
+				VersionBlock(u"CompanyName", TextValue(u"Test"), 5, 1),
+				VersionBlock(u"ProductName", TextValue(table.product_name), static_cast<uint16_t>(table.product_name.size() + 1), 1),
+				VersionBlock(u"ProductVersion", TextValue(table.product_version), static_cast<uint16_t>(table.product_version.size() + 1), 1),
+			};
+
+			tables.push_back(VersionBlock(std::u16string(table.name.begin(), table.name.end()), {}, 0, 1, strings));
+		}
+
+		Bytes translation;
+		translation.Append(fixture.language);
+		translation.Append(fixture.code_page);
+
+		std::vector<uint8_t> fixed_info(52);
+		fixed_info[0] = 0xbd, fixed_info[1] = 0x04, fixed_info[2] = 0xef, fixed_info[3] = 0xfe;		// VS_FFI_SIGNATURE
+
+		return VersionBlock(u"VS_VERSION_INFO", fixed_info, 52, 0, {
+			VersionBlock(u"StringFileInfo", {}, 0, 1, tables),
+			VersionBlock(u"VarFileInfo", {}, 0, 1, { VersionBlock(u"Translation", translation.data, 4, 0) }),
+		});
+	}
+
+	// Append a resource directory with a single entry, returning its offset.
+	size_t ResourceDirectory(Bytes& section, uint32_t id, uint32_t target)
+	{
+		auto offset = section.Append(uint32_t{ 0 });
+		section.Append(uint32_t{ 0 });
+		section.Append(uint32_t{ 0 });
+		section.Append(uint16_t{ 0 });			// named entries
+		section.Append(uint16_t{ 1 });			// ID entries
+		section.Append(id);
+		section.Append(target);
+		return offset;
+	}
+
+	std::vector<uint8_t> BuildPe(const Fixture& fixture, Layout* layout = nullptr)
+	{
+		Layout local;
+		auto& where = layout ? *layout : local;
+		Bytes section;
+		uint32_t import_rva{}, delay_import_rva{}, resource_rva{};
+
+		auto rva = [](size_t offset) { return static_cast<uint32_t>(SECTION_RVA + offset); };
+
+		if (!fixture.imports.empty())
+		{
+			std::vector<size_t> names;
+			for (auto& dll : fixture.imports)
+				names.push_back(section.Append(dll));
+
+			import_rva = rva(section.Align(4));
+			where.import_table = SECTION_OFFSET + section.data.size();
+			for (auto name : names)
+			{
+				section.Append(uint32_t{ 0 });				// import lookup table
+				section.Append(uint32_t{ 0 });
+				section.Append(uint32_t{ 0 });
+				section.Append(rva(name));
+				section.Append(uint32_t{ 0 });				// import address table
+			}
+			section.data.resize(section.data.size() + 20);
+		}
+
+		if (!fixture.delay_imports.empty())
+		{
+			std::vector<size_t> names;
+			for (auto& dll : fixture.delay_imports)
+				names.push_back(section.Append(dll));
+
+			delay_import_rva = rva(section.Align(4));
+			for (auto name : names)
+			{
+				section.Append(uint32_t{ 1 });				// RVA-based attributes
+				section.Append(rva(name));
+				section.data.resize(section.data.size() + 24);
+			}
+			section.data.resize(section.data.size() + 32);
+		}
+
+		if (fixture.has_version)
+		{
+			// Type, name and language directories, as resource compilers write.
+			auto root = section.Align(4);
+			resource_rva = rva(root);
+			where.resource = SECTION_OFFSET + root;
+
+			auto type_dir = ResourceDirectory(section, pe_detail::RT_VERSION_ID, 0);
+			auto name_dir = ResourceDirectory(section, 1, 0);
+			auto lang_dir = ResourceDirectory(section, fixture.language, 0);
+			auto data_entry = section.Append(uint32_t{ 0 });
+			section.Append(uint32_t{ 0 });
+			section.Append(uint32_t{ 0 });
+			section.Append(uint32_t{ 0 });
+
+			auto version = VersionResource(fixture);
+			auto version_offset = section.Align(4);
+			where.version = SECTION_OFFSET + version_offset;
+			section.Append(version);
+
+			section.Put(type_dir + 20, static_cast<uint32_t>(pe_detail::RESOURCE_SUBDIR | (name_dir - root)));
+			section.Put(name_dir + 20, static_cast<uint32_t>(pe_detail::RESOURCE_SUBDIR | (lang_dir - root)));
+			section.Put(lang_dir + 20, static_cast<uint32_t>(data_entry - root));
+			section.Put(data_entry, rva(version_offset));
+			section.Put(data_entry + 4, static_cast<uint32_t>(version.size()));
+		}
+
+		auto section_size = static_cast<uint32_t>(section.Align(0x200));
+
+		Bytes image;
+		image.data.resize(SECTION_OFFSET);
+		image.Put(0, uint16_t{ 0x5a4d });					// MZ
+		image.Put(0x3c, uint32_t{ 0x80 });
+		image.Put(0x80, uint32_t{ 0x4550 });				// PE\0\0
+
+		uint16_t optional_size = fixture.pe32plus ? 240 : 224;
+		image.Put(0x84, fixture.machine);
+		image.Put(0x86, uint16_t{ 1 });
+		image.Put(0x94, optional_size);
+
+		auto optional_header = where.optional_header = 0x98;
+		auto directories = optional_header + (fixture.pe32plus ? 112 : 96);
+		image.Put(optional_header, uint16_t{ fixture.pe32plus ? uint16_t{ 0x20b } : uint16_t{ 0x10b } });
+		image.Put(directories - 4, uint32_t{ 16 });
+
+		auto put_directory = [&](uint32_t index, uint32_t directory_rva) {
+			image.Put(directories + index * 8, directory_rva);
+			image.Put(directories + index * 8 + 4, directory_rva ? section_size : 0);
+		};
+
+		put_directory(pe_detail::DIRECTORY_IMPORT, import_rva);
+		put_directory(pe_detail::DIRECTORY_RESOURCE, resource_rva);
+		put_directory(pe_detail::DIRECTORY_DELAY_IMPORT, delay_import_rva);
+
+		auto section_header = where.section_header = optional_header + optional_size;
+		std::memcpy(image.data.data() + section_header, ".rdata", 6);
+		image.Put(section_header + 8, section_size);
+		image.Put(section_header + 12, SECTION_RVA);
+		image.Put(section_header + 16, section_size);
+		image.Put(section_header + 20, static_cast<uint32_t>(SECTION_OFFSET));
+
+		image.Append(section.data);
+		return image.data;
+	}
+
+	bool Parse(const std::vector<uint8_t>& data, PeInfo& info)
+	{
+		return ParsePeFile(data.data(), data.size(), info);
+	}
+}
+
+static_assert(NotedImportBit("xinput1_3.dll") == 1 && NotedImportBit("XInput1_4.DLL") == 2 &&
+	NotedImportBit("XINPUT9_1_0.DLL") == 4 && NotedImportBit("xinput1_4.dl") == 0 &&
+	NotedImportBit("kernel32.dll") == 0, "noted imports must match case-insensitively");
+
+TEST(GameFixtures)
+{
+	for (auto pe32plus : { true, false })
+	{
+		Fixture fixture;
+		fixture.pe32plus = pe32plus;
+		fixture.machine = pe32plus ? PE_MACHINE_AMD64 : PE_MACHINE_I386;
+
+		PeInfo info;
+		CHECK(Parse(BuildPe(fixture), info));
+		CHECK(info.machine == fixture.machine);
+		CHECK(info.has_product_name && std::string(info.product_name) == "Test Game");
+		CHECK(info.has_product_version && std::string(info.product_version) == "1.2.3.4");
+		CHECK(info.imports == 0);
+	}
+}
+
+TEST(WithoutVersion)
+{
+	Fixture fixture;
+	fixture.has_version = false;
+
+	PeInfo info;
+	CHECK(Parse(BuildPe(fixture), info));
+	CHECK(info.machine == PE_MACHINE_AMD64);
+	CHECK(!info.has_product_name && !info.has_product_version);
+}
+
+TEST(TranslationSelectsTable)
+{
+	Fixture fixture;
+	fixture.language = 0x0409;
+	fixture.tables = {
+		{ "080904b0", u"British Name", u"1.0" },
+		{ "040904B0", u"American Name", u"2.0" },		// table names ignore case
+	};
+
+	PeInfo info;
+	CHECK(Parse(BuildPe(fixture), info));
+	CHECK(std::string(info.product_name) == "American Name");
+	CHECK(std::string(info.product_version) == "2.0");
+
+	// No table for the translation, so no strings.
+	fixture.code_page = 0x04e4;
+	CHECK(Parse(BuildPe(fixture), info));
+	CHECK(!info.has_product_name);
+}
+
+TEST(ProductNameText)
+{
+	Fixture fixture;
+	fixture.tables[0].product_name = u"DiRT® Rally";
+	fixture.tables[0].product_version = std::u16string(200, u'9');
+
+	PeInfo info;
+	CHECK(Parse(BuildPe(fixture), info));
+	CHECK(std::string(info.product_name) == "DiRT? Rally");
+	CHECK(std::string(info.product_version) == std::string(sizeof(info.product_version) - 1, '9'));
+}
+
+TEST(Imports)
+{
+	Fixture fixture;
+	fixture.imports = { "KERNEL32.dll", "XInput1_4.dll", "USER32.dll" };
+	fixture.delay_imports = { "xinput9_1_0.DLL" };
+
+	PeInfo info;
+	CHECK(Parse(BuildPe(fixture), info));
+	CHECK(info.imports == (NotedImportBit("xinput1_4.dll") | NotedImportBit("xinput9_1_0.dll")));
+	CHECK(info.has_product_name);
+
+	fixture.imports = { "xinput1_3.dll" };
+	fixture.delay_imports.clear();
+	fixture.pe32plus = false;
+	CHECK(Parse(BuildPe(fixture), info));
+	CHECK(info.imports == NotedImportBit("xinput1_3.dll"));
+}
+
+TEST(NotPeFiles)
+{
+	const std::vector<std::vector<uint8_t>> files{
+		{},
+		{ 'M', 'Z' },
+		std::vector<uint8_t>(0x400, 0),
+		[] { auto data = BuildPe(Fixture{}); data[0] = 'Z'; return data; }(),
+		[] { auto data = BuildPe(Fixture{}); data[0x80] = 'N'; return data; }(),
+		[] { auto data = BuildPe(Fixture{}); std::memcpy(&data[0x3c], "\xf0\xff\xff\xff", 4); return data; }(),
+	};
+
+	for (auto& file : files)
+	{
+		PeInfo info;
+		CHECK(!Parse(file, info));
+	}
+}
+
+TEST(DamagedStructures)
+{
+	Layout layout;
+	auto original = BuildPe(Fixture{}, &layout);
+
+	struct Damage
+	{
+		const char* description;
+		size_t offset;
+		uint32_t value;
+	};
+
+	const Damage damages[]{
+		{ "optional header magic", layout.optional_header, 0x0107 },
+		{ "directory count", layout.optional_header + 108, 2 },
+		{ "resource directory past the end", layout.optional_header + 112 + 16, 0x7fff'0000 },
+		{ "section past the end", layout.section_header + 20, 0x7fff'0000 },
+		{ "section raw size", layout.section_header + 16, 0x10 },
+		{ "type entry pointing at itself", layout.resource + 20, pe_detail::RESOURCE_SUBDIR },
+		{ "type entry without subdirectory", layout.resource + 20, 0x18 },
+		{ "entry count", layout.resource + 14, 0xffff },
+		{ "version length", layout.version, 0xffff },
+		{ "version length too small", layout.version, 4 },
+		{ "version key", layout.version + 6, 'X' },
+	};
+
+	for (auto& damage : damages)
+	{
+		auto data = original;
+		std::memcpy(&data[damage.offset], &damage.value, sizeof(damage.value));
+
+		// Still a PE file, but the product name can't be found.
+		PeInfo info;
+		auto parsed = Parse(data, info);
+		if (!parsed || info.has_product_name)
+			std::printf("  %s\n", damage.description);
+		CHECK(parsed && !info.has_product_name);
+	}
+}
+
+TEST(UnterminatedImports)
+{
+	Fixture fixture;
+	fixture.imports = { "xinput1_4.dll" };
+	fixture.has_version = false;
+
+	Layout layout;
+	auto data = BuildPe(fixture, &layout);
+
+	// Fill the terminating descriptor and beyond, so the table runs to the end.
+	std::fill(data.begin() + layout.import_table + 20, data.end(), uint8_t{ 0x10 });
+	PeInfo info;
+	CHECK(Parse(data, info));
+	CHECK(info.imports == NotedImportBit("xinput1_4.dll"));
+
+	// A name running off the end of the file is ignored.
+	std::fill(data.begin() + SECTION_OFFSET, data.begin() + layout.import_table, uint8_t{ 'x' });
+	CHECK(Parse(data, info));
+	CHECK(info.imports == 0);
+}
+
+TEST(EveryTruncation)
+{
+	Fixture fixture;
+	fixture.imports = { "xinput1_3.dll" };
+	fixture.delay_imports = { "xinput1_4.dll" };
+	auto data = BuildPe(fixture);
+
+	PeInfo full;
+	CHECK(Parse(data, full));
+
+	for (size_t size = 0; size < data.size(); ++size)
+	{
+		PeInfo info;
+		std::vector<uint8_t> truncated(data.begin(), data.begin() + size);
+		auto parsed = Parse(truncated, info);
+
+		// Whatever is found must be what the whole file holds.
+		CHECK(!info.has_product_name || std::string(info.product_name) == full.product_name);
+		CHECK((info.imports & ~full.imports) == 0);
+		CHECK(parsed || !info.imports);
+	}
+}
+
+TEST(Fuzz)
+{
+	constexpr int ITERATIONS{ 20'000 };
+
+	Fixture fixture;
+	fixture.imports = { "KERNEL32.dll", "xinput1_3.dll" };
+	fixture.delay_imports = { "xinput9_1_0.dll" };
+	auto original = BuildPe(fixture);
+
+	std::mt19937 rng{ 54321 };
+	int parsed{ 0 };
+
+	for (int i = 0; i < ITERATIONS; ++i)
+	{
+		auto data = original;
+		for (auto mutations = 1 + rng() % 6; mutations; --mutations)
+		{
+			auto pos = rng() % data.size();
+			auto value = rng();
+			if (rng() % 2)
+				data[pos] = static_cast<uint8_t>(value);
+			else if (pos + 4 <= data.size())
+				std::memcpy(&data[pos], &value, 4);
+		}
+
+		PeInfo info;
+		if (Parse(data, info))
+			++parsed;
+
+		CHECK(std::strlen(info.product_name) < sizeof(info.product_name));
+		CHECK(std::strlen(info.product_version) < sizeof(info.product_version));
+		CHECK(info.imports < (1u << std::size(PE_NOTED_IMPORTS)));
+	}
+
+	std::printf("  %d of %d mutations parsed\n", parsed, ITERATIONS);
+}
+
+TEST(ParseBenchmark)
+{
+	Fixture fixture;
+	fixture.imports = { "KERNEL32.dll", "USER32.dll", "xinput1_3.dll" };
+	auto data = BuildPe(fixture);
+
+	size_t found{ 0 };
+	Benchmark("ParsePeFile", 100'000, [&](size_t) {
+		PeInfo info;
+		found += ParsePeFile(data.data(), data.size(), info) && info.has_product_name;
+	});
+	CHECK(found == 100'000);
+}
@@ -0,0 +1,147 @@
+// PollDetector against synthetic timelines, and ones shaped like the calls
+// recorded from games: a burst at start-up or in menus, then a steady timer.
+
+#include "Test.h"
+#include "PollDetector.h"
+
+#include <random>
+
+namespace
+{
+	constexpr uint64_t SECOND_US{ 1'000'000 };
+
+	// Feed call times in, returning whether the thread ended up judged a poller.
+	bool Replay(PollDetector& detector, const std::vector<uint64_t>& times_us)
+	{
+		for (auto time_us : times_us)
+			detector.Call(time_us);
+
+		return detector.IsPoller();
+	}
+
+	std::vector<uint64_t> Regular(uint64_t start_us, uint64_t period_us, size_t calls, uint64_t jitter_us = 0, uint32_t seed = 1)
+	{
+		std::mt19937 rng{ seed };
+		std::vector<uint64_t> times_us;
+
+		for (size_t i = 0; i < calls; ++i)
+		{
+			auto offset_us = jitter_us ? rng() % (2 * jitter_us + 1) : 0;
+			times_us.push_back(start_us + i * period_us + offset_us);
+		}
+
+		return times_us;
+	}
+
+	std::vector<uint64_t> Concat(std::vector<uint64_t> a, const std::vector<uint64_t>& b)
+	{
+		a.insert(a.end(), b.begin(), b.end());
+		return a;
+	}
+}
+
+TEST(NeedsSeveralIntervals)
+{
+	// The initial jitter estimate is pessimistic, so even a perfect timer takes
+	// a call or two beyond the minimum to be recognised.
+	PollDetector detector;
+	auto times_us = Regular(SECOND_US, SECOND_US, 10);
+	size_t first_poller{ 0 };
+
+	for (size_t i = 0; i < times_us.size(); ++i)
+	{
+		detector.Call(times_us[i]);
+		if (detector.IsPoller() && !first_poller)
+			first_poller = i;
+	}
+
+	CHECK(first_poller > POLL_MIN_INTERVALS - 1 && first_poller <= POLL_MIN_INTERVALS + 2);
+	CHECK(detector.IsPoller());
+	CHECK(detector.PeriodUs() == static_cast<int64_t>(SECOND_US));
+}
+
+TEST(SteadyTimers)
+{
+	const uint64_t PERIODS_US[]{ POLL_MIN_PERIOD_US, SECOND_US / 2, SECOND_US, 5 * SECOND_US, 30 * SECOND_US };
+
+	for (auto period_us : PERIODS_US)
+	{
+		PollDetector detector;
+		CHECK(Replay(detector, Regular(0, period_us, 20, period_us / 20)));
+
+		auto error_us = detector.PeriodUs() - static_cast<int64_t>(period_us);
+		CHECK(error_us * 10 <= static_cast<int64_t>(period_us) && -error_us * 10 <= static_cast<int64_t>(period_us));
+	}
+}
+
+TEST(FastRepeatsAreBursts)
+{
+	PollDetector detector;
+	CHECK(!Replay(detector, Regular(0, 100'000, 100)));
+}
+
+TEST(HeavyJitterIsNotPolling)
+{
+	PollDetector detector;
+	CHECK(!Replay(detector, Regular(0, SECOND_US, 50, SECOND_US / 2)));
+	CHECK(detector.JitterUs() * 100 > detector.PeriodUs() * POLL_MAX_JITTER_PERCENT);
+}
+
+TEST(UiDrivenCalls)
+{
+	// Menu navigation: irregular gaps of a fraction of a second to many seconds.
+	PollDetector detector;
+	std::vector<uint64_t> times_us;
+	uint64_t time_us{ 0 };
+
+	for (auto gap_ms : { 300, 4200, 800, 12000, 650, 2500, 9000, 400, 1500, 7000, 350, 20000 })
+		times_us.push_back(time_us += gap_ms * 1000ull);
+
+	CHECK(!Replay(detector, times_us));
+}
+
+TEST(LongGapRestartsDetection)
+{
+	PollDetector detector;
+	CHECK(Replay(detector, Regular(0, SECOND_US, 10)));
+
+	// Paused long enough that the old period says nothing about the new one.
+	auto resume_us = 10 * SECOND_US + POLL_MAX_PERIOD_US + 1;
+	detector.Call(resume_us);
+	CHECK(!detector.IsPoller());
+
+	CHECK(Replay(detector, Regular(resume_us + 2 * SECOND_US, 2 * SECOND_US, 10)));
+}
+
+TEST(StartupBurstThenTimer)
+{
+	// Start-up enumerates repeatedly in quick succession, then a hot-plug
+	// timer takes over, which should be recognised despite the burst.
+	auto burst = Regular(0, 20'000, 15, 5'000);
+	auto timer = Regular(2 * SECOND_US, SECOND_US, 30, 30'000);
+
+	PollDetector detector;
+	CHECK(Replay(detector, Concat(burst, timer)));
+	CHECK(detector.PeriodUs() > 900'000 && detector.PeriodUs() < 1'100'000);
+}
+
+TEST(TimerWithMissedTicks)
+{
+	// A timer stalled by loading, so the odd interval is a multiple of the period.
+	std::vector<uint64_t> times_us;
+	for (uint64_t tick = 0; tick < 60; ++tick)
+	{
+		if (tick % 17 != 5)
+			times_us.push_back(tick * SECOND_US);
+	}
+
+	PollDetector detector;
+	CHECK(Replay(detector, times_us));
+}
+
+TEST(CallBenchmark)
+{
+	PollDetector detector;
+	Benchmark("Call", 1'000'000, [&](size_t i) { detector.Call(i * SECOND_US); });
+	CHECK(detector.IsPoller());
+}
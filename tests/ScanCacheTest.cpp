@@ -0,0 +1,239 @@
+// The installer's scan cache: what survives a save and load, what's rejected,
+// and when an executable's remembered result may be used.
+
+#include "Test.h"
+#include "ScanCache.h"
+
+#include <cstddef>
+#include <random>
+
+namespace
+{
+	constexpr uint8_t XINPUT1_3{ 1 }, XINPUT9_1_0{ 4 };
+
+	bool Same(const ExeScan& a, const ExeScan& b)
+	{
+		return a.size == b.size && a.write_time == b.write_time && a.is_game == b.is_game &&
+			a.is_x64 == b.is_x64 && a.is_fixed == b.is_fixed && a.imports == b.imports;
+	}
+
+	// Steam and retail installs, a game and its helper executables.
+	ScanCacheMap GameLibrary()
+	{
+		ScanCacheMap dirs;
+		auto& rally = dirs["c:\\steam\\steamapps\\common\\dirt rally"];
+		rally["drt.exe"] = ExeScan{ 53'000'000, 131'000'000'000'000'000, true, false, true, XINPUT1_3 };
+		rally["crashreporter.exe"] = ExeScan{ 400'000, 131'000'000'000'000'001 };
+
+		auto& dirt4 = dirs["d:\\games\\dirt 4"];
+		dirt4["dirt4.exe"] = ExeScan{ 90'000'000, 131'500'000'000'000'000, true, true, false, XINPUT1_3 | XINPUT9_1_0 };
+		return dirs;
+	}
+
+	void UpdateChecksum(std::vector<uint8_t>& data)
+	{
+		Fnv1a64 hash;
+		hash.Update(data.data() + sizeof(ScanCacheHeader), data.size() - sizeof(ScanCacheHeader));
+		auto checksum = hash.Value();
+		std::memcpy(data.data() + offsetof(ScanCacheHeader, checksum), &checksum, sizeof(checksum));
+	}
+
+	void LoadLibrary(ScanCache& cache)
+	{
+		cache.Load(SerializeScanCache(GameLibrary()));
+	}
+}
+
+TEST(RoundTrip)
+{
+	auto dirs = GameLibrary();
+	ScanCacheMap loaded;
+	CHECK(ParseScanCache(SerializeScanCache(dirs), loaded));
+	CHECK(loaded.size() == dirs.size());
+
+	for (auto& [dir, exes] : dirs)
+	{
+		CHECK(loaded[dir].size() == exes.size());
+		for (auto& [name, exe] : exes)
+			CHECK(Same(loaded[dir][name], exe));
+	}
+
+	// An empty cache is still a valid file.
+	CHECK(ParseScanCache(SerializeScanCache({}), loaded) && loaded.empty());
+}
+
+TEST(OtherVersionsRejected)
+{
+	auto data = SerializeScanCache(GameLibrary());
+
+	auto version = data;
+	version[offsetof(ScanCacheHeader, version)] = SCAN_CACHE_VERSION + 1;
+
+	auto magic = data;
+	magic[0] = 'd';
+
+	ScanCacheMap loaded{ { "kept", {} } };
+	CHECK(!ParseScanCache(version, loaded));
+	CHECK(!ParseScanCache(magic, loaded));
+	CHECK(loaded.size() == 1 && loaded.count("kept"));		// untouched on failure
+}
+
+TEST(DamageRejected)
+{
+	auto data = SerializeScanCache(GameLibrary());
+	ScanCacheMap loaded;
+
+	for (size_t size = 0; size < data.size(); ++size)
+		CHECK(!ParseScanCache(std::vector<uint8_t>(data.begin(), data.begin() + size), loaded));
+
+	auto flipped = data;
+	flipped.back() ^= 1;
+	CHECK(!ParseScanCache(flipped, loaded));
+
+	// Trailing bytes, even with a checksum to match.
+	auto longer = data;
+	longer.push_back(0);
+	UpdateChecksum(longer);
+	CHECK(!ParseScanCache(longer, loaded));
+
+	// Too many directories for the header to be believed.
+	auto too_many = data;
+	auto num_dirs = MAX_SCAN_CACHE_DIRS + 1;
+	std::memcpy(&too_many[offsetof(ScanCacheHeader, num_dirs)], &num_dirs, sizeof(num_dirs));
+	CHECK(!ParseScanCache(too_many, loaded));
+}
+
+TEST(OversizedEntriesLeftOut)
+{
+	auto dirs = GameLibrary();
+	dirs[std::string(MAX_SCAN_CACHE_NAME + 1, 'x')]["game.exe"] = ExeScan{ 1, 1 };
+	dirs["e:\\long names"][std::string(MAX_SCAN_CACHE_NAME + 1, 'y')] = ExeScan{ 1, 1 };
+
+	auto& crowded = dirs["e:\\crowded"];
+	for (uint32_t i = 0; i <= MAX_SCAN_CACHE_EXES; ++i)
+		crowded["tool" + std::to_string(i) + ".exe"] = ExeScan{ i, i };
+
+	ScanCacheMap loaded;
+	CHECK(ParseScanCache(SerializeScanCache(dirs), loaded));
+	CHECK(loaded.size() == GameLibrary().size());
+
+	// Only the first MAX_SCAN_CACHE_DIRS are kept.
+	ScanCacheMap many;
+	for (uint32_t i = 0; i < MAX_SCAN_CACHE_DIRS + 10; ++i)
+		many["dir" + std::to_string(i)]["game.exe"] = ExeScan{ i, i };
+
+	CHECK(ParseScanCache(SerializeScanCache(many), loaded));
+	CHECK(loaded.size() == MAX_SCAN_CACHE_DIRS);
+}
+
+TEST(FindOnlyUnchanged)
+{
+	ScanCache cache;
+	LoadLibrary(cache);
+	auto expected = GameLibrary()["d:\\games\\dirt 4"]["dirt4.exe"];
+	ExeScan scan;
+
+	CHECK(cache.Find("D:\\Games\\DiRT 4", "DIRT4.EXE", expected.size, expected.write_time, scan));
+	CHECK(Same(scan, expected));
+
+	CHECK(!cache.Find("d:\\games\\dirt 4", "dirt4.exe", expected.size + 1, expected.write_time, scan));
+	CHECK(!cache.Find("d:\\games\\dirt 4", "dirt4.exe", expected.size, expected.write_time + 1, scan));
+	CHECK(!cache.Find("d:\\games\\dirt 4", "dirt5.exe", expected.size, expected.write_time, scan));
+	CHECK(!cache.Find("d:\\games\\dirt", "dirt4.exe", expected.size, expected.write_time, scan));
+}
+
+TEST(SavedOnlyWhenChanged)
+{
+	ScanCache cache;
+	LoadLibrary(cache);
+	std::vector<uint8_t> data;
+	CHECK(!cache.Save(data) && data.empty());
+
+	cache.Store("E:\\Games\\GRID", "Grid.exe", ExeScan{ 10, 20, true });
+	CHECK(cache.Save(data));
+	CHECK(!cache.Save(data));
+
+	ScanCache reloaded;
+	CHECK(reloaded.Load(data));
+	ExeScan scan;
+	CHECK(reloaded.Find("e:\\games\\grid", "grid.exe", 10, 20, scan) && scan.is_game);
+
+	// A damaged file is replaced on the next save, even with nothing new.
+	data[sizeof(ScanCacheHeader)] ^= 1;
+	CHECK(!reloaded.Load(data));
+	CHECK(!reloaded.Find("e:\\games\\grid", "grid.exe", 10, 20, scan));
+	CHECK(reloaded.Save(data));
+
+	ScanCacheMap loaded;
+	CHECK(ParseScanCache(data, loaded) && loaded.empty());
+}
+
+TEST(Prune)
+{
+	ScanCache cache;
+	LoadLibrary(cache);
+	std::vector<uint8_t> data;
+	ExeScan scan;
+
+	// Everything still present, so nothing to save.
+	cache.Prune("c:\\steam\\steamapps\\common\\dirt rally", { "DRT.exe", "CrashReporter.exe" });
+	cache.Prune("c:\\not cached", {});
+	CHECK(!cache.Save(data));
+
+	cache.Prune("C:\\Steam\\steamapps\\common\\DiRT Rally", { "drt.exe" });
+	CHECK(cache.Save(data));
+	CHECK(!cache.Find("c:\\steam\\steamapps\\common\\dirt rally", "crashreporter.exe", 400'000, 131'000'000'000'000'001, scan));
+	CHECK(cache.Find("c:\\steam\\steamapps\\common\\dirt rally", "drt.exe", 53'000'000, 131'000'000'000'000'000, scan));
+
+	// An uninstalled game's directory goes entirely.
+	cache.Prune("d:\\games\\dirt 4", {});
+	CHECK(cache.Save(data));
+
+	ScanCacheMap loaded;
+	CHECK(ParseScanCache(data, loaded));
+	CHECK(loaded.size() == 1 && loaded.begin()->second.size() == 1);
+}
+
+TEST(Fuzz)
+{
+	// Mutations with a fresh checksum, so they reach the parsing beyond it.
+	constexpr int ITERATIONS{ 50'000 };
+
+	auto original = SerializeScanCache(GameLibrary());
+	std::mt19937 rng{ 2024 };
+	int parsed{ 0 };
+
+	for (int i = 0; i < ITERATIONS; ++i)
+	{
+		auto data = original;
+		switch (rng() % 3)
+		{
+		case 0:
+			data[sizeof(ScanCacheHeader) + rng() % (data.size() - sizeof(ScanCacheHeader))] = static_cast<uint8_t>(rng());
+			break;
+
+		case 1:
+			data.resize(sizeof(ScanCacheHeader) + rng() % (data.size() - sizeof(ScanCacheHeader)));
+			break;
+
+		default:
+			data.insert(data.begin() + sizeof(ScanCacheHeader) + rng() % (data.size() - sizeof(ScanCacheHeader)),
+				static_cast<uint8_t>(rng()));
+			break;
+		}
+		UpdateChecksum(data);
+
+		ScanCacheMap loaded;
+		if (!ParseScanCache(data, loaded))
+			continue;
+
+		// Unknown flags and reordered names aren't kept, but whatever parses must
+		// then survive being saved and loaded again.
+		++parsed;
+		auto saved = SerializeScanCache(loaded);
+		ScanCacheMap reloaded;
+		CHECK(ParseScanCache(saved, reloaded) && SerializeScanCache(reloaded) == saved);
+	}
+
+	std::printf("  %d of %d mutations parsed\n", parsed, ITERATIONS);
+}
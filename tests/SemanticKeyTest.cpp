@@ -0,0 +1,143 @@
+// Semantic enumeration keys built from a mock action map, and their use as
+// DeviceCache keys as the shim does.
+
+#include "Test.h"
+#include "DeviceCache.h"
+#include "SemanticKey.h"
+
+#include <utility>
+
+namespace
+{
+	struct MockGuid
+	{
+		uint32_t Data1;
+		uint16_t Data2;
+		uint16_t Data3;
+		uint8_t Data4[8];
+	};
+
+	// Laid out like DIACTIONA, where only some fields decide the results.
+	struct MockAction
+	{
+		uintptr_t uAppData;
+		uint32_t dwSemantic;
+		uint32_t dwFlags;
+		const char* lptszActionName;
+		MockGuid guidInstance;
+		uint32_t dwObjID;
+		uint32_t dwHow;
+	};
+
+	struct MockSemanticEntry
+	{
+		uint32_t dwDevType;
+		uint32_t dwFlags;
+	};
+
+	std::vector<MockAction> RacingActions()
+	{
+		return {
+			{ 1, 0x01000201, 0, "Steer", {}, 0, 0 },
+			{ 2, 0x01000202, 0, "Accelerate", {}, 0, 0 },
+			{ 3, 0x01000203, 0, "Brake", {}, 0, 0 },
+		};
+	}
+
+	// The map GUID, genre and count are added by the shim before the actions.
+	std::wstring MockSemanticKey(const std::vector<MockAction>& actions)
+	{
+		std::wstring key{ L"{map}|genre|" + std::to_wstring(actions.size()) };
+		AppendSemanticActions(key, actions.data(), static_cast<uint32_t>(actions.size()));
+		return key;
+	}
+}
+
+TEST(KeyBytesAreHex)
+{
+	std::wstring key;
+	const uint8_t bytes[]{ 0x00, 0x7f, 0xa5, 0xff };
+	AppendKeyBytes(key, bytes, sizeof(bytes));
+	CHECK(key == L"007fa5ff");
+}
+
+TEST(NoActions)
+{
+	std::wstring key{ L"prefix" };
+	AppendSemanticActions(key, static_cast<const MockAction*>(nullptr), 5);
+	CHECK(key == L"prefix");
+
+	auto actions = RacingActions();
+	AppendSemanticActions(key, actions.data(), 0);
+	CHECK(key == L"prefix");
+}
+
+TEST(SameActionsSameKey)
+{
+	// Copies of the map at another address, as a game may rebuild it per call.
+	auto actions = RacingActions();
+	auto copy = actions;
+	CHECK(MockSemanticKey(actions) == MockSemanticKey(copy));
+
+	// Names and the mapping DirectInput fills in don't change which devices fit.
+	copy[1].lptszActionName = "Throttle";
+	copy[1].dwObjID = 0x1234;
+	copy[1].dwHow = 1;
+	CHECK(MockSemanticKey(actions) == MockSemanticKey(copy));
+}
+
+TEST(EachKeyedFieldChangesKey)
+{
+	auto base = MockSemanticKey(RacingActions());
+	std::vector<void (*)(MockAction&)> changes{
+		[](MockAction& action) { action.dwSemantic ^= 1; },
+		[](MockAction& action) { action.dwFlags |= 0x1; },			// DIA_FORCEFEEDBACK
+		[](MockAction& action) { action.uAppData += 100; },
+		[](MockAction& action) { action.guidInstance.Data1 = 1; },
+		[](MockAction& action) { action.guidInstance.Data4[7] = 1; },
+	};
+
+	for (auto& change : changes)
+	{
+		for (size_t i = 0; i < 3; ++i)
+		{
+			auto actions = RacingActions();
+			change(actions[i]);
+			CHECK(MockSemanticKey(actions) != base);
+		}
+	}
+}
+
+TEST(ActionOrderChangesKey)
+{
+	auto actions = RacingActions();
+	auto swapped = actions;
+	std::swap(swapped[0], swapped[2]);
+	CHECK(MockSemanticKey(actions) != MockSemanticKey(swapped));
+}
+
+TEST(SemanticCacheLookups)
+{
+	DeviceCache<MockSemanticEntry, std::wstring> cache;
+	auto actions = RacingActions();
+
+	DeviceSnapshot<MockSemanticEntry> snapshot;
+	snapshot.Add(MockSemanticEntry{ DEVTYPE_JOYSTICK, 0 });
+	cache.Store(MockSemanticKey(actions), std::move(snapshot));
+
+	auto same = RacingActions();
+	CHECK(cache.Read().Find(MockSemanticKey(same)) != nullptr);
+
+	// A map asking for force feedback on one action may be offered other devices.
+	auto changed = RacingActions();
+	changed[0].dwFlags = 1;
+	CHECK(cache.Read().Find(MockSemanticKey(changed)) == nullptr);
+}
+
+TEST(KeyBenchmark)
+{
+	std::vector<MockAction> actions(64, RacingActions().front());
+	size_t total{ 0 };
+	Benchmark("64 action key", 10'000, [&](size_t) { total += MockSemanticKey(actions).size(); });
+	CHECK(total > 0);
+}
@@ -0,0 +1,234 @@
+// SetupMemo hit rates over repeated enumerations of a mock device tree, with
+// the set lending and invalidation rules the shim relies on.
+
+#include "Test.h"
+#include "SetupMemo.h"
+
+#include <string>
+
+namespace
+{
+	constexpr uint32_t ERROR_INSUFFICIENT_BUFFER{ 122 };
+	constexpr uint32_t ERROR_INVALID_DATA{ 13 };
+
+	const SetupClassKey HID_CLASS{ { 0x4d, 0x1e, 0x55, 0xb2 }, 0x12, true };		// DIGCF_PRESENT | DIGCF_DEVICEINTERFACE
+
+	// Devices whose odd-numbered properties are missing, as most are, with
+	// counts of the real queries made and information sets opened and closed.
+	class MockDeviceTree
+	{
+	public:
+		MockDeviceTree(uint32_t num_devices, uint32_t num_properties) :
+			m_num_devices(num_devices), m_num_properties(num_properties) {}
+
+		// Enumerate the way DirectInput does, through the memo.
+		SetupMemoStats Enumerate(SetupMemo& memo)
+		{
+			SetupMemoStats stats;
+
+			uintptr_t handle{};
+			if (!memo.AcquireClass(HID_CLASS, handle, stats))
+			{
+				auto generation = memo.Generation();
+				handle = ++m_opened;
+				memo.AddClass(HID_CLASS, handle, generation);
+			}
+
+			for (uint32_t dev_inst = 1; dev_inst <= m_num_devices; ++dev_inst)
+			{
+				for (uint32_t property = 0; property < m_num_properties; ++property)
+				{
+					SetupPropertyKey key{ SetupQuery::DevNodeRegistryPropertyW, dev_inst, property };
+					memo.Property(key, [&] { return Query(dev_inst, property); }, stats);
+				}
+			}
+
+			if (memo.ReleaseClass(handle))
+				++m_destroyed;
+
+			return stats;
+		}
+
+		SetupPropertyResult Query(uint32_t dev_inst, uint32_t property)
+		{
+			++m_queries;
+
+			SetupPropertyResult result;
+			if (property % 2)
+				result.status = ERROR_INVALID_DATA;
+			else
+			{
+				auto value = "Device " + std::to_string(dev_inst) + " property " + std::to_string(property);
+				result.type = 1;		// REG_SZ
+				result.data.assign(value.begin(), value.end());
+			}
+
+			return result;
+		}
+
+		void Invalidate(SetupMemo& memo) { m_destroyed += static_cast<uint32_t>(memo.Invalidate().size()); }
+
+		uint32_t Queries() const { return m_queries; }
+		uint32_t Opened() const { return m_opened; }
+		uint32_t Destroyed() const { return m_destroyed; }
+
+	private:
+		uint32_t m_num_devices;
+		uint32_t m_num_properties;
+		uint32_t m_queries{ 0 };
+		uint32_t m_opened{ 0 };
+		uint32_t m_destroyed{ 0 };
+	};
+
+	double HitRate(const SetupMemoStats& stats)
+	{
+		auto total = stats.hits + stats.misses;
+		return total ? 100.0 * stats.hits / total : 0.0;
+	}
+}
+
+TEST(RepeatEnumerationsHit)
+{
+	SetupMemo memo;
+	MockDeviceTree tree(8, 6);
+
+	auto first = tree.Enumerate(memo);
+	CHECK(first.hits == 0);
+	CHECK(first.misses == 1 + 8 * 6);
+	CHECK(tree.Queries() == 8 * 6);
+
+	for (int i = 0; i < 5; ++i)
+	{
+		auto stats = tree.Enumerate(memo);
+		CHECK(stats.misses == 0);
+		CHECK(stats.hits == 1 + 8 * 6);
+	}
+
+	CHECK(tree.Queries() == 8 * 6);
+	CHECK(tree.Opened() == 1);
+	CHECK(tree.Destroyed() == 0);
+}
+
+TEST(HotPlugSession)
+{
+	// A game enumerating every few seconds, with a controller plugged in and
+	// out twice, each invalidating the memo.
+	SetupMemo memo;
+	MockDeviceTree tree(12, 8);
+	SetupMemoStats total;
+
+	for (int i = 0; i < 40; ++i)
+	{
+		if (i == 15 || i == 30)
+			tree.Invalidate(memo);
+
+		auto stats = tree.Enumerate(memo);
+		total.hits += stats.hits;
+		total.misses += stats.misses;
+	}
+
+	auto rate = HitRate(total);
+	std::printf("  hit rate %.1f%%, %u real queries\n", rate, tree.Queries());
+	CHECK(tree.Queries() == 3 * 12 * 8);
+	CHECK(rate > 90.0);
+
+	tree.Invalidate(memo);
+	CHECK(tree.Opened() == tree.Destroyed());
+}
+
+TEST(ChangeDuringQueryNotKept)
+{
+	SetupMemo memo;
+	SetupMemoStats stats;
+	SetupPropertyKey key{ SetupQuery::DeviceRegistryPropertyA, 1, 0 };
+
+	auto result = memo.Property(key, [&] {
+		memo.Invalidate();		// a HID arrival while DirectInput was reading
+		return SetupPropertyResult{ 0, 1, { 'o', 'l', 'd' } };
+	}, stats);
+
+	CHECK(result.data.size() == 3);
+
+	int queries{ 0 };
+	memo.Property(key, [&] { ++queries; return SetupPropertyResult{}; }, stats);
+	CHECK(queries == 1);
+	CHECK(stats.misses == 2 && stats.hits == 0);
+}
+
+TEST(QueriesAreDistinct)
+{
+	SetupMemo memo;
+	SetupMemoStats stats;
+	int queries{ 0 };
+	auto query = [&] { ++queries; return SetupPropertyResult{}; };
+
+	for (auto kind : { SetupQuery::DeviceRegistryPropertyA, SetupQuery::DeviceRegistryPropertyW,
+		SetupQuery::DevNodeRegistryPropertyA, SetupQuery::DevNodeRegistryPropertyW })
+	{
+		memo.Property(SetupPropertyKey{ kind, 1, 0 }, query, stats);
+		memo.Property(SetupPropertyKey{ kind, 2, 0 }, query, stats);
+		memo.Property(SetupPropertyKey{ kind, 1, 1 }, query, stats);
+	}
+
+	CHECK(queries == 12);
+	CHECK(stats.hits == 0);
+}
+
+TEST(SetsLentToOneUser)
+{
+	SetupMemo memo;
+	SetupMemoStats stats;
+	uintptr_t handle{}, other{};
+
+	CHECK(memo.AddClass(HID_CLASS, 1, memo.Generation()));
+	CHECK(!memo.AddClass(HID_CLASS, 2, memo.Generation()));		// caller keeps set 2
+
+	// Still on loan to the caller that added it.
+	CHECK(!memo.AcquireClass(HID_CLASS, other, stats));
+	CHECK(!memo.ReleaseClass(1));
+	CHECK(memo.AcquireClass(HID_CLASS, handle, stats) && handle == 1);
+
+	// Narrow and wide requests are kept apart.
+	auto narrow = HID_CLASS;
+	narrow.wide = false;
+	CHECK(!memo.AcquireClass(narrow, other, stats));
+
+	// Dropped while on loan, so the borrower destroys it on release.
+	CHECK(memo.Invalidate().empty());
+	CHECK(memo.ReleaseClass(handle));
+
+	// Opened before a change, so it can't be kept.
+	auto generation = memo.Generation();
+	memo.Invalidate();
+	CHECK(!memo.AddClass(HID_CLASS, 3, generation));
+	CHECK(memo.ReleaseClass(3));
+}
+
+TEST(CopyToCallerBuffer)
+{
+	SetupPropertyResult present{ 0, 1, { 'a', 'b', 'c', 0 } };
+	SetupPropertyResult missing{ ERROR_INVALID_DATA, 0, {} };
+	SetupPropertyResult empty{ 0, 1, {} };
+	char buffer[8]{};
+	void* volatile no_buffer{};		// asking for the size, hidden from -Wnonnull
+	uint32_t required{};
+
+	CHECK(CopySetupProperty(present, no_buffer, 0, required, ERROR_INSUFFICIENT_BUFFER) == ERROR_INSUFFICIENT_BUFFER);
+	CHECK(required == 4);
+	CHECK(CopySetupProperty(present, buffer, 3, required, ERROR_INSUFFICIENT_BUFFER) == ERROR_INSUFFICIENT_BUFFER);
+	CHECK(CopySetupProperty(present, buffer, sizeof(buffer), required, ERROR_INSUFFICIENT_BUFFER) == 0);
+	CHECK(std::string(buffer) == "abc");
+
+	CHECK(CopySetupProperty(missing, buffer, sizeof(buffer), required, ERROR_INSUFFICIENT_BUFFER) == ERROR_INVALID_DATA);
+	CHECK(CopySetupProperty(empty, no_buffer, 0, required, ERROR_INSUFFICIENT_BUFFER) == 0 && required == 0);
+}
+
+TEST(EnumerationBenchmark)
+{
+	SetupMemo memo;
+	MockDeviceTree tree(16, 10);
+	tree.Enumerate(memo);
+
+	Benchmark("memoised enumeration", 10'000, [&](size_t) { tree.Enumerate(memo); });
+	CHECK(tree.Queries() == 16 * 10);
+}
@@ -0,0 +1,83 @@
+// The policy control seqlock, including a writer killed part way through,
+// which mustn't leave the game's threads waiting on it.
+
+#include "Test.h"
+#include "ShimControl.h"
+
+#include <chrono>
+#include <thread>
+
+namespace
+{
+	const ShimPolicy THROTTLED{ ShimMode::Throttle, 20, DEFAULT_FRAME_BUDGET_US };
+
+	bool Same(const ShimPolicy& a, const ShimPolicy& b)
+	{
+		return a.mode == b.mode && a.max_calls == b.max_calls && a.budget_us == b.budget_us;
+	}
+}
+
+TEST(WriteThenRead)
+{
+	ShimControl control{};
+	control.Write(THROTTLED);
+
+	ShimPolicy policy{};
+	CHECK(control.Read(policy) && Same(policy, THROTTLED));
+	CHECK(control.sequence == 2);
+}
+
+TEST(AbandonedWrite)
+{
+	ShimControl control{};
+	control.Write(THROTTLED);
+
+	// The tool was killed after claiming the sequence.
+	++control.sequence;
+	control.mode = static_cast<uint32_t>(ShimMode::PassThrough);
+
+	auto policy = THROTTLED;
+	auto start = std::chrono::steady_clock::now();
+	CHECK(!control.Read(policy));
+	CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+	CHECK(Same(policy, THROTTLED));				// the caller's last good policy
+
+	// The next change takes over, and reading works again.
+	const ShimPolicy adaptive{ ShimMode::Adaptive, 4, 5'000 };
+	control.Write(adaptive);
+	CHECK(!(control.sequence & 1));
+	CHECK(control.Read(policy) && Same(policy, adaptive));
+}
+
+TEST(ReadersNeverTear)
+{
+	ShimControl control{};
+	control.Write(ShimPolicy{ ShimMode::Cached, 0, 0 });
+
+	std::atomic<bool> done{ false };
+	std::atomic<uint64_t> reads{ 0 }, torn{ 0 };
+
+	std::thread reader([&] {
+		while (!done)
+		{
+			ShimPolicy policy{};
+			if (!control.Read(policy))
+				continue;
+
+			torn += policy.max_calls != policy.budget_us;
+			++reads;
+		}
+	});
+
+	// Keep writing until the reader has had a fair chance to overlap.
+	uint32_t n{ 0 };
+	while (++n < 200'000 || reads < 10'000)
+		control.Write(ShimPolicy{ ShimMode::Cached, n, n });
+
+	done = true;
+	reader.join();
+
+	CHECK(torn == 0);
+	CHECK(!(control.sequence & 1));
+	std::printf("  %llu reads during %u writes\n", static_cast<unsigned long long>(reads.load()), n);
+}
@@ -0,0 +1,48 @@
+// Minimal harness for the tests here, which cover the headers that are kept
+// free of Windows so they can be built and run anywhere.
+//
+// Each test is registered with TEST and checks its results with CHECK, which
+// reports a failure and carries on. Benchmarks run with the tests, printing
+// their timings without judging them.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+struct TestCase
+{
+	const char* name;
+	void (*func)();
+};
+
+std::vector<TestCase>& TestCases();
+void TestFailed(const char* file, int line, const char* expr);
+
+struct TestRegistrar
+{
+	TestRegistrar(const char* name, void (*func)()) { TestCases().push_back(TestCase{ name, func }); }
+};
+
+#define TEST(name) \
+	static void name(); \
+	static TestRegistrar name##_registrar{ #name, name }; \
+	static void name()
+
+#define CHECK(expr) ((expr) ? (void)0 : TestFailed(__FILE__, __LINE__, #expr))
+
+// Time a number of calls to func(i), printing and returning the mean in ns.
+template <typename Func>
+double Benchmark(const char* name, size_t iterations, Func&& func)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; ++i)
+		func(i);
+
+	auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+	auto mean_ns = elapsed.count() / static_cast<double>(iterations ? iterations : 1);
+	std::printf("  %s: %.1fns\n", name, mean_ns);
+	return mean_ns;
+}
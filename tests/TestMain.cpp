@@ -0,0 +1,48 @@
+// Runs the tests registered in the executable, or only those named on the
+// command line, returning the number that failed.
+
+#include "Test.h"
+
+#include <cstring>
+
+static int s_failures{ 0 };
+
+std::vector<TestCase>& TestCases()
+{
+	static std::vector<TestCase> cases;
+	return cases;
+}
+
+void TestFailed(const char* file, int line, const char* expr)
+{
+	std::printf("  %s(%d): CHECK(%s) failed\n", file, line, expr);
+	++s_failures;
+}
+
+int main(int argc, char* argv[])
+{
+	int failed{ 0 };
+
+	for (auto& test : TestCases())
+	{
+		auto selected = argc < 2;
+		for (int i = 1; i < argc; ++i)
+			selected |= !std::strcmp(argv[i], test.name);
+
+		if (!selected)
+			continue;
+
+		std::printf("%s\n", test.name);
+		auto failures = s_failures;
+		test.func();
+
+		if (s_failures != failures)
+		{
+			std::printf("%s: FAILED\n", test.name);
+			++failed;
+		}
+	}
+
+	std::printf("%d failed\n", failed);
+	return failed;
+}
@@ -0,0 +1,256 @@
+#include "pch.h"
+
+constexpr auto APP_NAME{ "DirtFix" };
+constexpr ULONGLONG EMPTY_SLOT_RECHECK_MS{ 2000 };	// in case an arrival is missed
+
+// System DLLs to chain to if there isn't one matching our own name.
+constexpr const char* SYSTEM_XINPUT_DLLS[]{ "xinput1_4.dll", "xinput1_3.dll", "xinput9_1_0.dll" };
+
+using GetStateFn = DWORD(WINAPI*)(DWORD dwUserIndex, XINPUT_STATE* pState);
+using SetStateFn = DWORD(WINAPI*)(DWORD dwUserIndex, XINPUT_VIBRATION* pVibration);
+using GetCapabilitiesFn = DWORD(WINAPI*)(DWORD dwUserIndex, DWORD dwFlags, XINPUT_CAPABILITIES* pCapabilities);
+using EnableFn = void(WINAPI*)(BOOL enable);
+using GetDSoundAudioDeviceGuidsFn = DWORD(WINAPI*)(DWORD dwUserIndex, GUID* pDSoundRenderGuid, GUID* pDSoundCaptureGuid);
+using GetBatteryInformationFn = DWORD(WINAPI*)(DWORD dwUserIndex, BYTE devType, void* pBatteryInformation);
+using GetKeystrokeFn = DWORD(WINAPI*)(DWORD dwUserIndex, DWORD dwReserved, void* pKeystroke);
+using GetStateExFn = DWORD(WINAPI*)(DWORD dwUserIndex, void* pState);
+using WaitForGuideButtonFn = DWORD(WINAPI*)(DWORD dwUserIndex, DWORD dwFlags, void* pListener);
+using UserIndexFn = DWORD(WINAPI*)(DWORD dwUserIndex);
+
+// Functions of the chained system DLL, any of which may be missing from older
+// versions, such as xinput9_1_0.dll with only the first four.
+struct SystemXInput
+{
+	GetStateFn pfnGetState;
+	SetStateFn pfnSetState;
+	GetCapabilitiesFn pfnGetCapabilities;
+	EnableFn pfnEnable;
+	GetDSoundAudioDeviceGuidsFn pfnGetDSoundAudioDeviceGuids;
+	GetBatteryInformationFn pfnGetBatteryInformation;
+	GetKeystrokeFn pfnGetKeystroke;
+	GetStateExFn pfnGetStateEx;						// ordinal 100
+	WaitForGuideButtonFn pfnWaitForGuideButton;		// ordinal 101
+	UserIndexFn pfnCancelGuideButtonWait;			// ordinal 102
+	UserIndexFn pfnPowerOffController;				// ordinal 103
+};
+
+HMODULE g_hinstDLL;
+HWND g_hwndNotify;
+
+// Tick count until which each slot is known to be empty, or zero if unknown.
+std::atomic<ULONGLONG> g_emptyUntil[XUSER_MAX_COUNT];
+std::atomic<uint32_t> g_arrivals;
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ForgetEmptySlots()
+{
+	++g_arrivals;
+
+	for (auto& empty_until : g_emptyUntil)
+		empty_until = 0;
+}
+
+LRESULT CALLBACK HidNotifySubclassProc(
+	HWND hWnd,
+	UINT uMsg,
+	WPARAM wParam,
+	LPARAM lParam,
+	UINT_PTR /*uIdSubclass*/,
+	DWORD_PTR /*dwRefData*/)
+{
+	auto p = reinterpret_cast<PDEV_BROADCAST_DEVICEINTERFACE>(lParam);
+
+	// Only arrivals matter, as removals are found by the next poll of the slot.
+	if (uMsg == WM_DEVICECHANGE &&
+		wParam == DBT_DEVICEARRIVAL &&
+		p->dbcc_devicetype == DBT_DEVTYP_DEVICEINTERFACE &&
+		p->dbcc_classguid == GUID_DEVINTERFACE_HID)
+	{
+		ForgetEmptySlots();
+	}
+
+	return DefSubclassProc(hWnd, uMsg, wParam, lParam);
+}
+
+// Thread owning a message-only window to receive the same HID arrival
+// notifications as the dinput8.dll shim, as XInput controllers also present
+// a HID interface.
+void NotifyThread()
+{
+	g_hwndNotify = CreateWindow("static", "", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, GetModuleHandle(NULL), 0L);
+	SetWindowSubclass(g_hwndNotify, HidNotifySubclassProc, 0, 0);
+
+	DEV_BROADCAST_DEVICEINTERFACE dbdi{};
+	dbdi.dbcc_size = sizeof(dbdi);
+	dbdi.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+	dbdi.dbcc_classguid = GUID_DEVINTERFACE_HID;
+	RegisterDeviceNotification(g_hwndNotify, &dbdi, DEVICE_NOTIFY_WINDOW_HANDLE);
+
+	MSG msg;
+	while (GetMessage(&msg, NULL, 0, 0) > 0)
+		DispatchMessage(&msg);
+}
+
+// Bind to the system DLL with our own name, so the one shim binary can be
+// installed as any of the XInput versions a game imports.
+SystemXInput LoadSystemXInput()
+{
+	char szModule[MAX_PATH]{};
+	GetModuleFileName(g_hinstDLL, szModule, _countof(szModule));
+
+	char szSystem[MAX_PATH]{};
+	GetSystemDirectory(szSystem, _countof(szSystem));	// System32 or SysWOW64
+
+	auto hmodXInput = LoadLibrary((fs::path(szSystem) / fs::path(szModule).filename()).u8string().c_str());
+
+	for (auto dll_name : SYSTEM_XINPUT_DLLS)
+	{
+		if (!hmodXInput)
+			hmodXInput = LoadLibrary((fs::path(szSystem) / dll_name).u8string().c_str());
+	}
+
+	SystemXInput system{};
+
+	if (!hmodXInput)
+	{
+		MessageBox(NULL, "Failed to bind to chained System32 XInput DLL", APP_NAME, MB_ICONSTOP);
+		return system;
+	}
+
+	system.pfnGetState = (GetStateFn)GetProcAddress(hmodXInput, "XInputGetState");
+	system.pfnSetState = (SetStateFn)GetProcAddress(hmodXInput, "XInputSetState");
+	system.pfnGetCapabilities = (GetCapabilitiesFn)GetProcAddress(hmodXInput, "XInputGetCapabilities");
+	system.pfnEnable = (EnableFn)GetProcAddress(hmodXInput, "XInputEnable");
+	system.pfnGetDSoundAudioDeviceGuids =
+		(GetDSoundAudioDeviceGuidsFn)GetProcAddress(hmodXInput, "XInputGetDSoundAudioDeviceGuids");
+	system.pfnGetBatteryInformation =
+		(GetBatteryInformationFn)GetProcAddress(hmodXInput, "XInputGetBatteryInformation");
+	system.pfnGetKeystroke = (GetKeystrokeFn)GetProcAddress(hmodXInput, "XInputGetKeystroke");
+	system.pfnGetStateEx = (GetStateExFn)GetProcAddress(hmodXInput, MAKEINTRESOURCE(100));
+	system.pfnWaitForGuideButton = (WaitForGuideButtonFn)GetProcAddress(hmodXInput, MAKEINTRESOURCE(101));
+	system.pfnCancelGuideButtonWait = (UserIndexFn)GetProcAddress(hmodXInput, MAKEINTRESOURCE(102));
+	system.pfnPowerOffController = (UserIndexFn)GetProcAddress(hmodXInput, MAKEINTRESOURCE(103));
+
+	std::thread(NotifyThread).detach();
+
+	return system;
+}
+
+const SystemXInput& System()
+{
+	static const SystemXInput system = LoadSystemXInput();
+	return system;
+}
+
+// Answer calls for a slot known to be empty without probing it, which otherwise
+// costs hundreds of microseconds for each of the empty slots polled every frame.
+template <typename Fn, typename... Args>
+DWORD SlotCall(Fn pfn, DWORD dwUserIndex, Args... args)
+{
+	if (!pfn)
+		return ERROR_DEVICE_NOT_CONNECTED;
+
+	auto slot = dwUserIndex < XUSER_MAX_COUNT;
+	if (slot && GetTickCount64() < g_emptyUntil[dwUserIndex])
+		return ERROR_DEVICE_NOT_CONNECTED;
+
+	auto arrivals = g_arrivals.load();
+	auto result = pfn(dwUserIndex, args...);
+
+	// Don't trust a result that may predate an arrival during the call.
+	if (slot && result == ERROR_DEVICE_NOT_CONNECTED && g_arrivals == arrivals)
+		g_emptyUntil[dwUserIndex] = GetTickCount64() + EMPTY_SLOT_RECHECK_MS;
+
+	return result;
+}
+
+template <typename Fn, typename... Args>
+DWORD ForwardCall(Fn pfn, Args... args)
+{
+	return pfn ? pfn(args...) : ERROR_DEVICE_NOT_CONNECTED;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+DWORD WINAPI
+XInputGetState(DWORD dwUserIndex, XINPUT_STATE* pState)
+{
+	return SlotCall(System().pfnGetState, dwUserIndex, pState);
+}
+
+DWORD WINAPI
+XInputSetState(DWORD dwUserIndex, XINPUT_VIBRATION* pVibration)
+{
+	return SlotCall(System().pfnSetState, dwUserIndex, pVibration);
+}
+
+DWORD WINAPI
+XInputGetCapabilities(DWORD dwUserIndex, DWORD dwFlags, XINPUT_CAPABILITIES* pCapabilities)
+{
+	return SlotCall(System().pfnGetCapabilities, dwUserIndex, dwFlags, pCapabilities);
+}
+
+DWORD WINAPI
+XInputGetDSoundAudioDeviceGuids(DWORD dwUserIndex, GUID* pDSoundRenderGuid, GUID* pDSoundCaptureGuid)
+{
+	return ForwardCall(System().pfnGetDSoundAudioDeviceGuids, dwUserIndex, pDSoundRenderGuid, pDSoundCaptureGuid);
+}
+
+// The next three are declared by Xinput.h only for some target versions, and
+// with different types, so they're renamed to their exports in xinput.def.
+extern "C" void WINAPI
+Shim_XInputEnable(BOOL enable)
+{
+	if (auto pfn = System().pfnEnable)
+		pfn(enable);
+}
+
+extern "C" DWORD WINAPI
+Shim_XInputGetBatteryInformation(DWORD dwUserIndex, BYTE devType, void* pBatteryInformation)
+{
+	return ForwardCall(System().pfnGetBatteryInformation, dwUserIndex, devType, pBatteryInformation);
+}
+
+extern "C" DWORD WINAPI
+Shim_XInputGetKeystroke(DWORD dwUserIndex, DWORD dwReserved, void* pKeystroke)
+{
+	return ForwardCall(System().pfnGetKeystroke, dwUserIndex, dwReserved, pKeystroke);
+}
+
+// Undocumented functions exported by ordinal only, used by some games to read
+// the guide button.
+extern "C" DWORD WINAPI
+XInputGetStateEx(DWORD dwUserIndex, void* pState)
+{
+	return SlotCall(System().pfnGetStateEx, dwUserIndex, pState);
+}
+
+extern "C" DWORD WINAPI
+XInputWaitForGuideButton(DWORD dwUserIndex, DWORD dwFlags, void* pListener)
+{
+	return ForwardCall(System().pfnWaitForGuideButton, dwUserIndex, dwFlags, pListener);
+}
+
+extern "C" DWORD WINAPI
+XInputCancelGuideButtonWait(DWORD dwUserIndex)
+{
+	return ForwardCall(System().pfnCancelGuideButtonWait, dwUserIndex);
+}
+
+extern "C" DWORD WINAPI
+XInputPowerOffController(DWORD dwUserIndex)
+{
+	return ForwardCall(System().pfnPowerOffController, dwUserIndex);
+}
+
+BOOL APIENTRY DllMain(
+	_In_ HMODULE hinstDLL,
+	_In_ DWORD  dwReason,
+	_In_ LPVOID /*lpvReserved*/)
+{
+	if (dwReason == DLL_PROCESS_ATTACH)
+		g_hinstDLL = hinstDLL;
+
+	return TRUE;
+}